@@ -0,0 +1,75 @@
+// Cost of the history store at 10k, 100k and 1M entries (or the sizes given
+// as arguments): filling it, loading the file at startup, and appending
+// one more command once it is that big. Prints the same tab-separated
+// lines as run.sh.
+//
+//   gcc -O2 -D_GNU_SOURCE -std=c11 -I.. -o history_bench history_bench.c
+
+#include <time.h>
+#include "history.h"
+
+#define APPENDS 2000
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *bench, size_t n, double value, const char *unit) {
+    printf("%s\tmyshell\t%zu\t%.3f\t%s\n", bench, n, value, unit);
+}
+
+static void run(size_t n, const char *dir) {
+    char path[4096], idx[4200], size[32];
+    snprintf(path, sizeof(path), "%s/history", dir);
+    snprintf(idx, sizeof(idx), "%s.idx", path);
+    snprintf(size, sizeof(size), "%zu", n);
+    unlink(path);
+    unlink(idx);
+    setenv("MYSHELL_HISTFILE", path, 1);
+    setenv("HISTSIZE", size, 1);
+
+    char cmd[96];
+    history_init();
+    double t = now();
+    for (size_t i = 0; i < n; i++) {
+        snprintf(cmd, sizeof(cmd), "make -j8 target-%zu && ./run --case %zu", i, i);
+        add_to_history(cmd);
+    }
+    report("history_fill", n, (now() - t) / n * 1e6, "us/entry");
+    history_free();
+
+    t = now();
+    history_init();
+    report("history_load", n, (now() - t) * 1e3, "ms");
+
+    t = now();
+    for (size_t i = 0; i < APPENDS; i++) {
+        snprintf(cmd, sizeof(cmd), "git commit -m 'change %zu'", i);
+        add_to_history(cmd);
+    }
+    report("history_append", n, (now() - t) / APPENDS * 1e6, "us/entry");
+    history_free();
+
+    unlink(path);
+    unlink(idx);
+}
+
+int main(int argc, char **argv) {
+    char dir[] = "/tmp/myshell-histbench-XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    if (argc > 1) {
+        for (int i = 1; i < argc; i++)
+            run((size_t)atol(argv[i]), dir);
+    } else {
+        run(10000, dir);
+        run(100000, dir);
+        run(1000000, dir);
+    }
+    rmdir(dir);
+    return 0;
+}
@@ -0,0 +1,234 @@
+// Keystroke-to-echo latency of an interactive shell, measured through a
+// pseudo-terminal. The shell is started on a pty with a history of
+// -H entries (written to a temporary file that both $MYSHELL_HISTFILE and
+// $HISTFILE point at), and scripted key streams are replayed one key at a
+// time:
+//
+//   type       printable characters, 100 to a line, then Ctrl-U
+//   backspace  deleting a 200-character line one key at a time
+//   history    holding Up through the history
+//   paste      2 KiB bracketed pastes, then Ctrl-U
+//
+// For every key the time from write() to the first byte the shell sends
+// back is its latency; every byte until the terminal has been quiet for
+// QUIET_MS counts towards bytes per key. Output uses run.sh's format:
+//
+//   bench   shell   param   value   unit
+//
+//   gcc -O2 -D_GNU_SOURCE -std=c11 -o pty_latency pty_latency.c -lutil
+//   ./pty_latency [-H entries] [-n keys] [-l label] shell [args...]
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pty.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define QUIET_MS 3
+#define REPLY_TIMEOUT_MS 2000
+
+typedef struct {
+    double *ms;
+    size_t n, cap;
+    size_t bytes;
+    size_t missed;      // keys the shell never answered
+} Samples;
+
+static int pty_fd;
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void write_all(const char *s, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(pty_fd, s, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("write");
+            exit(1);
+        }
+        s += n;
+        len -= (size_t)n;
+    }
+}
+
+// Reads until the terminal has been silent for quiet_ms; returns the bytes.
+static size_t drain(int quiet_ms) {
+    char buf[65536];
+    size_t total = 0;
+    struct pollfd pfd = {pty_fd, POLLIN, 0};
+    while (poll(&pfd, 1, quiet_ms) > 0) {
+        ssize_t n = read(pty_fd, buf, sizeof(buf));
+        if (n <= 0) break;
+        total += (size_t)n;
+    }
+    return total;
+}
+
+// Sends keys unmeasured and waits for the screen to settle.
+static void send(const char *keys) {
+    write_all(keys, strlen(keys));
+    drain(50);
+}
+
+static void record(Samples *s, const char *keys, size_t len) {
+    double start = now_ms();
+    write_all(keys, len);
+    struct pollfd pfd = {pty_fd, POLLIN, 0};
+    if (poll(&pfd, 1, REPLY_TIMEOUT_MS) <= 0) {
+        s->missed++;
+        return;
+    }
+    double first = now_ms();
+    s->bytes += drain(QUIET_MS);
+    if (s->n == s->cap) {
+        s->cap = s->cap ? s->cap * 2 : 256;
+        s->ms = realloc(s->ms, s->cap * sizeof(double));
+        if (!s->ms) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    s->ms[s->n++] = first - start;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void report(const char *bench, const char *label, Samples *s) {
+    if (s->n == 0) {
+        printf("%s\t%s\tmissed\t%zu\tkeys\n", bench, label, s->missed);
+        return;
+    }
+    qsort(s->ms, s->n, sizeof(double), cmp_double);
+    printf("%s\t%s\tp50\t%.3f\tms\n", bench, label, s->ms[s->n / 2]);
+    printf("%s\t%s\tp99\t%.3f\tms\n", bench, label, s->ms[(s->n * 99) / 100]);
+    printf("%s\t%s\tbytes\t%.1f\tbytes/key\n", bench, label, (double)s->bytes / s->n);
+    if (s->missed)
+        printf("%s\t%s\tmissed\t%zu\tkeys\n", bench, label, s->missed);
+    fflush(stdout);
+    free(s->ms);
+    memset(s, 0, sizeof(*s));
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: pty_latency [-H entries] [-n keys] [-l label] shell [args...]\n");
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    long entries = 100000, keys = 1000;
+    const char *label = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "+H:n:l:")) != -1) {
+        switch (opt) {
+        case 'H': entries = atol(optarg); break;
+        case 'n': keys = atol(optarg); break;
+        case 'l': label = optarg; break;
+        default: usage();
+        }
+    }
+    if (optind == argc || keys <= 0)
+        usage();
+    if (!label) {
+        label = strrchr(argv[optind], '/');
+        label = label ? label + 1 : argv[optind];
+    }
+
+    char dir[] = "/tmp/myshell-ptybench-XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    char hist[sizeof(dir) + 16], idx[sizeof(dir) + 32];
+    snprintf(hist, sizeof(hist), "%s/history", dir);
+    snprintf(idx, sizeof(idx), "%s.idx", hist);
+    FILE *f = fopen(hist, "w");
+    if (!f) {
+        perror(hist);
+        return 1;
+    }
+    for (long i = 0; i < entries; i++)
+        fprintf(f, "grep -rn 'pattern %ld' src/ --include='*.c' | sort | head -%ld\n", i, i % 50 + 1);
+    fclose(f);
+
+    struct winsize ws = {24, 80, 0, 0};
+    pid_t pid = forkpty(&pty_fd, NULL, NULL, &ws);
+    if (pid < 0) {
+        perror("forkpty");
+        return 1;
+    }
+    if (pid == 0) {
+        char size[32];
+        snprintf(size, sizeof(size), "%ld", entries + 1000);
+        setenv("TERM", "xterm", 1);
+        setenv("MYSHELL_HISTFILE", hist, 1);
+        setenv("HISTFILE", hist, 1);
+        setenv("HISTSIZE", size, 1);
+        execvp(argv[optind], argv + optind);
+        perror(argv[optind]);
+        _exit(127);
+    }
+
+    drain(500);        // startup and first prompt
+    Samples s = {0};
+
+    const char *text = "the quick brown fox jumps over the lazy dog 0123456789 ";
+    size_t tlen = strlen(text);
+    for (long i = 0; i < keys; i++) {
+        record(&s, &text[i % tlen], 1);
+        if (i % 100 == 99) send("\x15");
+    }
+    send("\x15");
+    report("type", label, &s);
+
+    char line[201];
+    for (int i = 0; i < 200; i++) line[i] = text[i % tlen];
+    line[200] = '\0';
+    for (long done = 0; done < keys;) {
+        send(line);
+        for (int i = 0; i < 200 && done < keys; i++, done++)
+            record(&s, "\x7f", 1);
+        send("\x15");
+    }
+    report("backspace", label, &s);
+
+    for (long i = 0; i < keys && i < entries; i++)
+        record(&s, "\x1b[A", 3);
+    send("\x15");
+    report("history", label, &s);
+
+    static char paste[2048 + 16];
+    size_t plen = 0;
+    plen += (size_t)sprintf(paste, "\x1b[200~");
+    for (int i = 0; i < 2048; i++) paste[plen++] = text[i % tlen];
+    plen += (size_t)sprintf(paste + plen, "\x1b[201~");
+    for (long i = 0; i < keys / 50 + 1; i++) {
+        record(&s, paste, plen);
+        send("\x15");
+    }
+    report("paste", label, &s);
+
+    send("exit\r");
+    for (int i = 0; i < 100 && waitpid(pid, NULL, WNOHANG) == 0; i++)
+        usleep(10000);
+    if (waitpid(pid, NULL, WNOHANG) == 0) {
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+    }
+    unlink(hist);
+    unlink(idx);
+    rmdir(dir);
+    return 0;
+}
@@ -0,0 +1,123 @@
+#!/bin/sh
+# Benchmarks the shell's non-interactive path (myshell -c / scripts) and
+# runs the same workloads under bash and dash when they are installed.
+#
+#   bench/run.sh [shell...]        default: myshell bash dash
+#
+# Results go to stdout as tab-separated lines
+#
+#   bench   shell   param   value   unit
+#
+# and progress to stderr. BENCH_SCALE multiplies the command counts
+# (default 1); BENCH_MB is the data pushed through each pipeline (default
+# 256). Bigger numbers are better for */s and MB/s, smaller for us/*.
+
+set -e
+
+root=$(cd "$(dirname "$0")/.." && pwd)
+scale=${BENCH_SCALE:-1}
+mb=${BENCH_MB:-256}
+work=$(mktemp -d /tmp/myshell-bench-XXXXXX)
+trap 'rm -rf "$work"' EXIT INT TERM
+
+gcc -O2 -D_GNU_SOURCE -std=c11 -Wall -Wextra -pthread -o "$work/myshell" "$root/main.c" -I"$root" -lm
+gcc -O2 -D_GNU_SOURCE -std=c11 -Wall -Wextra -o "$work/history_bench" "$root/bench/history_bench.c" -I"$root"
+gcc -O2 -D_GNU_SOURCE -std=c11 -Wall -Wextra -o "$work/pty_latency" "$root/bench/pty_latency.c" -lutil
+
+shells=${*:-myshell bash dash}
+
+now() {
+    date +%s%N
+}
+
+# report bench shell param value unit
+report() {
+    printf '%s\t%s\t%s\t%s\t%s\n' "$1" "$2" "$3" "$4" "$5"
+}
+
+# lines file n text...: a script of n copies of one command line
+lines() {
+    out=$1 n=$2
+    shift 2
+    awk -v n="$n" -v line="$*" 'BEGIN { for (i = 0; i < n; i++) print line }' > "$out"
+}
+
+# elapsed_ns shell script: runs the script, prints its wall time in ns
+elapsed_ns() {
+    start=$(now)
+    "$1" "$2" > /dev/null
+    end=$(now)
+    echo $((end - start))
+}
+
+per_cmd_us() {
+    awk -v ns="$1" -v n="$2" 'BEGIN { printf "%.2f", ns / n / 1000 }'
+}
+
+per_sec() {
+    awk -v ns="$1" -v n="$2" 'BEGIN { printf "%.0f", n / (ns / 1e9) }'
+}
+
+spawns=$((2000 * scale))
+builtins=$((100000 * scale))
+lines "$work/spawn.sh" "$spawns" /bin/true
+lines "$work/redirect.sh" "$spawns" '/bin/true > /dev/null'
+lines "$work/builtin.sh" "$builtins" 'set +e'
+
+for sh in $shells; do
+    case $sh in
+    myshell) bin=$work/myshell ;;
+    *) bin=$(command -v "$sh" || true) ;;
+    esac
+    if [ -z "$bin" ]; then
+        echo "skipping $sh: not installed" >&2
+        continue
+    fi
+    echo "running $sh" >&2
+
+    spawn_ns=$(elapsed_ns "$bin" "$work/spawn.sh")
+    report spawn "$sh" "$spawns" "$(per_sec "$spawn_ns" "$spawns")" cmds/s
+
+    redirect_ns=$(elapsed_ns "$bin" "$work/redirect.sh")
+    report redirect "$sh" "$spawns" "$(per_sec "$redirect_ns" "$spawns")" cmds/s
+    report redirect_overhead "$sh" "$spawns" \
+        "$(per_cmd_us $((redirect_ns - spawn_ns)) "$spawns")" us/cmd
+
+    builtin_ns=$(elapsed_ns "$bin" "$work/builtin.sh")
+    report builtin "$sh" "$builtins" "$(per_cmd_us "$builtin_ns" "$builtins")" us/cmd
+
+    stages=2
+    while [ $stages -le 8 ]; do
+        pipeline="head -c ${mb}M /dev/zero"
+        i=2
+        while [ $i -lt $stages ]; do
+            pipeline="$pipeline | cat"
+            i=$((i + 1))
+        done
+        echo "$pipeline | cat > /dev/null" > "$work/pipe.sh"
+        pipe_ns=$(elapsed_ns "$bin" "$work/pipe.sh")
+        report pipeline "$sh" "$stages" \
+            "$(awk -v ns="$pipe_ns" -v mb="$mb" 'BEGIN { printf "%.1f", mb / (ns / 1e9) }')" MB/s
+        stages=$((stages + 1))
+    done
+done
+
+# the history store exists only in myshell
+case " $shells " in
+*" myshell "*)
+    echo "running history" >&2
+    "$work/history_bench"
+    ;;
+esac
+
+# interactive latency; dash has no line editor to measure
+for sh in $shells; do
+    case $sh in
+    myshell) set -- "$work/myshell" ;;
+    bash) set -- bash --norc ;;
+    *) continue ;;
+    esac
+    command -v "$1" > /dev/null || continue
+    echo "running $sh under a pty" >&2
+    "$work/pty_latency" -l "$sh" "$@"
+done
@@ -0,0 +1,65 @@
+#ifndef BUILTINS_H
+#define BUILTINS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// ---------------- Builtin Table -----------------
+//
+// Builtins are looked up once, when a command line is parsed, and the
+// parse tree keeps the pointer, so a cached line never compares names
+// again. The table is a perfect hash: builtins_init picks a seed under
+// which every name lands in a slot of its own, so a lookup is one hash and
+// at most one strcmp, hit or miss.
+
+typedef int (*builtin_fn)(int argc, char **argv);
+
+typedef struct {
+    const char *name;
+    builtin_fn fn;
+    int pure;       // leaves the shell's state alone, so it may run in the
+                    // shell itself as a pipeline stage
+} Builtin;
+
+// Defined next to the builtins themselves in main.c.
+extern const Builtin builtin_table[];
+extern const size_t builtin_count;
+
+#define BUILTIN_SLOTS 128       // power of two, a few times builtin_count
+
+static const Builtin *builtin_slots[BUILTIN_SLOTS];
+static uint32_t builtin_seed;
+
+static inline uint32_t builtin_name_hash(const char *s, uint32_t seed) {
+    uint32_t h = 2166136261u ^ seed;
+    for (; *s; s++) {
+        h ^= (unsigned char)*s;
+        h *= 16777619u;
+    }
+    return h ^ (h >> 15);
+}
+
+static void builtins_init(void) {
+    for (uint32_t seed = 1;; seed++) {
+        memset(builtin_slots, 0, sizeof(builtin_slots));
+        size_t i = 0;
+        for (; i < builtin_count; i++) {
+            uint32_t slot = builtin_name_hash(builtin_table[i].name, seed) & (BUILTIN_SLOTS - 1);
+            if (builtin_slots[slot])
+                break;
+            builtin_slots[slot] = &builtin_table[i];
+        }
+        if (i == builtin_count) {
+            builtin_seed = seed;
+            return;
+        }
+    }
+}
+
+static const Builtin *builtin_lookup(const char *name) {
+    const Builtin *b = builtin_slots[builtin_name_hash(name, builtin_seed) & (BUILTIN_SLOTS - 1)];
+    return b && strcmp(b->name, name) == 0 ? b : NULL;
+}
+
+#endif
@@ -16,93 +16,226 @@
 #include <sched.h>
 #include <signal.h>
 #include <spawn.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include "threadpool.h"
 
-typedef struct {
-    char *command;  
-    int index;      
-} HistoryEntry;
-
-// --- Simple job control implementation ---
-typedef enum { JOB_RUNNING = 0, JOB_STOPPED = 1, JOB_DONE = 2 } JobStatus;
-
-typedef struct Job {
-    pid_t pid;
-    int jid;
-    char *cmdline;
-    JobStatus status;
-    struct Job *next;
-} Job;
-
-static Job *job_list = NULL;
-static int next_jid = 1;
-
-static Job *find_job_by_pid(pid_t pid) {
-    for (Job *j = job_list; j; j = j->next) if (j->pid == pid) return j;
-    return NULL;
+#include "jobs.h"
+
+extern pid_t fg_pid;
+extern int prompt_cwd_dirty;
+char* env_path = NULL;
+extern char **environ;
+
+// Resets the signals the shell ignores or handles back to their defaults in
+// the child, and optionally places it in process group pgid (0 = new group
+// led by the child itself). pgid < 0 leaves the process group untouched.
+static void init_spawnattr(posix_spawnattr_t *attr, pid_t pgid) {
+    sigset_t defaults;
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGINT);
+    sigaddset(&defaults, SIGTSTP);
+    sigaddset(&defaults, SIGTTOU);
+    sigaddset(&defaults, SIGTTIN);
+    sigaddset(&defaults, SIGPIPE);     // ignored while a builtin stage runs
+
+    // the shell blocks SIGCHLD for its signalfd; children start unblocked
+    sigset_t none;
+    sigemptyset(&none);
+
+    short flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+    posix_spawnattr_init(attr);
+    posix_spawnattr_setsigdefault(attr, &defaults);
+    posix_spawnattr_setsigmask(attr, &none);
+    if (pgid >= 0) {
+        posix_spawnattr_setpgroup(attr, pgid);
+        flags |= POSIX_SPAWN_SETPGROUP;
+    }
+    posix_spawnattr_setflags(attr, flags);
 }
 
-static Job *find_job_by_jid(int jid) {
-    for (Job *j = job_list; j; j = j->next) if (j->jid == jid) return j;
-    return NULL;
+// --- Command hash table (like bash's `hash`) ---
+// Maps command names to the absolute path found on $PATH, so a spawn does
+// not have to try exec in every PATH directory. The table is dropped when
+// PATH changes and an entry is dropped when its binary disappears.
+
+#define CMD_HASH_BUCKETS 256
+
+typedef struct HashedCommand {
+    char *name;
+    char *path;
+    unsigned hits;
+    struct HashedCommand *next;
+} HashedCommand;
+
+static HashedCommand *cmd_hash[CMD_HASH_BUCKETS];
+static char *cmd_hash_path = NULL;   // the PATH the table was filled from
+
+static unsigned cmd_hash_bucket(const char *name) {
+    unsigned h = 5381;
+    while (*name) h = h * 33 + (unsigned char)*name++;
+    return h % CMD_HASH_BUCKETS;
+}
+
+void hash_clear(void) {
+    for (int i = 0; i < CMD_HASH_BUCKETS; i++) {
+        HashedCommand *c = cmd_hash[i];
+        while (c) {
+            HashedCommand *next = c->next;
+            free(c->name);
+            free(c->path);
+            free(c);
+            c = next;
+        }
+        cmd_hash[i] = NULL;
+    }
+    free(cmd_hash_path);
+    cmd_hash_path = NULL;
 }
 
-static int add_job(pid_t pid, const char *cmdline, JobStatus status) {
-    Job *j = malloc(sizeof(Job));
-    if (!j) return -1;
-    j->pid = pid;
-    j->jid = next_jid++;
-    j->cmdline = strdup(cmdline ? cmdline : "");
-    j->status = status;
-    j->next = job_list;
-    job_list = j;
-    return j->jid;
-}
-
-static void remove_job(Job *job) {
-    if (!job) return;
-    Job **p = &job_list;
-    while (*p) {
-        if (*p == job) {
-            *p = job->next;
-            free(job->cmdline);
-            free(job);
+static void hash_forget(const char *name) {
+    HashedCommand **p = &cmd_hash[cmd_hash_bucket(name)];
+    for (; *p; p = &(*p)->next) {
+        if (strcmp((*p)->name, name) == 0) {
+            HashedCommand *c = *p;
+            *p = c->next;
+            free(c->name);
+            free(c->path);
+            free(c);
             return;
         }
-        p = &((*p)->next);
     }
 }
 
-static void list_jobs(void) {
-    for (Job *j = job_list; j; j = j->next) {
-        const char *st = j->status == JOB_RUNNING ? "Running" : (j->status == JOB_STOPPED ? "Stopped" : "Done");
-        printf("[%d] %s %d %s\n", j->jid, st, j->pid, j->cmdline);
+// The command search path: $PATH, or a default when it is unset.
+static const char *path_value(void) {
+    const char *path = getenv("PATH");
+    return path ? path : "/usr/local/bin:/usr/bin:/bin";
+}
+
+// Copies the PATH element at *p into dir and moves *p past it; an empty
+// element means the current directory. Returns 0 after the last one.
+// Elements too long for dir come back empty.
+static int path_next(const char **p, char *dir, size_t size) {
+    if (!*p) return 0;
+    const char *end = strchrnul(*p, ':');
+    size_t len = (size_t)(end - *p);
+    if (len == 0) {
+        snprintf(dir, size, ".");
+    } else if (len < size) {
+        memcpy(dir, *p, len);
+        dir[len] = '\0';
+    } else {
+        dir[0] = '\0';
     }
+    *p = *end ? end + 1 : NULL;
+    return 1;
 }
 
-static void mark_job_stopped(pid_t pid) {
-    Job *j = find_job_by_pid(pid);
-    if (j) j->status = JOB_STOPPED;
+// Searches PATH for an executable regular file called name.
+static char *path_search(const char *name) {
+    char dir[PATH_MAX], candidate[PATH_MAX];
+    for (const char *p = path_value(); path_next(&p, dir, sizeof(dir));) {
+        if (!dir[0]) continue;
+        if (snprintf(candidate, sizeof(candidate), "%s/%s", dir, name) >= (int)sizeof(candidate))
+            continue;
+        struct stat st;
+        if (stat(candidate, &st) == 0 && S_ISREG(st.st_mode) && access(candidate, X_OK) == 0)
+            return strdup(candidate);
+    }
+    return NULL;
 }
 
-static void mark_job_running(pid_t pid) {
-    Job *j = find_job_by_pid(pid);
-    if (j) j->status = JOB_RUNNING;
+// Returns the cached absolute path for name, searching PATH on a miss.
+// NULL if name is not on PATH. Names containing '/' are not hashed.
+const char *hash_lookup(const char *name) {
+    const char *path = getenv("PATH");
+    if (!path) path = "";
+    if (!cmd_hash_path || strcmp(cmd_hash_path, path) != 0) {
+        hash_clear();
+        cmd_hash_path = strdup(path);
+    }
+
+    unsigned b = cmd_hash_bucket(name);
+    for (HashedCommand *c = cmd_hash[b]; c; c = c->next) {
+        if (strcmp(c->name, name) == 0) {
+            c->hits++;
+            return c->path;
+        }
+    }
+
+    char *found = path_search(name);
+    if (!found) return NULL;
+    HashedCommand *c = malloc(sizeof(HashedCommand));
+    if (!c) {
+        free(found);
+        return NULL;
+    }
+    c->name = strdup(name);
+    c->path = found;
+    c->hits = 1;
+    c->next = cmd_hash[b];
+    cmd_hash[b] = c;
+    return c->path;
 }
 
+// hash [-r] [name...]
+void hash_commands(char **args) {
+    if (args[1] && strcmp(args[1], "-r") == 0) {
+        hash_clear();
+        return;
+    }
+    if (args[1]) {
+        for (int i = 1; args[i]; i++) {
+            hash_forget(args[i]);
+            if (!hash_lookup(args[i]))
+                fprintf(stderr, "hash: %s: not found\n", args[i]);
+            else    // the fresh entry is at the head of its bucket
+                cmd_hash[cmd_hash_bucket(args[i])]->hits = 0;
+        }
+        return;
+    }
 
-extern char *history; 
-char* env_path = NULL;
-extern char **environ;
+    int any = 0;
+    for (int i = 0; i < CMD_HASH_BUCKETS; i++) {
+        for (HashedCommand *c = cmd_hash[i]; c; c = c->next) {
+            if (!any) printf("hits\tcommand\n");
+            printf("%4u\t%s\n", c->hits, c->path);
+            any = 1;
+        }
+    }
+    if (!any) printf("hash: hash table empty\n");
+}
 
-static inline pid_t spawn_command(char *const args[], posix_spawn_file_actions_t *actions) {
+static inline pid_t spawn_command_attr(char *const args[], posix_spawn_file_actions_t *actions,
+                                       posix_spawnattr_t *attr) {
     if (!args || !args[0]) {
         errno = EINVAL;
         perror("myshell");
         return -1;
     }
 
+    // builtin output may still sit in stdio's buffer (stdout is fully
+    // buffered in scripts); it has to reach the fd before the child writes
+    fflush(stdout);
+
     pid_t pid = -1;
-    int rc = posix_spawnp(&pid, args[0], actions, NULL, args, environ);
+    int rc;
+    if (strchr(args[0], '/')) {
+        rc = posix_spawn(&pid, args[0], actions, attr, args, environ);
+    } else {
+        const char *path = hash_lookup(args[0]);
+        rc = path ? posix_spawn(&pid, path, actions, attr, args, environ) : ENOENT;
+        if (path && rc == ENOENT) {
+            // the cached binary went away; look it up again once
+            hash_forget(args[0]);
+            path = hash_lookup(args[0]);
+            rc = path ? posix_spawn(&pid, path, actions, attr, args, environ) : ENOENT;
+        }
+        if (rc == ENOEXEC)      // script without #!; let posix_spawnp run it with sh
+            rc = posix_spawnp(&pid, args[0], actions, attr, args, environ);
+    }
     if (rc != 0) {
         errno = rc;
         perror("myshell");
@@ -111,103 +244,190 @@ static inline pid_t spawn_command(char *const args[], posix_spawn_file_actions_t
     return pid;
 }
 
+static inline pid_t spawn_command(char *const args[], posix_spawn_file_actions_t *actions) {
+    posix_spawnattr_t attr;
+    init_spawnattr(&attr, -1);
+    pid_t pid = spawn_command_attr(args, actions, &attr);
+    posix_spawnattr_destroy(&attr);
+    return pid;
+}
 
-int count_commands() {
-    if (!history || *history == '\0')
-        return 0;
+int run_job(char **args, posix_spawn_file_actions_t *actions, int background, const char *cmdline);
 
-    int count = 0;
-    for (char *p = history; *p; ++p)
-        if (*p == '\n')
-            ++count;
-    return count;
-}
-
-HistoryEntry last_command(int index) {
-    HistoryEntry entry = {NULL, -1};
-    if (!history || *history == '\0')
-        return entry;
-
-    int total = count_commands();
-    if (total == 0)
-        return entry;
-    if (index < 0)
-        index = 0;
-    else if (index >= total)
-        index = total - 1;
-    char *start = history;
-    int current = 0;
-
-    for (char *p = history; *p; ++p) {
-        if (*p == '\n') {
-            if (current == index)
-                break;
-            start = p + 1;
-            current++;
+// One redirection of a command. A command's redirections apply in order,
+// so `>f 2>&1` sends both to f and `2>&1 >f` only stdout.
+typedef enum {
+    REDIR_OPEN,         // open path with flags onto fd
+    REDIR_DUP,          // fd becomes a copy of src (n>&m, n<&m)
+    REDIR_CLOSE,        // n>&-
+    REDIR_DATA,         // fd reads the len bytes at path (<<, <<<)
+} RedirKind;
+
+typedef struct Redirect {
+    int fd;
+    RedirKind kind;
+    int flags;
+    int src;
+    const char *path;
+    size_t len;
+    int expand;         // path is as typed and expands at run time (1), or
+                        // is a here-document body that does (2)
+    struct Redirect *next;
+} Redirect;
+
+// Returns a close-on-exec fd, above the ones a command would use, that
+// reads data from the start. It is a memfd rather than a pipe, so a
+// here-document never touches the disk and one bigger than a pipe buffer
+// cannot block the shell before its reader exists.
+static int redirect_data_fd(const char *data, size_t len) {
+    int mfd = memfd_create("myshell-heredoc", MFD_CLOEXEC);
+    if (mfd < 0) {
+        perror("memfd_create");
+        return -1;
+    }
+    for (size_t off = 0; off < len;) {
+        ssize_t w = write(mfd, data + off, len - off);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            perror("here-document");
+            close(mfd);
+            return -1;
         }
+        off += (size_t)w;
     }
-    char *end = strchr(start, '\n');
-    size_t len = end ? (size_t)(end - start) : strlen(start);
+    lseek(mfd, 0, SEEK_SET);
+    int fd = fcntl(mfd, F_DUPFD_CLOEXEC, 10);
+    close(mfd);
+    if (fd < 0)
+        perror("here-document");
+    return fd;
+}
 
-    entry.command = malloc(len + 1);
-    if (!entry.command) {
-        perror("malloc failed");
-        entry.index = -1;
-        return entry;
-    }
+// The files and here-document fds named by file actions that have not been
+// spawned yet; redirect_release closes them once the child has its copies.
+#define REDIR_TEMPS_MAX 64
+static int redirect_temps[REDIR_TEMPS_MAX];
+static int redirect_ntemps;
 
-    strncpy(entry.command, start, len);
-    entry.command[len] = '\0';
-    entry.index = index;
+static void redirect_release(void) {
+    while (redirect_ntemps > 0)
+        close(redirect_temps[--redirect_ntemps]);
+}
 
-    return entry;
+// Returns the file r names opened in the shell, as a close-on-exec fd above
+// the ones a command would use, or -1 after printing the error.
+static int redirect_open_fd(const Redirect *r) {
+    int fd = open(r->path, r->flags | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "myshell: %s: %s\n", r->path, strerror(errno));
+        return -1;
+    }
+    int high = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+    close(fd);
+    if (high < 0)
+        fprintf(stderr, "myshell: %s: %s\n", r->path, strerror(errno));
+    return high;
 }
 
-void add_to_history(const char *command) {
-    size_t old_len = history ? strlen(history) : 0;
-    size_t cmd_len = strlen(command);
-    size_t new_len = old_len + cmd_len + 2; 
-    history = realloc(history, new_len);
-    if (!history) {
-        perror("realloc failed");
-        exit(1);
+// Turns redirections into file actions, so that even `cmd <<EOF 2>&1` is a
+// single posix_spawn. Files are opened here rather than by the child, so a
+// bad target is reported by name instead of as a failed spawn. Returns -1
+// after printing the error if one cannot be set up; call redirect_release
+// after spawning.
+static int add_redirects(posix_spawn_file_actions_t *fa, const Redirect *r) {
+    for (; r; r = r->next) {
+        switch (r->kind) {
+        case REDIR_DUP:
+            posix_spawn_file_actions_adddup2(fa, r->src, r->fd);
+            break;
+        case REDIR_CLOSE:
+            posix_spawn_file_actions_addclose(fa, r->fd);
+            break;
+        case REDIR_OPEN:
+        case REDIR_DATA: {
+            if (redirect_ntemps == REDIR_TEMPS_MAX) {
+                fprintf(stderr, "myshell: too many redirections\n");
+                return -1;
+            }
+            int fd = r->kind == REDIR_OPEN ? redirect_open_fd(r) : redirect_data_fd(r->path, r->len);
+            if (fd < 0)
+                return -1;
+            redirect_temps[redirect_ntemps++] = fd;
+            posix_spawn_file_actions_adddup2(fa, fd, r->fd);
+            break;
+        }
+        }
+    }
+    return 0;
+}
+
+// Applies one redirection to the shell's own fds (a builtin or a forked
+// subshell). New fds are close-on-exec except the one redirected. Returns
+// -1 after printing the error.
+static int redirect_apply(const Redirect *r) {
+    int fd;
+    switch (r->kind) {
+    case REDIR_CLOSE:
+        close(r->fd);
+        return 0;
+    case REDIR_DUP:
+        if (r->src != r->fd && dup2(r->src, r->fd) < 0) {
+            fprintf(stderr, "myshell: %d: %s\n", r->src, strerror(errno));
+            return -1;
+        }
+        return 0;
+    case REDIR_DATA:
+        fd = redirect_data_fd(r->path, r->len);
+        break;
+    default:
+        fd = redirect_open_fd(r);
+        break;
+    }
+    if (fd < 0)
+        return -1;
+    if (fd != r->fd) {
+        dup2(fd, r->fd);
+        close(fd);
+    } else {
+        fcntl(fd, F_SETFD, 0);
     }
-    if (old_len == 0)
-        history[0] = '\0';
-    strcat(history, command);
-    strcat(history, "\n");
+    return 0;
 }
 
-void cd_commands(char *path) {
+// One stage of a pipeline: argv is spawned, unless body is set, in which
+// case a forked copy of the shell runs it (a subshell, for instance). A
+// body that is just a pure builtin may instead run in the shell itself.
+typedef struct {
+    char **argv;
+    const Redirect *redirs;
+    void *body;
+    int in_shell;
+} PipeStage;
+
+// Runs a parse tree in a forked shell; returns its exit status.
+int exec_subshell_body(void *body);
+
+
+int cd_commands(char *path) {
     if (path == NULL || strcmp(path, "") == 0) {
         char *home = getenv("HOME");
         if (home == NULL) {
             fprintf(stderr, "cd: HOME not set\n");
-            return;
+            return 1;
         }
         if (chdir(home) != 0) {
             perror("cd");
-            return;
+            return 1;
         }
     } else {
         if (chdir(path) != 0) {
             perror("cd");
-            return;
+            return 1;
         }
     }
 
-    char *cwd = getcwd(NULL, 0);
-    if (cwd != NULL) {
-        free(cwd);
-    } else {
-        perror("getcwd");
-    }
-}
-
-void ls_commands(char **args) {   
-    pid_t pid = spawn_command(args, NULL);
-    if (pid > 0)
-        waitpid(pid, NULL, 0);
+    prompt_cwd_dirty = 1;
+    return 0;
 }
 
 void pwd_commands() {
@@ -219,13 +439,14 @@ void pwd_commands() {
         perror("getcwd");
     }
 }
-void touch_commands(char *filename) {
+int touch_commands(char *filename) {
     FILE *file = fopen(filename, "a");
     if (file == NULL) {
         perror("touch");
-        return;
+        return 1;
     }
     fclose(file);
+    return 0;
 }
 
 void nano_commands(char *filename) {
@@ -234,66 +455,252 @@ void nano_commands(char *filename) {
     if (pid > 0)
         waitpid(pid, NULL, 0);
 }
-void rm_commands(char *filename) {
+int rm_commands(char *filename) {
     if (remove(filename) != 0) {
         perror("rm");
+        return 1;
     }
+    return 0;
 }
 
 void help_commands() {
     printf("Supported commands:\n");
     printf("  cd [dir]      - Change directory to 'dir' or home if no dir is given\n");
-    printf("  ls            - List files in the current directory\n");
+    printf("  ls [-laStUr1] - List directory contents (other flags run /bin/ls)\n");
     printf("  pwd           - Print the current working directory\n");
     printf("  touch [file]  - Create an empty file named 'file'\n");
+    printf("  rmdir [-j N] dir... - Remove directory trees using N threads\n");
+    printf("  cat [--stats] [file...] - Copy files to stdout (splice, sendfile, copy_file_range)\n");
+    printf("  cp [-r] [-j N] [--stats] src... dest - Copy files (reflink when possible), trees on N threads\n");
+    printf("  tee [-a] [--stats] [file...] - Copy stdin to stdout and files (tee(2) on pipes)\n");
     printf("  help          - Show this help message\n");
+    printf("  history [n]   - List the last n commands (all by default)\n");
+    printf("  hash [-r]     - Show remembered command paths and hits; -r forgets them\n");
+    printf("  pipestatus    - Show the exit status of each stage of the last pipeline\n");
+    printf("  parallel [-j N] [-k] cmd ::: args - Run cmd once per arg (or stdin line), N at a time\n");
+    printf("  stats [-n N] [name] - Slowest commands and per-command timings and failures\n");
     printf("  exit          - Exit the shell\n");
 }
 
-void rm_r_recursive(const char *path) {
-    struct dirent *entry;
-    DIR *dir = opendir(path);
+// ---------------- Recursive Delete -----------------
+//
+// rmdir removes whole trees. Everything is relative to the parent's open
+// directory fd (openat/unlinkat), so there is no path buffer to overflow,
+// and the entry type comes from d_type, so no stat is needed except on
+// filesystems that report DT_UNKNOWN. Symlinks are removed, never followed.
+//
+// Each directory is a task on the work-stealing pool. A directory keeps
+// its fd open and counts the subdirectories it queued; the last of them
+// to finish removes the directory itself and reports to its own parent.
+
+typedef struct RmDir {
+    struct RmDir *parent;
+    int fd;                 // open until every subdirectory is done
+    atomic_size_t pending;  // 1 for our own scan + one per subdirectory
+    atomic_int failed;      // something inside could not be removed
+    char name[];
+} RmDir;
+
+typedef struct {
+    size_t files;
+    size_t dirs;
+    size_t errors;
+    char pad[40];           // keep workers off each other's cache line
+} RmStats;
+
+static ThreadPool *rm_pool;
+static RmStats *rm_stats;
+
+// Path of name inside d, for error messages only.
+static char *rm_path(const RmDir *d, const char *name) {
+    size_t len = strlen(name) + 1;
+    for (const RmDir *p = d; p; p = p->parent)
+        len += strlen(p->name) + 1;
+    char *path = malloc(len);
+    if (!path) return NULL;
+    char *end = path + len - 1;
+    *end = '\0';
+    for (const char *n = name; ; n = d->name, d = d->parent) {
+        size_t nl = strlen(n);
+        end -= nl;
+        memcpy(end, n, nl);
+        if (!d) break;
+        *--end = '/';
+    }
+    return path;
+}
+
+static void rm_error(const RmDir *d, const char *name, int worker) {
+    int err = errno;
+    char *path = rm_path(d, name);
+    fprintf(stderr, "rmdir: cannot remove '%s': %s\n", path ? path : name, strerror(err));
+    free(path);
+    rm_stats[worker].errors++;
+}
+
+static RmDir *rm_node(RmDir *parent, const char *name) {
+    size_t len = strlen(name) + 1;
+    RmDir *d = malloc(sizeof(RmDir) + len);
+    if (!d) {
+        perror("malloc failed");
+        exit(1);
+    }
+    d->parent = parent;
+    d->fd = -1;
+    atomic_init(&d->pending, 1);
+    atomic_init(&d->failed, 0);
+    memcpy(d->name, name, len);
+    return d;
+}
+
+// Drops one reference to d; the last one removes the directory and
+// passes on to the parent.
+static void rm_release(RmDir *d, int worker) {
+    while (d && atomic_fetch_sub(&d->pending, 1) == 1) {
+        RmDir *parent = d->parent;
+        int pfd = parent ? parent->fd : AT_FDCWD;
+        if (d->fd >= 0)
+            close(d->fd);
+        if (atomic_load(&d->failed)) {
+            if (parent) atomic_store(&parent->failed, 1);
+        } else if (unlinkat(pfd, d->name, AT_REMOVEDIR) == 0) {
+            rm_stats[worker].dirs++;
+        } else {
+            rm_error(parent, d->name, worker);
+            if (parent) atomic_store(&parent->failed, 1);
+        }
+        free(d);
+        d = parent;
+    }
+}
+
+static void rm_dir_task(void *arg, int worker) {
+    RmDir *d = arg;
+    int pfd = d->parent ? d->parent->fd : AT_FDCWD;
+    d->fd = openat(pfd, d->name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    int dfd = d->fd >= 0 ? dup(d->fd) : -1;
+    DIR *dir = dfd >= 0 ? fdopendir(dfd) : NULL;
     if (!dir) {
-        perror("opendir");
+        rm_error(d->parent, d->name, worker);
+        if (dfd >= 0) close(dfd);
+        atomic_store(&d->failed, 1);
+        if (d->parent) atomic_store(&d->parent->failed, 1);
+        rm_release(d, worker);
         return;
     }
+
+    struct dirent *entry;
     while ((entry = readdir(dir)) != NULL) {
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+        const char *name = entry->d_name;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
             continue;
 
-        char fullpath[512];
-        snprintf(fullpath, sizeof(fullpath), "%s/%s", path, entry->d_name);
-
-        struct stat st;
-        if (stat(fullpath, &st) == 0) {
-            if (S_ISDIR(st.st_mode)) {
-                rm_r_recursive(fullpath);  
-            } else {
-                remove(fullpath);
-            }
+        unsigned char type = entry->d_type;
+        if (type == DT_UNKNOWN) {
+            struct stat st;
+            if (fstatat(d->fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0)
+                type = S_ISDIR(st.st_mode) ? DT_DIR : DT_REG;
+        }
+        if (type == DT_DIR) {
+            atomic_fetch_add(&d->pending, 1);
+            pool_submit(rm_pool, worker, rm_dir_task, rm_node(d, name));
+        } else if (unlinkat(d->fd, name, 0) == 0) {
+            rm_stats[worker].files++;
+        } else {
+            rm_error(d, name, worker);
+            atomic_store(&d->failed, 1);
         }
     }
     closedir(dir);
-    if (rmdir(path) != 0) {
+    rm_release(d, worker);
+}
+
+// rmdir [-j N] dir...
+int rmdir_commands(char **args) {
+    int jobs = pool_default_workers();
+    int i = 1;
+    for (; args[i] && args[i][0] == '-' && args[i][1]; i++) {
+        const char *n = NULL;
+        if (strcmp(args[i], "--") == 0) { i++; break; }
+        if (strncmp(args[i], "-j", 2) == 0)
+            n = args[i][2] ? args[i] + 2 : args[++i];
+        if (!n || atoi(n) < 1) {
+            fprintf(stderr, "rmdir: usage: rmdir [-j N] dir...\n");
+            return 2;
+        }
+        jobs = atoi(n);
+    }
+    if (!args[i]) {
+        fprintf(stderr, "rmdir: missing directory operand\n");
+        return 2;
+    }
+
+    // one fd per directory being worked on; lift the soft limit meanwhile
+    struct rlimit saved_nofile, nofile;
+    int have_nofile = getrlimit(RLIMIT_NOFILE, &saved_nofile) == 0;
+    if (have_nofile) {
+        nofile = saved_nofile;
+        nofile.rlim_cur = nofile.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &nofile);
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    rm_pool = pool_create(jobs);
+    rm_stats = calloc((size_t)jobs, sizeof(RmStats));
+    if (!rm_pool || !rm_stats) {
         perror("rmdir");
+        pool_destroy(rm_pool);
+        free(rm_stats);
+        return 1;
     }
+    for (; args[i]; i++)
+        pool_submit(rm_pool, 0, rm_dir_task, rm_node(NULL, args[i]));
+    pool_run(rm_pool);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    RmStats total = {0};
+    for (int w = 0; w < jobs; w++) {
+        total.files += rm_stats[w].files;
+        total.dirs += rm_stats[w].dirs;
+        total.errors += rm_stats[w].errors;
+    }
+    double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("rmdir: removed %zu files and %zu directories in %.3fs (%d thread%s)",
+           total.files, total.dirs, secs, jobs, jobs == 1 ? "" : "s");
+    if (total.errors)
+        printf(", %zu errors", total.errors);
+    printf("\n");
+
+    pool_destroy(rm_pool);
+    free(rm_stats);
+    rm_pool = NULL;
+    rm_stats = NULL;
+    if (have_nofile)
+        setrlimit(RLIMIT_NOFILE, &saved_nofile);
+    return total.errors ? 1 : 0;
 }
-void version_command(const char* arg){
-    char *args[] = {(char *)arg, "--version", NULL};
-    pid_t pid = spawn_command(args, NULL);
-    if (pid > 0)
-        waitpid(pid, NULL, 0);
-}
+
+static char *saved_path = NULL;   // PATH before `source` prepended the venv
+
 void activate_virtualenv(const char *path) {
     char resolved[PATH_MAX];
     if (realpath(path, resolved) == NULL) {
         fprintf(stderr, "source: could not find '%s'\n", path);
         return;
     }
+    const char *old_path = getenv("PATH");
+    if (!old_path) old_path = "";
+    if (!saved_path) saved_path = strdup(old_path);
     setenv("VIRTUAL_ENV", resolved, 1);
-    char new_path[4096];
-    snprintf(new_path, sizeof(new_path), "%s/bin:%s", resolved, getenv("PATH"));
+    char *new_path = NULL;
+    if (asprintf(&new_path, "%s/bin:%s", resolved, old_path) < 0) {
+        perror("source");
+        return;
+    }
     setenv("PATH", new_path, 1);
+    free(new_path);
+    hash_clear();
     if (env_path) free(env_path);
     env_path = strdup(resolved);
     printf("Activated virtual environment: %s\n", resolved);
@@ -303,6 +710,12 @@ void deactivate_virtualenv() {
     if (getenv("VIRTUAL_ENV")) {
         unsetenv("VIRTUAL_ENV");
     }
+    if (saved_path) {
+        setenv("PATH", saved_path, 1);
+        free(saved_path);
+        saved_path = NULL;
+    }
+    hash_clear();
     if (env_path) {
         free(env_path);
         env_path = NULL;
@@ -313,68 +726,448 @@ void deactivate_virtualenv() {
 
 // ---------------- Pipe Execution -----------------
 
-void Pipe_commands(char **cmd1_args, char **cmd2_args) {
-    int pipefd[2];
-    if (pipe(pipefd) == -1) {
-        perror("pipe");
-        return;
+// Exit status of every stage of the last foreground pipeline, like bash's
+// PIPESTATUS. A plain command counts as a one-stage pipeline.
+int *pipestatus = NULL;
+int pipestatus_count = 0;
+int last_status = 0;
+// Resource usage of each stage of the last foreground job, from wait4.
+struct rusage *pipeusage = NULL;
+int pipeusage_count = 0;
+
+static int status_to_code(int status) {
+    if (WIFEXITED(status)) return WEXITSTATUS(status);
+    if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+    if (WIFSTOPPED(status)) return 128 + WSTOPSIG(status);
+    return status;
+}
+
+static void set_pipestatus(int n) {
+    if (n > pipestatus_count) {
+        int *p = realloc(pipestatus, n * sizeof(int));
+        if (!p) {
+            perror("realloc failed");
+            exit(1);
+        }
+        pipestatus = p;
     }
+    pipestatus_count = n;
+}
 
-    posix_spawn_file_actions_t fa1;
-    posix_spawn_file_actions_init(&fa1);
-    posix_spawn_file_actions_adddup2(&fa1, pipefd[1], STDOUT_FILENO);
-    posix_spawn_file_actions_addclose(&fa1, pipefd[0]);
-    posix_spawn_file_actions_addclose(&fa1, pipefd[1]);
-    pid_t pid1 = spawn_command(cmd1_args, &fa1);
-    posix_spawn_file_actions_destroy(&fa1);
-    if (pid1 == -1) {
-        close(pipefd[0]);
-        close(pipefd[1]);
-        return;
+void pipestatus_commands(void) {
+    for (int i = 0; i < pipestatus_count; i++)
+        printf(i ? " %d" : "%d", pipestatus[i]);
+    printf("\n");
+}
+
+// ---------------- Resource Accounting -----------------
+//
+// What a command cost: wall time, plus the shell's own usage (builtins)
+// and that of every child reaped meanwhile (RUSAGE_CHILDREN), as deltas.
+// Max RSS is not cumulative, so it is the largest of the processes reaped
+// meanwhile instead. Used by `time`, MYSHELL_REPORTTIME and CMD_DURATION.
+
+typedef struct {
+    struct timespec start;
+    struct rusage self, children;
+    long saved_peak;
+} UsageMark;
+
+typedef struct {
+    double real, user, sys;     // seconds
+    long maxrss;                // KiB
+    long minflt, majflt;
+    long nvcsw, nivcsw;
+} CmdUsage;
+
+static double tv_seconds(struct timeval tv) {
+    return (double)tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void usage_begin(UsageMark *m) {
+    m->saved_peak = job_peak_rss;
+    job_peak_rss = 0;
+    getrusage(RUSAGE_SELF, &m->self);
+    getrusage(RUSAGE_CHILDREN, &m->children);
+    clock_gettime(CLOCK_MONOTONIC, &m->start);
+}
+
+static void usage_end(const UsageMark *m, CmdUsage *u) {
+    struct timespec end;
+    struct rusage self, children;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    getrusage(RUSAGE_SELF, &self);
+    getrusage(RUSAGE_CHILDREN, &children);
+
+    u->real = (double)(end.tv_sec - m->start.tv_sec) + (end.tv_nsec - m->start.tv_nsec) / 1e9;
+    u->user = tv_seconds(self.ru_utime) - tv_seconds(m->self.ru_utime) +
+              tv_seconds(children.ru_utime) - tv_seconds(m->children.ru_utime);
+    u->sys = tv_seconds(self.ru_stime) - tv_seconds(m->self.ru_stime) +
+             tv_seconds(children.ru_stime) - tv_seconds(m->children.ru_stime);
+#define USAGE_DELTA(f) (self.f - m->self.f + children.f - m->children.f)
+    u->minflt = USAGE_DELTA(ru_minflt);
+    u->majflt = USAGE_DELTA(ru_majflt);
+    u->nvcsw = USAGE_DELTA(ru_nvcsw);
+    u->nivcsw = USAGE_DELTA(ru_nivcsw);
+#undef USAGE_DELTA
+    u->maxrss = job_peak_rss;
+    if (m->saved_peak > job_peak_rss)
+        job_peak_rss = m->saved_peak;
+}
+
+static void print_seconds(FILE *out, const char *label, double s) {
+    int min = (int)(s / 60);
+    fprintf(out, "%s\t%dm%.3fs\n", label, min, s - min * 60);
+}
+
+static void usage_print(FILE *out, const CmdUsage *u) {
+    print_seconds(out, "real", u->real);
+    print_seconds(out, "user", u->user);
+    print_seconds(out, "sys", u->sys);
+    fprintf(out, "maxrss\t%ld KiB\tfaults %ld minor, %ld major\tctxsw %ld voluntary, %ld involuntary\n",
+            u->maxrss, u->minflt, u->majflt, u->nvcsw, u->nivcsw);
+}
+
+// One line per stage of the last foreground pipeline.
+static void pipeusage_print(FILE *out) {
+    for (int i = 0; i < pipeusage_count; i++) {
+        const struct rusage *r = &pipeusage[i];
+        fprintf(out, "[%d]\tuser %.3fs\tsys %.3fs\tmaxrss %ld KiB\tfaults %ld\tctxsw %ld\n",
+                i + 1, tv_seconds(r->ru_utime), tv_seconds(r->ru_stime), r->ru_maxrss,
+                r->ru_minflt + r->ru_majflt, r->ru_nvcsw + r->ru_nivcsw);
     }
+}
 
-    posix_spawn_file_actions_t fa2;
-    posix_spawn_file_actions_init(&fa2);
-    posix_spawn_file_actions_adddup2(&fa2, pipefd[0], STDIN_FILENO);
-    posix_spawn_file_actions_addclose(&fa2, pipefd[1]);
-    posix_spawn_file_actions_addclose(&fa2, pipefd[0]);
-    pid_t pid2 = spawn_command(cmd2_args, &fa2);
-    posix_spawn_file_actions_destroy(&fa2);
+// Runs job j in the foreground: hands it the terminal and waits until it
+// finishes or stops. A finished job is removed; a stopped one stays in the
+// job table. Per-process statuses are left in pipestatus[]; returns the
+// status of the last one.
+int wait_foreground_job(Job *j) {
+    int interactive = job_control && isatty(STDIN_FILENO);
+    if (interactive)
+        tcsetpgrp(STDIN_FILENO, j->pgid);
+    fg_pid = -j->pgid;
+
+    while (j->status == JOB_RUNNING) {
+        int status;
+        struct rusage ru;
+        // without job control the processes share the subshell's group,
+        // which may hold other jobs' children too: wait for ours one by one
+        pid_t target = -j->pgid;
+        for (int i = 0; !job_control && i < j->nprocs; i++) {
+            if (j->procs[i].status == JOB_RUNNING) {
+                target = j->procs[i].pid;
+                break;
+            }
+        }
+        pid_t pid = wait4(target, &status, WUNTRACED, &ru);
+        if (pid < 0) {
+            if (errno == EINTR) continue;
+            if (target > 0) {
+                // reaped elsewhere; it has exited
+                job_update(target, 0, NULL);
+                continue;
+            }
+            // nothing left in the group; whatever we missed has exited
+            for (int i = 0; i < j->nprocs; i++)
+                if (j->procs[i].status != JOB_DONE)
+                    job_update(j->procs[i].pid, 0, NULL);
+            break;
+        }
+        // spawned before tcsetpgrp and touched the terminal: resume it
+        if (interactive && WIFSTOPPED(status) &&
+            (WSTOPSIG(status) == SIGTTIN || WSTOPSIG(status) == SIGTTOU)) {
+            kill(pid, SIGCONT);
+            continue;
+        }
+        job_update(pid, status, &ru);
+    }
 
-    close(pipefd[0]);
-    close(pipefd[1]);
+    if (interactive)
+        tcsetpgrp(STDIN_FILENO, getpgrp());
+    fg_pid = 0;
 
-    if (pid2 == -1) {
-        waitpid(pid1, NULL, 0);
-        return;
+    set_pipestatus(j->nprocs);
+    for (int i = 0; i < j->nprocs; i++)
+        pipestatus[i] = status_to_code(j->procs[i].wait_status);
+    if (j->nprocs > pipeusage_count) {
+        struct rusage *u = realloc(pipeusage, j->nprocs * sizeof(struct rusage));
+        if (!u) {
+            perror("realloc failed");
+            exit(1);
+        }
+        pipeusage = u;
     }
+    pipeusage_count = j->nprocs;
+    for (int i = 0; i < j->nprocs; i++)
+        pipeusage[i] = j->procs[i].usage;
+    last_status = pipestatus[j->nprocs - 1];
 
-    waitpid(pid1, NULL, 0);
-    waitpid(pid2, NULL, 0);
+    if (j->status == JOB_STOPPED) {
+        job_dequeue_notify(j);
+        printf("\n[%d] Stopped %d %s\n", j->jid, j->pgid, j->cmdline);
+    } else {
+        remove_job(j);
+    }
+    return last_status;
 }
 
+// Spawns a single command as a job with a process group of its own and
+// runs it in the foreground, or reports its job number if background.
+int run_job(char **args, posix_spawn_file_actions_t *actions, int background, const char *cmdline) {
+    posix_spawnattr_t attr;
+    init_spawnattr(&attr, job_control ? 0 : -1);
+    pid_t pid = spawn_command_attr(args, actions, &attr);
+    posix_spawnattr_destroy(&attr);
 
+    set_pipestatus(1);
+    if (pid < 0) {
+        last_status = pipestatus[0] = 127;
+        return last_status;
+    }
+    Job *j = add_job(pid, &pid, 1, cmdline);
+    if (!j) {
+        fprintf(stderr, "failed to add job\n");
+        int status = 0;
+        waitpid(pid, &status, 0);
+        last_status = pipestatus[0] = status_to_code(status);
+        return last_status;
+    }
+    if (background) {
+        if (job_control)
+            printf("[%d] %d\n", j->jid, pid);
+        last_status = pipestatus[0] = 0;
+        return 0;
+    }
+    return wait_foreground_job(j);
+}
 
-// Redirection >, <, >>
-void redirect_commands(char **args, const char *output_file,
-                       const char *input_file, int append)
-{
-    posix_spawn_file_actions_t fa;
-    posix_spawn_file_actions_init(&fa);
+// Pipe ends the shell holds for a stage it runs itself; forked stages must
+// not keep them open, or the pipe would never see EOF.
+static int fork_close[2] = {-1, -1};
+
+// Forks a copy of the shell that runs body with stdin/stdout taken from in
+// and out (-1 to keep them) and redirs applied on top, then exits with its
+// status. spare is a pipe end the child must not hold. pgid is as for
+// init_spawnattr; both sides set it so neither can run ahead of the other.
+static pid_t fork_subshell(void *body, int in, int out, int spare, const Redirect *redirs, pid_t pgid) {
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return -1;
+    }
+    if (pid > 0) {
+        if (pgid >= 0)
+            setpgid(pid, pgid ? pgid : pid);
+        return pid;
+    }
 
-    if (input_file)
-        posix_spawn_file_actions_addopen(&fa, STDIN_FILENO, input_file, O_RDONLY, 0);
+    if (pgid >= 0)
+        setpgid(0, pgid);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTSTP, SIG_DFL);
+    signal(SIGTTOU, SIG_DFL);
+    signal(SIGTTIN, SIG_DFL);
+    signal(SIGPIPE, SIG_DFL);
+    sigset_t none;
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, NULL);
+    jobs_reset_child();
 
-    if (output_file) {
-        int flags = O_CREAT | O_WRONLY | (append ? O_APPEND : O_TRUNC);
-        posix_spawn_file_actions_addopen(&fa, STDOUT_FILENO, output_file, flags, 0644);
+    if (spare != -1) close(spare);
+    for (int i = 0; i < 2; i++)
+        if (fork_close[i] != -1) close(fork_close[i]);
+    if (in != -1 && in != STDIN_FILENO) {
+        dup2(in, STDIN_FILENO);
+        close(in);
     }
+    if (out != -1 && out != STDOUT_FILENO) {
+        dup2(out, STDOUT_FILENO);
+        close(out);
+    }
+    for (const Redirect *r = redirs; r; r = r->next)
+        if (redirect_apply(r) < 0)
+            _exit(1);
 
-    pid_t pid = spawn_command(args, &fa);
-    posix_spawn_file_actions_destroy(&fa);
+    int status = exec_subshell_body(body);
+    fflush(NULL);
+    _exit(status);
+}
 
-    if (pid > 0)
-        waitpid(pid, NULL, 0);
+// Runs stages[0] | stages[1] | ... | stages[n-1]. Every stage is spawned in
+// a single pass into one process group led by the first stage, and each pipe
+// end is closed in the shell as soon as the stage that needs it exists, so a
+// reader always sees EOF once its writer exits. The pipeline is one job.
+// Returns the status of the last stage; per-stage statuses are left in
+// pipestatus[].
+//
+// In a foreground pipeline the first in_shell stage is not forked: its pipe
+// ends are kept, and once every other stage is running the shell runs the
+// builtin itself on them. Its readers and writers are live processes by
+// then, so it cannot block on a full pipe that nobody drains. Not under
+// job control on a terminal, though: there the job must own the terminal
+// while it runs (`cat f | less`) and Ctrl-Z must be able to stop all of
+// it, neither of which the shell itself can be part of.
+int Pipe_commands(const PipeStage *stages, int n, int background, const char *cmdline) {
+    pid_t pids[n];
+    pid_t pgid = 0;
+    int prev_read = -1;
+    int here = -1, here_in = -1, here_out = -1;
+    int terminal = job_control && isatty(STDIN_FILENO);
+    for (int i = 0; i < n && !background && !terminal; i++) {
+        if (stages[i].in_shell) {
+            here = i;
+            break;
+        }
+    }
+
+    for (int i = 0; i < n; i++) {
+        int pipefd[2] = {-1, -1};
+        if (i < n - 1 && pipe2(pipefd, O_CLOEXEC) == -1) {
+            perror("pipe");
+            n = i;
+            break;
+        }
+
+        if (i == here) {
+            pids[i] = 0;
+            fork_close[0] = here_in = prev_read;
+            fork_close[1] = here_out = pipefd[1];
+            prev_read = pipefd[0];
+            continue;
+        }
+        if (stages[i].body) {
+            pids[i] = fork_subshell(stages[i].body, prev_read, pipefd[1], pipefd[0],
+                                    stages[i].redirs, job_control ? pgid : -1);
+        } else {
+            // All pipe fds are close-on-exec; dup2 clears the flag on the copy,
+            // so each stage ends up holding only its own stdin/stdout.
+            posix_spawn_file_actions_t fa;
+            posix_spawn_file_actions_init(&fa);
+            if (prev_read != -1)
+                posix_spawn_file_actions_adddup2(&fa, prev_read, STDIN_FILENO);
+            if (pipefd[1] != -1)
+                posix_spawn_file_actions_adddup2(&fa, pipefd[1], STDOUT_FILENO);
+            // a stage's own redirections win over the pipe, as in sh
+            pids[i] = -1;
+            if (add_redirects(&fa, stages[i].redirs) == 0) {
+                posix_spawnattr_t attr;
+                init_spawnattr(&attr, job_control ? pgid : -1);
+                pids[i] = spawn_command_attr(stages[i].argv, &fa, &attr);
+                posix_spawnattr_destroy(&attr);
+            }
+            redirect_release();
+            posix_spawn_file_actions_destroy(&fa);
+        }
+
+        if (prev_read != -1) close(prev_read);
+        if (pipefd[1] != -1) close(pipefd[1]);
+        prev_read = pipefd[0];
+
+        if (pids[i] > 0 && pgid == 0)
+            pgid = pids[i];
+    }
+    if (prev_read != -1) close(prev_read);
+    fork_close[0] = fork_close[1] = -1;
+
+    int here_status = 0;
+    if (here >= 0 && here < n) {
+        // a reader that quits early must not take the shell down with it
+        void (*old_pipe)(int) = signal(SIGPIPE, SIG_IGN);
+        fflush(stdout);
+        int saved_in = here_in != -1 ? fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 10) : -1;
+        int saved_out = here_out != -1 ? fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10) : -1;
+        if (here_in != -1) dup2(here_in, STDIN_FILENO);
+        if (here_out != -1) dup2(here_out, STDOUT_FILENO);
+        here_status = exec_subshell_body(stages[here].body);
+        fflush(stdout);
+        if (saved_in != -1) {
+            dup2(saved_in, STDIN_FILENO);
+            close(saved_in);
+        }
+        if (saved_out != -1) {
+            dup2(saved_out, STDOUT_FILENO);
+            close(saved_out);
+        }
+        clearerr(stdout);
+        signal(SIGPIPE, old_pipe);
+    }
+    if (here_in != -1) close(here_in);
+    if (here_out != -1) close(here_out);
+
+    Job *j = pgid ? add_job(pgid, pids, n, cmdline) : NULL;
+    if (!j) {
+        if (pgid)
+            fprintf(stderr, "failed to add job\n");
+        for (int i = 0; i < n; i++)
+            if (pids[i] > 0) waitpid(pids[i], NULL, 0);
+        set_pipestatus(n > 0 ? n : 1);
+        for (int i = 0; i < pipestatus_count; i++)
+            pipestatus[i] = i == here ? here_status : 127;
+        last_status = pipestatus[pipestatus_count - 1];
+        return last_status;
+    }
+    if (here >= 0 && here < n)
+        j->procs[here].wait_status = W_EXITCODE(here_status & 0xff, 0);
+
+    if (background) {
+        if (job_control)
+            printf("[%d] %d\n", j->jid, pgid);
+        set_pipestatus(n);
+        for (int i = 0; i < n; i++)
+            pipestatus[i] = 0;
+        last_status = 0;
+        return last_status;
+    }
+    return wait_foreground_job(j);
+}
+
+// `wait [%job | pid]`: waits for one job, or for every running job.
+int wait_commands(char **args) {
+    Job *j = NULL;
+    if (args[1]) {
+        j = find_job_spec(args[1]);
+        if (!j) {
+            fprintf(stderr, "wait: %s: no such job\n", args[1]);
+            return 127;
+        }
+    }
+    if (jobs_wait(j) < 0)
+        return 130;
+
+    // waited-for jobs are not reported again
+    int status = 0;
+    if (j) {
+        if (j->status == JOB_DONE) {
+            status = status_to_code(job_wait_status(j));
+            remove_job(j);
+        }
+        return status;
+    }
+    for (Job *k = job_first, *next; k; k = next) {
+        next = k->next;
+        if (k->status == JOB_DONE) remove_job(k);
+    }
+    return 0;
+}
+
+
+
+// Runs a command with its redirections applied in order.
+void redirect_commands(char **args, const Redirect *redirs, int background, const char *cmdline)
+{
+    posix_spawn_file_actions_t fa;
+    posix_spawn_file_actions_init(&fa);
+    if (add_redirects(&fa, redirs) == 0) {
+        run_job(args, &fa, background, cmdline);
+    } else {
+        set_pipestatus(1);
+        last_status = pipestatus[0] = 1;
+    }
+    redirect_release();
+    posix_spawn_file_actions_destroy(&fa);
 }
 
 
@@ -0,0 +1,468 @@
+#ifndef COMPLETE_H
+#define COMPLETE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <linux/limits.h>
+#include <sys/stat.h>
+#include "builtins.h"
+
+// ---------------- Completion -----------------
+//
+// Tab completes the word before the cursor. The first word of a command
+// completes from the builtins and every executable on PATH. Any other word,
+// or a word with a '/' in it, completes from a directory.
+//
+// Commands live in a prefix trie, so a lookup only walks the prefix. Each
+// node counts the names below it, which gives the number of matches and
+// their longest common prefix without visiting them. The trie is built
+// from one cached listing per PATH directory, found with path_next and the
+// same executable test as path_search. Before every lookup the directories
+// are stat'ed: a changed PATH, or a directory whose mtime moved, is
+// rescanned and the trie rebuilt. Otherwise a Tab costs one stat per PATH
+// directory plus the walk.
+//
+// Directory listings for file names are cached the same way: the last
+// COMP_DIR_CACHE directories, sorted, keyed by absolute path and checked
+// against their mtime. A prefix is found by binary search.
+
+#define COMP_DIR_CACHE 16
+#define COMP_LIST_MAX 200       // candidates listed on a second Tab
+
+typedef struct {
+    uint32_t child;             // first child; 0 = none (0 is the root)
+    uint32_t sibling;           // next sibling, in byte order
+    uint32_t count;             // names ending in this subtree
+    unsigned char c;
+    unsigned char terminal;
+} TrieNode;
+
+typedef struct {
+    TrieNode *nodes;
+    uint32_t n, cap;
+} Trie;
+
+typedef struct {
+    char *dir;
+    struct timespec mtime;
+    char *names;                // NUL-separated executables
+    size_t len;
+} CompPathDir;
+
+typedef struct {
+    const char *name;
+    int is_dir;
+} CompEntry;
+
+typedef struct {
+    char *path;                 // absolute
+    struct timespec mtime;
+    char *pool;                 // the names
+    CompEntry *entries;         // sorted by name
+    size_t n;
+    unsigned long used;         // LRU tick
+} CompDir;
+
+// What Tab found for a word: how many candidates, their longest common
+// prefix, and with want_list the candidates themselves (at most
+// COMP_LIST_MAX). For file names all of it is about the part after the
+// last '/'.
+typedef struct {
+    size_t count;
+    char *common;
+    int is_dir;                 // the one candidate is a directory
+    char **items;
+    size_t nitems;
+} CompResult;
+
+static Trie comp_trie;
+static CompPathDir *comp_path_dirs;
+static size_t comp_npath_dirs;
+static char *comp_path;         // PATH the caches were built for
+static CompDir comp_dirs[COMP_DIR_CACHE];
+static unsigned long comp_tick;
+
+static void *comp_alloc(size_t size) {
+    void *p = malloc(size ? size : 1);
+    if (!p) {
+        perror("malloc failed");
+        exit(1);
+    }
+    return p;
+}
+
+static int comp_same_time(struct timespec a, struct timespec b) {
+    return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+
+// --- trie ---
+
+static uint32_t trie_node(Trie *t, unsigned char c) {
+    if (t->n == t->cap) {
+        t->cap = t->cap ? t->cap * 2 : 4096;
+        TrieNode *grown = realloc(t->nodes, t->cap * sizeof(TrieNode));
+        if (!grown) {
+            perror("realloc failed");
+            exit(1);
+        }
+        t->nodes = grown;
+    }
+    t->nodes[t->n] = (TrieNode){0, 0, 0, c, 0};
+    return t->n++;
+}
+
+static void trie_clear(Trie *t) {
+    t->n = 0;
+    trie_node(t, 0);            // the root
+}
+
+// The child of node for byte c, or 0.
+static uint32_t trie_child(const Trie *t, uint32_t node, unsigned char c) {
+    for (uint32_t k = t->nodes[node].child; k; k = t->nodes[k].sibling) {
+        if (t->nodes[k].c == c) return k;
+        if (t->nodes[k].c > c) break;
+    }
+    return 0;
+}
+
+static void trie_insert(Trie *t, const char *name) {
+    uint32_t path[NAME_MAX + 1];
+    size_t depth = 0;
+    uint32_t node = 0;
+    for (const unsigned char *s = (const unsigned char *)name; *s && depth < NAME_MAX; s++) {
+        path[depth++] = node;
+        // keep siblings sorted so listings come out in order
+        uint32_t *link = &t->nodes[node].child;
+        while (*link && t->nodes[*link].c < *s) link = &t->nodes[*link].sibling;
+        if (*link && t->nodes[*link].c == *s) {
+            node = *link;
+            continue;
+        }
+        uint32_t k = trie_node(t, *s);     // may move t->nodes; redo the link
+        link = &t->nodes[node].child;
+        while (*link && t->nodes[*link].c < *s) link = &t->nodes[*link].sibling;
+        t->nodes[k].sibling = *link;
+        *link = k;
+        node = k;
+    }
+    if (t->nodes[node].terminal) return;
+    t->nodes[node].terminal = 1;
+    t->nodes[node].count++;
+    for (size_t i = 0; i < depth; i++) t->nodes[path[i]].count++;
+}
+
+static void trie_collect(const Trie *t, uint32_t node, char *buf, size_t len, CompResult *r) {
+    if (t->nodes[node].terminal && r->nitems < COMP_LIST_MAX) {
+        buf[len] = '\0';
+        r->items[r->nitems++] = strdup(buf);
+    }
+    if (len >= NAME_MAX) return;
+    for (uint32_t k = t->nodes[node].child; k && r->nitems < COMP_LIST_MAX; k = t->nodes[k].sibling) {
+        buf[len] = (char)t->nodes[k].c;
+        trie_collect(t, k, buf, len + 1, r);
+    }
+}
+
+// --- command names ---
+
+// Lists the executables in dir the way path_search would accept them.
+static void comp_scan_path_dir(CompPathDir *d) {
+    free(d->names);
+    d->names = NULL;
+    d->len = 0;
+    DIR *dir = opendir(d->dir);
+    if (!dir) return;
+    size_t cap = 0;
+    struct dirent *e;
+    while ((e = readdir(dir))) {
+        if (e->d_name[0] == '.' && (!e->d_name[1] || (e->d_name[1] == '.' && !e->d_name[2])))
+            continue;
+        if (e->d_type != DT_REG && e->d_type != DT_LNK && e->d_type != DT_UNKNOWN)
+            continue;
+        struct stat st;
+        if (e->d_type != DT_REG &&
+            (fstatat(dirfd(dir), e->d_name, &st, 0) != 0 || !S_ISREG(st.st_mode)))
+            continue;
+        if (faccessat(dirfd(dir), e->d_name, X_OK, 0) != 0)
+            continue;
+        size_t n = strlen(e->d_name) + 1;
+        if (d->len + n > cap) {
+            cap = cap ? cap * 2 : 4096;
+            while (d->len + n > cap) cap *= 2;
+            char *grown = realloc(d->names, cap);
+            if (!grown) {
+                perror("realloc failed");
+                exit(1);
+            }
+            d->names = grown;
+        }
+        memcpy(d->names + d->len, e->d_name, n);
+        d->len += n;
+    }
+    closedir(dir);
+}
+
+static void comp_free_path_dirs(void) {
+    for (size_t i = 0; i < comp_npath_dirs; i++) {
+        free(comp_path_dirs[i].dir);
+        free(comp_path_dirs[i].names);
+    }
+    free(comp_path_dirs);
+    comp_path_dirs = NULL;
+    comp_npath_dirs = 0;
+}
+
+// Brings the command trie up to date with PATH and its directories.
+static void comp_refresh_commands(void) {
+    const char *path = path_value();
+    int rebuild = comp_trie.n == 0;
+    if (!comp_path || strcmp(comp_path, path) != 0) {
+        comp_free_path_dirs();
+        free(comp_path);
+        comp_path = strdup(path);
+        char dir[PATH_MAX];
+        size_t cap = 0;
+        for (const char *p = path; path_next(&p, dir, sizeof(dir));) {
+            if (!dir[0]) continue;
+            if (comp_npath_dirs == cap) {
+                cap = cap ? cap * 2 : 16;
+                CompPathDir *grown = realloc(comp_path_dirs, cap * sizeof(CompPathDir));
+                if (!grown) {
+                    perror("realloc failed");
+                    exit(1);
+                }
+                comp_path_dirs = grown;
+            }
+            comp_path_dirs[comp_npath_dirs++] = (CompPathDir){strdup(dir), {-1, 0}, NULL, 0};
+        }
+        rebuild = 1;
+    }
+    for (size_t i = 0; i < comp_npath_dirs; i++) {
+        CompPathDir *d = &comp_path_dirs[i];
+        struct stat st;
+        struct timespec mtime = {-1, 0};
+        if (stat(d->dir, &st) == 0) mtime = st.st_mtim;
+        if (comp_same_time(mtime, d->mtime)) continue;
+        d->mtime = mtime;
+        comp_scan_path_dir(d);
+        rebuild = 1;
+    }
+    if (!rebuild) return;
+
+    trie_clear(&comp_trie);
+    for (size_t i = 0; i < builtin_count; i++)
+        trie_insert(&comp_trie, builtin_table[i].name);
+    for (size_t i = 0; i < comp_npath_dirs; i++)
+        for (size_t off = 0; off < comp_path_dirs[i].len; off += strlen(comp_path_dirs[i].names + off) + 1)
+            trie_insert(&comp_trie, comp_path_dirs[i].names + off);
+}
+
+static void complete_command(const char *prefix, int want_list, CompResult *r) {
+    comp_refresh_commands();
+    const Trie *t = &comp_trie;
+    size_t len = strlen(prefix);
+    uint32_t node = 0;
+    for (size_t i = 0; i < len && node != UINT32_MAX; i++) {
+        uint32_t k = trie_child(t, node, (unsigned char)prefix[i]);
+        node = k ? k : UINT32_MAX;
+    }
+    if (node == UINT32_MAX || t->nodes[node].count == 0)
+        return;
+    r->count = t->nodes[node].count;
+
+    // the common prefix runs down while there is only one way to go
+    char buf[NAME_MAX + 1];
+    memcpy(buf, prefix, len < NAME_MAX ? len : NAME_MAX);
+    size_t n = len < NAME_MAX ? len : NAME_MAX;
+    uint32_t at = node;
+    while (!t->nodes[at].terminal && n < NAME_MAX) {
+        uint32_t k = t->nodes[at].child;
+        if (!k || t->nodes[k].sibling) break;
+        buf[n++] = (char)t->nodes[k].c;
+        at = k;
+    }
+    buf[n] = '\0';
+    r->common = strdup(buf);
+
+    if (want_list) {
+        r->items = comp_alloc(COMP_LIST_MAX * sizeof(char *));
+        memcpy(buf, prefix, len < NAME_MAX ? len : NAME_MAX);
+        trie_collect(t, node, buf, len < NAME_MAX ? len : NAME_MAX, r);
+    }
+}
+
+// --- file names ---
+
+static int comp_cmp_entries(const void *a, const void *b) {
+    return strcmp(((const CompEntry *)a)->name, ((const CompEntry *)b)->name);
+}
+
+static void comp_dir_free(CompDir *d) {
+    free(d->path);
+    free(d->pool);
+    free(d->entries);
+    memset(d, 0, sizeof(*d));
+}
+
+static int comp_dir_scan(CompDir *d, struct timespec mtime) {
+    DIR *dir = opendir(d->path);
+    if (!dir) return -1;
+    size_t pool_len = 0, pool_cap = 4096, cap = 64, n = 0;
+    d->pool = comp_alloc(pool_cap);
+    CompEntry *entries = comp_alloc(cap * sizeof(CompEntry));
+    struct dirent *e;
+    while ((e = readdir(dir))) {
+        if (e->d_name[0] == '.' && (!e->d_name[1] || (e->d_name[1] == '.' && !e->d_name[2])))
+            continue;
+        int is_dir = e->d_type == DT_DIR;
+        if (e->d_type == DT_LNK || e->d_type == DT_UNKNOWN) {
+            struct stat st;
+            is_dir = fstatat(dirfd(dir), e->d_name, &st, 0) == 0 && S_ISDIR(st.st_mode);
+        }
+        size_t len = strlen(e->d_name) + 1;
+        if (pool_len + len > pool_cap) {
+            while (pool_len + len > pool_cap) pool_cap *= 2;
+            char *grown = realloc(d->pool, pool_cap);
+            if (!grown) {
+                perror("realloc failed");
+                exit(1);
+            }
+            d->pool = grown;
+        }
+        if (n == cap) {
+            cap *= 2;
+            CompEntry *grown = realloc(entries, cap * sizeof(CompEntry));
+            if (!grown) {
+                perror("realloc failed");
+                exit(1);
+            }
+            entries = grown;
+        }
+        memcpy(d->pool + pool_len, e->d_name, len);
+        // the pool may still move; keep offsets until it is complete
+        entries[n++] = (CompEntry){(const char *)(uintptr_t)pool_len, is_dir};
+        pool_len += len;
+    }
+    closedir(dir);
+    for (size_t i = 0; i < n; i++)
+        entries[i].name = d->pool + (uintptr_t)entries[i].name;
+    qsort(entries, n, sizeof(CompEntry), comp_cmp_entries);
+    d->entries = entries;
+    d->n = n;
+    d->mtime = mtime;
+    return 0;
+}
+
+// The cached listing of the absolute directory path, rescanned when its
+// mtime has moved. NULL if it cannot be read.
+static CompDir *comp_dir_get(const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode))
+        return NULL;
+    CompDir *d = NULL, *victim = &comp_dirs[0];
+    for (int i = 0; i < COMP_DIR_CACHE; i++) {
+        if (comp_dirs[i].path && strcmp(comp_dirs[i].path, path) == 0) {
+            d = &comp_dirs[i];
+            break;
+        }
+        if (comp_dirs[i].used < victim->used) victim = &comp_dirs[i];
+    }
+    if (d && !comp_same_time(d->mtime, st.st_mtim)) {
+        char *keep = d->path;
+        d->path = NULL;
+        comp_dir_free(d);
+        d->path = keep;
+        if (comp_dir_scan(d, st.st_mtim) != 0) {
+            comp_dir_free(d);
+            return NULL;
+        }
+    } else if (!d) {
+        d = victim;
+        comp_dir_free(d);
+        d->path = strdup(path);
+        if (comp_dir_scan(d, st.st_mtim) != 0) {
+            comp_dir_free(d);
+            return NULL;
+        }
+    }
+    d->used = ++comp_tick;
+    return d;
+}
+
+// word is the unquoted word being completed, relative to the cwd or
+// absolute, with ~ for $HOME.
+static void complete_file(const char *word, int want_list, CompResult *r) {
+    const char *slash = strrchr(word, '/');
+    const char *base = slash ? slash + 1 : word;
+
+    // the directory: word up to its last '/', made absolute
+    char path[PATH_MAX];
+    size_t plen = 0;
+    const char *rel = word;
+    if (word[0] == '~' && word[1] == '/') {
+        const char *home = getenv("HOME");
+        plen = (size_t)snprintf(path, sizeof(path), "%s", home ? home : "");
+        rel = word + 1;
+    } else if (word[0] != '/') {
+        if (!getcwd(path, sizeof(path) - 1)) return;
+        plen = strlen(path);
+        path[plen++] = '/';
+    }
+    size_t rlen = slash ? (size_t)(slash + 1 - rel) : 0;
+    if (plen + rlen + 1 >= sizeof(path)) return;
+    memcpy(path + plen, rel, rlen);
+    path[plen + rlen] = '\0';
+
+    CompDir *d = comp_dir_get(path[0] ? path : "/");
+    if (!d) return;
+    size_t blen = strlen(base);
+    size_t lo = 0, hi = d->n;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (strncmp(d->entries[mid].name, base, blen) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    size_t common = 0, first = SIZE_MAX, last = 0;
+    for (size_t i = lo; i < d->n && strncmp(d->entries[i].name, base, blen) == 0; i++) {
+        if (d->entries[i].name[0] == '.' && base[0] != '.')
+            continue;           // dot files only when asked for
+        if (first == SIZE_MAX) {
+            first = i;
+            common = strlen(d->entries[i].name);
+        } else {
+            size_t k = blen;
+            while (k < common && d->entries[i].name[k] == d->entries[first].name[k]) k++;
+            common = k;
+        }
+        last = i;
+        r->count++;
+        if (want_list) {
+            if (!r->items) r->items = comp_alloc(COMP_LIST_MAX * sizeof(char *));
+            if (r->nitems < COMP_LIST_MAX) {
+                size_t n = strlen(d->entries[i].name);
+                char *item = comp_alloc(n + 2);
+                memcpy(item, d->entries[i].name, n);
+                item[n] = d->entries[i].is_dir ? '/' : '\0';
+                item[n + 1] = '\0';
+                r->items[r->nitems++] = item;
+            }
+        }
+    }
+    if (r->count == 0) return;
+    r->common = strndup(d->entries[first].name, common);
+    r->is_dir = r->count == 1 && d->entries[last].is_dir;
+}
+
+static void comp_result_free(CompResult *r) {
+    for (size_t i = 0; i < r->nitems; i++) free(r->items[i]);
+    free(r->items);
+    free(r->common);
+    memset(r, 0, sizeof(*r));
+}
+
+#endif
@@ -0,0 +1,797 @@
+#ifndef COPY_H
+#define COPY_H
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include "jobs.h"
+#include "threadpool.h"
+
+// ---------------- cat, cp, tee -----------------
+//
+//   cat [--stats] [file...]
+//   cp [-r] [-j N] [--stats] src... dest
+//   tee [-a] [--stats] [file...]
+//
+// These run in the shell and leave the data to the kernel wherever it can
+// move it without a trip through user memory. Each copy starts with the
+// best method for its pair of fds and drops to the next one when the
+// kernel refuses the pair (EINVAL, EXDEV, ...), carrying on from the same
+// position:
+//
+//   clone            cp of a whole file: FICLONE shares the blocks (reflink)
+//   copy_file_range  file to file; the filesystem may still reflink it or
+//                    copy on the server
+//   splice           into or out of a pipe
+//   sendfile         file to anything else (a terminal, a socket)
+//   read/write       through a 1 MiB page-aligned buffer
+//
+// --stats prints the bytes, time, throughput and how many bytes each
+// method moved to stderr. Any other flag runs the real command. Ctrl-C
+// interrupts even a blocked read; the status is then 130.
+
+#define COPY_BUF (1 << 20)              // read/write fallback buffer
+#define COPY_CHUNK ((size_t)1 << 30)    // per copy_file_range/sendfile call
+#define COPY_PIPE_CHUNK ((size_t)1 << 20)
+
+typedef enum {
+    COPY_CLONE,
+    COPY_RANGE,
+    COPY_SPLICE,
+    COPY_SENDFILE,
+    COPY_RW,
+    COPY_METHODS,
+} CopyMethod;
+
+static const char *copy_method_names[COPY_METHODS] = {
+    "clone", "copy_file_range", "splice", "sendfile", "read/write",
+};
+
+typedef struct {
+    uint64_t bytes;
+    uint64_t files;
+    uint64_t dirs;
+    uint64_t errors;
+    uint64_t by_method[COPY_METHODS];
+    char *buf;              // read/write buffer, allocated on first use
+    char pad[64];           // keep workers off each other's cache line
+} CopyStats;
+
+// --- moving bytes ---
+
+static int copy_write_all(int fd, const char *s, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, s, len);
+        if (n < 0) {
+            if (errno == EINTR && !sigint_flag) continue;
+            return -1;
+        }
+        s += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static ssize_t copy_rw(int in, int out, CopyStats *st) {
+    if (!st->buf && posix_memalign((void **)&st->buf, 4096, COPY_BUF) != 0) {
+        st->buf = NULL;
+        errno = ENOMEM;
+        return -1;
+    }
+    ssize_t n = read(in, st->buf, COPY_BUF);
+    if (n > 0 && copy_write_all(out, st->buf, (size_t)n) < 0)
+        return -1;
+    return n;
+}
+
+// Errors that mean "not for this pair of fds" rather than a real failure.
+static int copy_unsupported(int err) {
+    return err == EINVAL || err == EXDEV || err == ENOSYS || err == EOPNOTSUPP || err == EBADF;
+}
+
+// Copies in to out, from their current positions until EOF on in. Returns
+// -1 with errno set on failure; EINTR means Ctrl-C.
+static int copy_fd(int in, int out, CopyStats *st) {
+    struct stat si, so;
+    if (fstat(in, &si) < 0 || fstat(out, &so) < 0)
+        return -1;
+    // files in /proc and /sys claim to be empty; only read() sees inside
+    int in_file = S_ISREG(si.st_mode) && si.st_size > 0;
+    CopyMethod m = in_file && S_ISREG(so.st_mode)             ? COPY_RANGE
+                 : S_ISFIFO(si.st_mode) || S_ISFIFO(so.st_mode) ? COPY_SPLICE
+                 : in_file                                     ? COPY_SENDFILE
+                                                               : COPY_RW;
+    for (;;) {
+        if (sigint_flag) {
+            errno = EINTR;
+            return -1;
+        }
+        ssize_t n;
+        switch (m) {
+        case COPY_RANGE:
+            n = copy_file_range(in, NULL, out, NULL, COPY_CHUNK, 0);
+            break;
+        case COPY_SPLICE:
+            n = splice(in, NULL, out, NULL, COPY_PIPE_CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE);
+            break;
+        case COPY_SENDFILE:
+            n = sendfile(out, in, NULL, COPY_CHUNK);
+            break;
+        default:
+            n = copy_rw(in, out, st);
+            break;
+        }
+        if (n == 0)
+            return 0;
+        if (n > 0) {
+            st->bytes += (uint64_t)n;
+            st->by_method[m] += (uint64_t)n;
+            continue;
+        }
+        if (errno == EINTR && !sigint_flag)
+            continue;
+        if (m == COPY_RW || !copy_unsupported(errno))
+            return -1;
+        m = m == COPY_RANGE && in_file ? COPY_SENDFILE : COPY_RW;
+    }
+}
+
+// --- shared pieces of the builtins ---
+
+static struct sigaction copy_saved_int;
+
+// Lets Ctrl-C interrupt blocking reads and writes: the shell's handler is
+// installed with SA_RESTART, which would resume them.
+static void copy_begin(struct timespec *start) {
+    struct sigaction sa;
+    sigint_flag = 0;
+    sigaction(SIGINT, NULL, &copy_saved_int);
+    sa = copy_saved_int;
+    if (sa.sa_handler != SIG_DFL && sa.sa_handler != SIG_IGN) {
+        sa.sa_flags &= ~SA_RESTART;
+        sigaction(SIGINT, &sa, NULL);
+    }
+    fflush(stdout);
+    clock_gettime(CLOCK_MONOTONIC, start);
+}
+
+static void copy_end(void) {
+    sigaction(SIGINT, &copy_saved_int, NULL);
+}
+
+static void copy_report(const char *cmd, const CopyStats *st, struct timespec start, int threads) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    fprintf(stderr, "%s: ", cmd);
+    if (st->files || st->dirs)
+        fprintf(stderr, "%llu files, %llu directories, ", (unsigned long long)st->files,
+                (unsigned long long)st->dirs);
+    fprintf(stderr, "%llu bytes in %.3fs, %.1f MB/s", (unsigned long long)st->bytes, secs,
+            secs > 0 ? st->bytes / secs / 1e6 : 0.0);
+    const char *sep = " (";
+    for (int m = 0; m < COPY_METHODS; m++) {
+        if (st->by_method[m]) {
+            fprintf(stderr, "%s%s %llu", sep, copy_method_names[m], (unsigned long long)st->by_method[m]);
+            sep = ", ";
+        }
+    }
+    if (*sep == ',') fputc(')', stderr);
+    if (threads > 1) fprintf(stderr, ", %d threads", threads);
+    if (st->errors) fprintf(stderr, ", %llu errors", (unsigned long long)st->errors);
+    fputc('\n', stderr);
+}
+
+// Runs the real command for flags the builtins do not handle.
+static int copy_external(char **args) {
+    return run_job(args, NULL, 0, args[0]);
+}
+
+// --- cat ---
+
+int cat_commands(char **args) {
+    int stats = 0, i = 1;
+    for (; args[i] && args[i][0] == '-' && args[i][1]; i++) {
+        if (strcmp(args[i], "--") == 0) {
+            i++;
+            break;
+        }
+        if (strcmp(args[i], "--stats") != 0)
+            return copy_external(args);
+        stats = 1;
+    }
+    static char *stdin_only[] = {"-", NULL};
+    char **files = args[i] ? &args[i] : stdin_only;
+
+    CopyStats st = {0};
+    struct timespec start;
+    struct stat so;
+    int have_out = fstat(STDOUT_FILENO, &so) == 0;
+    int status = 0, stop = 0;
+    copy_begin(&start);
+    for (; *files && !stop; files++) {
+        const char *name = *files;
+        int fd = strcmp(name, "-") == 0 ? STDIN_FILENO : open(name, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            fprintf(stderr, "cat: %s: %s\n", name, strerror(errno));
+            status = 1;
+            continue;
+        }
+        struct stat si;
+        if (have_out && S_ISREG(so.st_mode) && fstat(fd, &si) == 0 && si.st_dev == so.st_dev &&
+            si.st_ino == so.st_ino) {
+            fprintf(stderr, "cat: %s: input file is output file\n", name);
+            status = 1;
+        } else if (copy_fd(fd, STDOUT_FILENO, &st) < 0) {
+            // a reader that went away or Ctrl-C ends the whole cat
+            stop = errno == EINTR || errno == EPIPE;
+            if (!stop)
+                fprintf(stderr, "cat: %s: %s\n", name, strerror(errno));
+            status = errno == EINTR ? 130 : 1;
+        }
+        if (fd != STDIN_FILENO) close(fd);
+    }
+    copy_end();
+    if (stats) copy_report("cat", &st, start, 1);
+    free(st.buf);
+    return status;
+}
+
+// --- tee ---
+//
+// When stdin is a pipe, tee(2) duplicates what is in it without consuming
+// it. Each round, the first output that is a pipe (stdout, usually) gets
+// tee'd straight into it, which decides the round's size n; every other
+// regular file or pipe gets n bytes tee'd into a private pipe and spliced
+// on from there. The private pipe is at least as large as stdin's and
+// empty each time, so it always takes all n. Finally the n bytes are
+// consumed: spliced into the last such output, or read into the buffer
+// once for the outputs that take neither (a terminal, an O_APPEND file).
+
+typedef struct {
+    int fd;
+    const char *name;
+    int rw;             // cannot splice: gets the bytes with write()
+    int pipe;
+} TeeOut;
+
+// Moves exactly n bytes from in to out with splice.
+static int tee_splice_n(int in, int out, size_t n) {
+    while (n > 0) {
+        ssize_t m = splice(in, NULL, out, NULL, n, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (m < 0 && errno == EINTR && !sigint_flag) continue;
+        if (m <= 0) {
+            if (m == 0) errno = EPIPE;
+            return -1;
+        }
+        n -= (size_t)m;
+    }
+    return 0;
+}
+
+// Writes one round to every output; returns the bytes consumed from
+// stdin, 0 at EOF, -1 on error with *bad set to the failing output.
+static ssize_t tee_round(TeeOut *outs, int nouts, int priv[2], int consumer, CopyStats *st, int *bad) {
+    size_t n = 0;
+    int have_n = 0;
+    for (int i = 0; i < nouts; i++) {
+        if (outs[i].rw || i == consumer)
+            continue;
+        int direct = outs[i].pipe && !have_n;
+        ssize_t t;
+        do {
+            t = tee(STDIN_FILENO, direct ? outs[i].fd : priv[1], have_n ? n : COPY_PIPE_CHUNK, 0);
+        } while (t < 0 && errno == EINTR && !sigint_flag);
+        *bad = i;
+        if (t < 0) return -1;
+        if (!have_n) {
+            if (t == 0) return 0;
+            n = (size_t)t;
+            have_n = 1;
+        } else if ((size_t)t != n) {
+            errno = EIO;
+            return -1;
+        }
+        if (!direct && tee_splice_n(priv[0], outs[i].fd, n) < 0)
+            return -1;
+        st->by_method[COPY_SPLICE] += n;
+    }
+
+    if (consumer >= 0) {
+        *bad = consumer;
+        if (!have_n) {
+            ssize_t t;
+            do {
+                t = splice(STDIN_FILENO, NULL, outs[consumer].fd, NULL, COPY_PIPE_CHUNK,
+                           SPLICE_F_MOVE | SPLICE_F_MORE);
+            } while (t < 0 && errno == EINTR && !sigint_flag);
+            if (t <= 0) return t;
+            n = (size_t)t;
+        } else if (tee_splice_n(STDIN_FILENO, outs[consumer].fd, n) < 0) {
+            return -1;
+        }
+        st->by_method[COPY_SPLICE] += n;
+    } else {
+        for (size_t left = n; left > 0;) {
+            *bad = -1;
+            ssize_t r = read(STDIN_FILENO, st->buf, left < COPY_BUF ? left : COPY_BUF);
+            if (r < 0 && errno == EINTR && !sigint_flag) continue;
+            if (r <= 0) {
+                if (r == 0) errno = EIO;
+                return -1;
+            }
+            for (int i = 0; i < nouts; i++) {
+                *bad = i;
+                if (outs[i].rw && copy_write_all(outs[i].fd, st->buf, (size_t)r) < 0)
+                    return -1;
+            }
+            st->by_method[COPY_RW] += (uint64_t)r;
+            left -= (size_t)r;
+        }
+    }
+    return (ssize_t)n;
+}
+
+// The plain loop, for a stdin that is not a pipe.
+static ssize_t tee_rw_round(TeeOut *outs, int nouts, CopyStats *st, int *bad) {
+    *bad = -1;
+    ssize_t n = read(STDIN_FILENO, st->buf, COPY_BUF);
+    if (n <= 0) return n;
+    for (int i = 0; i < nouts; i++) {
+        *bad = i;
+        if (outs[i].fd >= 0 && copy_write_all(outs[i].fd, st->buf, (size_t)n) < 0)
+            return -1;
+    }
+    st->by_method[COPY_RW] += (uint64_t)n;
+    return n;
+}
+
+int tee_commands(char **args) {
+    int stats = 0, append = 0, i = 1;
+    for (; args[i] && args[i][0] == '-' && args[i][1]; i++) {
+        if (strcmp(args[i], "--") == 0) {
+            i++;
+            break;
+        }
+        if (strcmp(args[i], "-a") == 0) append = 1;
+        else if (strcmp(args[i], "--stats") == 0) stats = 1;
+        else return copy_external(args);
+    }
+    int nfiles = 0;
+    while (args[i + nfiles]) nfiles++;
+
+    CopyStats st = {0};
+    if (posix_memalign((void **)&st.buf, 4096, COPY_BUF) != 0) {
+        perror("tee");
+        return 1;
+    }
+    int status = 0, nouts = 0;
+    TeeOut outs[nfiles + 1];
+    outs[nouts++] = (TeeOut){STDOUT_FILENO, "standard output", 0, 0};
+    for (int k = 0; k < nfiles; k++) {
+        const char *name = args[i + k];
+        int fd = open(name, O_WRONLY | O_CREAT | O_CLOEXEC | (append ? O_APPEND : O_TRUNC), 0666);
+        if (fd < 0) {
+            fprintf(stderr, "tee: %s: %s\n", name, strerror(errno));
+            status = 1;
+            continue;
+        }
+        outs[nouts++] = (TeeOut){fd, name, 0, 0};
+    }
+
+    // who can take spliced data, and whether stdin allows tee(2) at all
+    struct stat s;
+    int spliced = 0, consumer = -1;
+    int in_pipe = fstat(STDIN_FILENO, &s) == 0 && S_ISFIFO(s.st_mode);
+    for (int k = 0; k < nouts; k++) {
+        int flags = fcntl(outs[k].fd, F_GETFL);
+        outs[k].pipe = fstat(outs[k].fd, &s) == 0 && S_ISFIFO(s.st_mode);
+        outs[k].rw = !(outs[k].pipe || S_ISREG(s.st_mode)) || (flags >= 0 && (flags & O_APPEND));
+        if (!outs[k].rw) {
+            spliced++;
+            consumer = k;
+        }
+    }
+    for (int k = 0; k < nouts; k++)
+        if (outs[k].rw) consumer = -1;
+
+    int priv[2] = {-1, -1};
+    if (in_pipe && spliced > 0 && spliced > (consumer >= 0)) {
+        // more than one spliced output: they need the private pipe
+        int size = fcntl(STDIN_FILENO, F_GETPIPE_SZ);
+        if (pipe2(priv, O_CLOEXEC) < 0 || size < 0 || fcntl(priv[1], F_SETPIPE_SZ, size) < size) {
+            if (priv[0] >= 0) {
+                close(priv[0]);
+                close(priv[1]);
+            }
+            in_pipe = 0;
+        }
+    }
+
+    struct timespec start;
+    copy_begin(&start);
+    for (;;) {
+        int bad = -1;
+        ssize_t n = in_pipe && spliced > 0 ? tee_round(outs, nouts, priv, consumer, &st, &bad)
+                                           : tee_rw_round(outs, nouts, &st, &bad);
+        if (n == 0) break;
+        if (n > 0) {
+            st.bytes += (uint64_t)n;
+            continue;
+        }
+        if (errno == EINTR) {
+            status = 130;
+        } else {
+            if (errno != EPIPE)
+                fprintf(stderr, "tee: %s: %s\n", bad >= 0 ? outs[bad].name : "standard input",
+                        strerror(errno));
+            status = 1;
+        }
+        break;
+    }
+    copy_end();
+    if (stats) copy_report("tee", &st, start, 1);
+
+    for (int k = 1; k < nouts; k++)
+        close(outs[k].fd);
+    if (priv[0] >= 0) {
+        close(priv[0]);
+        close(priv[1]);
+    }
+    free(st.buf);
+    return status;
+}
+
+// --- cp ---
+//
+// cp -r copies trees on the work-stealing pool, the way rmdir removes them:
+// every directory is a task, everything is opened relative to the parent's
+// directory fds, and a directory keeps its fds open until the last entry
+// inside it is done, then takes on its source's permissions (it is created
+// 0700 so that the copy can be filled even from a read-only source). Small
+// files are copied by the task that finds them; files of CP_SPLIT bytes or
+// more become tasks of their own, so one large file does not hold up a
+// whole directory. Symlinks are copied as symlinks.
+
+#define CP_SPLIT ((off_t)8 << 20)
+
+typedef struct CpDir {
+    struct CpDir *parent;
+    int src_fd, dst_fd;     // open until every entry inside is done
+    atomic_size_t pending;  // 1 for our own scan + one per queued entry
+    mode_t mode;
+    const char *dst_name;   // points into names
+    char names[];           // source name, then destination name
+} CpDir;
+
+typedef struct {
+    CpDir *dir;
+    mode_t mode;
+    char name[];
+} CpFile;
+
+static ThreadPool *cp_pool;
+static CopyStats *cp_stats;
+
+static CpDir *cp_node(CpDir *parent, const char *src, const char *dst) {
+    size_t slen = strlen(src) + 1, dlen = strlen(dst) + 1;
+    CpDir *d = malloc(sizeof(CpDir) + slen + dlen);
+    if (!d) {
+        perror("malloc failed");
+        exit(1);
+    }
+    d->parent = parent;
+    d->src_fd = d->dst_fd = -1;
+    d->mode = 0700;
+    atomic_init(&d->pending, 1);
+    memcpy(d->names, src, slen);
+    memcpy(d->names + slen, dst, dlen);
+    d->dst_name = d->names + slen;
+    return d;
+}
+
+// Reports name inside d's source (d may be NULL for a top-level name).
+static void cp_error(const CpDir *d, const char *name, int worker) {
+    int err = errno;
+    const char *dirs[64];
+    int n = 0;
+    for (const CpDir *p = d; p && n < 64; p = p->parent)
+        dirs[n++] = p->names;
+    fprintf(stderr, "cp: ");
+    while (n > 0)
+        fprintf(stderr, "%s/", dirs[--n]);
+    fprintf(stderr, "%s: %s\n", name, strerror(err));
+    cp_stats[worker].errors++;
+}
+
+// Copies one regular file, reflinking it if the filesystem can. Errors are
+// reported as inside d.
+static void cp_file(const CpDir *d, int sdir, const char *sname, int ddir, const char *dname,
+                    mode_t mode, int worker) {
+    CopyStats *st = &cp_stats[worker];
+    int in = openat(sdir, sname, O_RDONLY | O_CLOEXEC);
+    struct stat si, sd;
+    if (in < 0 || fstat(in, &si) < 0) {
+        cp_error(d, sname, worker);
+        if (in >= 0) close(in);
+        return;
+    }
+    if (fstatat(ddir, dname, &sd, 0) == 0 && si.st_dev == sd.st_dev && si.st_ino == sd.st_ino) {
+        fprintf(stderr, "cp: '%s' and '%s' are the same file\n", sname, dname);
+        st->errors++;
+        close(in);
+        return;
+    }
+    int out = openat(ddir, dname, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, mode & 0777);
+    if (out < 0) {
+        cp_error(d, dname, worker);
+        close(in);
+        return;
+    }
+    int r = 0;
+    if (si.st_size > 0 && ioctl(out, FICLONE, in) == 0) {
+        st->bytes += (uint64_t)si.st_size;
+        st->by_method[COPY_CLONE] += (uint64_t)si.st_size;
+    } else {
+        r = copy_fd(in, out, st);
+    }
+    if (close(out) < 0)
+        r = -1;
+    if (r < 0 && !sigint_flag)
+        cp_error(d, sname, worker);
+    else if (r == 0)
+        st->files++;
+    close(in);
+}
+
+static void cp_release(CpDir *d, int worker) {
+    while (d && atomic_fetch_sub(&d->pending, 1) == 1) {
+        CpDir *parent = d->parent;
+        if (d->dst_fd >= 0) {
+            fchmod(d->dst_fd, d->mode & 0777);
+            close(d->dst_fd);
+            cp_stats[worker].dirs++;
+        }
+        if (d->src_fd >= 0)
+            close(d->src_fd);
+        free(d);
+        d = parent;
+    }
+}
+
+static void cp_file_task(void *arg, int worker) {
+    CpFile *f = arg;
+    cp_file(f->dir, f->dir->src_fd, f->name, f->dir->dst_fd, f->name, f->mode, worker);
+    cp_release(f->dir, worker);
+    free(f);
+}
+
+static void cp_dir_task(void *arg, int worker) {
+    CpDir *d = arg;
+    int psrc = d->parent ? d->parent->src_fd : AT_FDCWD;
+    int pdst = d->parent ? d->parent->dst_fd : AT_FDCWD;
+    struct stat st;
+    d->src_fd = openat(psrc, d->names, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (d->src_fd < 0 || fstat(d->src_fd, &st) < 0) {
+        cp_error(d->parent, d->names, worker);
+        cp_release(d, worker);
+        return;
+    }
+    d->mode = st.st_mode;
+    if (mkdirat(pdst, d->dst_name, 0700) < 0 && errno != EEXIST) {
+        cp_error(d->parent, d->names, worker);
+        cp_release(d, worker);
+        return;
+    }
+    d->dst_fd = openat(pdst, d->dst_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    int dfd = dup(d->src_fd);
+    DIR *dir = dfd >= 0 ? fdopendir(dfd) : NULL;
+    if (d->dst_fd < 0 || !dir) {
+        cp_error(d->parent, d->names, worker);
+        if (dfd >= 0) close(dfd);
+        cp_release(d, worker);
+        return;
+    }
+
+    struct dirent *entry;
+    while (!sigint_flag && (entry = readdir(dir)) != NULL) {
+        const char *name = entry->d_name;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+            continue;
+        if (fstatat(d->src_fd, name, &st, AT_SYMLINK_NOFOLLOW) < 0) {
+            cp_error(d, name, worker);
+            continue;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            atomic_fetch_add(&d->pending, 1);
+            pool_submit(cp_pool, worker, cp_dir_task, cp_node(d, name, name));
+        } else if (S_ISREG(st.st_mode) && st.st_size >= CP_SPLIT) {
+            size_t len = strlen(name) + 1;
+            CpFile *f = malloc(sizeof(CpFile) + len);
+            if (!f) {
+                perror("malloc failed");
+                exit(1);
+            }
+            f->dir = d;
+            f->mode = st.st_mode;
+            memcpy(f->name, name, len);
+            atomic_fetch_add(&d->pending, 1);
+            pool_submit(cp_pool, worker, cp_file_task, f);
+        } else if (S_ISREG(st.st_mode)) {
+            cp_file(d, d->src_fd, name, d->dst_fd, name, st.st_mode, worker);
+        } else if (S_ISLNK(st.st_mode)) {
+            char target[PATH_MAX];
+            ssize_t n = readlinkat(d->src_fd, name, target, sizeof(target) - 1);
+            if (n >= 0) target[n] = '\0';
+            if (n < 0 || symlinkat(target, d->dst_fd, name) < 0)
+                cp_error(d, name, worker);
+            else
+                cp_stats[worker].files++;
+        } else {
+            errno = ENOTSUP;
+            cp_error(d, name, worker);
+        }
+    }
+    closedir(dir);
+    cp_release(d, worker);
+}
+
+// Whether dst, which need not exist yet, is the directory src or lies
+// inside it; copying there would keep finding its own output.
+static int cp_into_itself(const char *src, const char *dst) {
+    char *s = realpath(src, NULL);
+    char *d = realpath(dst, NULL);
+    if (s && !d) {
+        // dst is about to be created: its parent decides
+        char parent[PATH_MAX];
+        size_t len = strlen(dst);
+        while (len > 1 && dst[len - 1] == '/') len--;
+        while (len > 0 && dst[len - 1] != '/') len--;
+        while (len > 1 && dst[len - 1] == '/') len--;
+        if (len >= sizeof(parent)) len = 0;
+        memcpy(parent, len ? dst : ".", len ? len : 1);
+        parent[len ? len : 1] = '\0';
+        d = realpath(parent, NULL);
+    }
+    int inside = 0;
+    if (s && d) {
+        size_t n = strlen(s);
+        inside = strncmp(s, d, n) == 0 && (d[n] == '\0' || d[n] == '/' || n == 1);
+    }
+    free(s);
+    free(d);
+    return inside;
+}
+
+static int cp_usage(void) {
+    fprintf(stderr, "usage: cp [-r] [-j N] [--stats] src... dest\n");
+    return 2;
+}
+
+// cp [-r] [-j N] [--stats] src... dest
+int cp_commands(char **args) {
+    int recursive = 0, stats = 0, jobs = pool_default_workers();
+    int i = 1;
+    for (; args[i] && args[i][0] == '-' && args[i][1]; i++) {
+        const char *n = NULL;
+        if (strcmp(args[i], "--") == 0) {
+            i++;
+            break;
+        }
+        if (strcmp(args[i], "-r") == 0 || strcmp(args[i], "-R") == 0) {
+            recursive = 1;
+        } else if (strcmp(args[i], "--stats") == 0) {
+            stats = 1;
+        } else if (strncmp(args[i], "-j", 2) == 0) {
+            n = args[i][2] ? args[i] + 2 : args[++i];
+            if (!n || atoi(n) < 1)
+                return cp_usage();
+            jobs = atoi(n);
+        } else {
+            return copy_external(args);
+        }
+    }
+    int nsrc = 0;
+    while (args[i + nsrc]) nsrc++;
+    if (nsrc < 2)
+        return cp_usage();
+    nsrc--;
+    const char *dest = args[i + nsrc];
+    struct stat sd;
+    int dest_dir = stat(dest, &sd) == 0 && S_ISDIR(sd.st_mode);
+    if (nsrc > 1 && !dest_dir) {
+        fprintf(stderr, "cp: target '%s' is not a directory\n", dest);
+        return 1;
+    }
+
+    // two fds per directory being worked on; lift the soft limit meanwhile
+    struct rlimit saved_nofile, nofile;
+    int have_nofile = getrlimit(RLIMIT_NOFILE, &saved_nofile) == 0;
+    if (have_nofile) {
+        nofile = saved_nofile;
+        nofile.rlim_cur = nofile.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &nofile);
+    }
+
+    cp_pool = pool_create(recursive ? jobs : 1);
+    cp_stats = calloc((size_t)jobs, sizeof(CopyStats));
+    if (!cp_pool || !cp_stats) {
+        perror("cp");
+        pool_destroy(cp_pool);
+        free(cp_stats);
+        return 1;
+    }
+    struct timespec start;
+    copy_begin(&start);
+    for (int k = 0; k < nsrc; k++) {
+        const char *src = args[i + k];
+        char *target = NULL;
+        if (dest_dir) {
+            size_t len = strlen(src);
+            while (len > 1 && src[len - 1] == '/') len--;
+            const char *base = src + len;
+            while (base > src && base[-1] != '/') base--;
+            if (asprintf(&target, "%s/%.*s", dest, (int)(src + len - base), base) < 0) {
+                perror("cp");
+                break;
+            }
+        }
+        struct stat ss;
+        if (stat(src, &ss) < 0) {
+            cp_error(NULL, src, 0);
+        } else if (S_ISDIR(ss.st_mode) && !recursive) {
+            fprintf(stderr, "cp: -r not specified; omitting directory '%s'\n", src);
+            cp_stats[0].errors++;
+        } else if (S_ISDIR(ss.st_mode) && cp_into_itself(src, target ? target : dest)) {
+            fprintf(stderr, "cp: cannot copy a directory into itself: '%s' -> '%s'\n", src,
+                    target ? target : dest);
+            cp_stats[0].errors++;
+        } else if (S_ISDIR(ss.st_mode)) {
+            pool_submit(cp_pool, 0, cp_dir_task, cp_node(NULL, src, target ? target : dest));
+        } else {
+            cp_file(NULL, AT_FDCWD, src, AT_FDCWD, target ? target : dest, ss.st_mode, 0);
+        }
+        free(target);
+    }
+    pool_run(cp_pool);
+    copy_end();
+
+    CopyStats total = {0};
+    for (int w = 0; w < jobs; w++) {
+        total.bytes += cp_stats[w].bytes;
+        total.files += cp_stats[w].files;
+        total.dirs += cp_stats[w].dirs;
+        total.errors += cp_stats[w].errors;
+        for (int m = 0; m < COPY_METHODS; m++)
+            total.by_method[m] += cp_stats[w].by_method[m];
+        free(cp_stats[w].buf);
+    }
+    if (stats)
+        copy_report("cp", &total, start, recursive ? jobs : 1);
+
+    pool_destroy(cp_pool);
+    free(cp_stats);
+    cp_pool = NULL;
+    cp_stats = NULL;
+    if (have_nofile)
+        setrlimit(RLIMIT_NOFILE, &saved_nofile);
+    if (sigint_flag)
+        return 130;
+    return total.errors ? 1 : 0;
+}
+
+#endif
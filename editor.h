@@ -0,0 +1,881 @@
+#ifndef EDITOR_H
+#define EDITOR_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include "history.h"
+#include "history_search.h"
+#include "promt.h"
+#include "jobs.h"
+#include "lexer.h"
+#include "complete.h"
+
+// ---------------- Line Editor -----------------
+//
+// Input is read in bursts: one read() per wakeup drains whatever the
+// terminal has queued (a whole paste, a held-down key), every key in the
+// burst is applied to the line, and only then is a frame drawn. A frame is
+// built in memory and sent with a single write(); it rewrites the screen
+// only from the first byte that differs from what is already shown.
+//
+// Bracketed paste is enabled while a line is being read, so pasted text is
+// inserted as is, newlines included, without running anything.
+
+enum {
+    KEY_NONE = -1,
+    KEY_ESC = 1000,
+    KEY_UP,
+    KEY_DOWN,
+    KEY_RIGHT,
+    KEY_LEFT,
+    KEY_HOME,
+    KEY_END,
+    KEY_DELETE,
+    KEY_WORD_LEFT,
+    KEY_WORD_RIGHT,
+    KEY_PASTE_START,
+    KEY_PASTE_END,
+};
+
+#define CTRL_KEY(c) ((c) & 0x1f)
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} EditBuf;
+
+static void editbuf_reserve(EditBuf *b, size_t extra) {
+    if (b->len + extra <= b->cap)
+        return;
+    size_t cap = b->cap ? b->cap : 256;
+    while (cap < b->len + extra) cap *= 2;
+    char *p = realloc(b->data, cap);
+    if (!p) {
+        perror("realloc failed");
+        exit(1);
+    }
+    b->data = p;
+    b->cap = cap;
+}
+
+static void editbuf_append(EditBuf *b, const char *s, size_t len) {
+    editbuf_reserve(b, len);
+    memcpy(b->data + b->len, s, len);
+    b->len += len;
+}
+
+static void editbuf_printf(EditBuf *b, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+static void editbuf_printf(EditBuf *b, const char *fmt, ...) {
+    char tmp[64];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(tmp, sizeof(tmp), fmt, ap);
+    va_end(ap);
+    if (n > 0) editbuf_append(b, tmp, (size_t)n < sizeof(tmp) ? (size_t)n : sizeof(tmp) - 1);
+}
+
+// --- input ---
+
+static unsigned char input_buf[8192];
+static size_t input_start = 0, input_len = 0;
+static int in_paste = 0;
+
+static int editor_fill(void) {
+    if (input_start > 0) {
+        memmove(input_buf, input_buf + input_start, input_len);
+        input_start = 0;
+    }
+    if (input_len == sizeof(input_buf))
+        return 1;
+    ssize_t n;
+    do {
+        jobs_wait_input();
+        n = read(STDIN_FILENO, input_buf + input_len, sizeof(input_buf) - input_len);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0)
+        return 0;
+    input_len += (size_t)n;
+    return 1;
+}
+
+static int input_ready(int timeout_ms) {
+    struct pollfd p = { STDIN_FILENO, POLLIN, 0 };
+    return poll(&p, 1, timeout_ms) > 0;
+}
+
+// Decodes the next key from the queued input. Returns KEY_NONE when the
+// queue is empty or holds only the start of an escape sequence.
+static int editor_next_key(void) {
+    if (input_len == 0)
+        return KEY_NONE;
+    unsigned char *p = input_buf + input_start;
+    size_t n = input_len;
+
+    if (p[0] != 27) {
+        input_start++;
+        input_len--;
+        return p[0];
+    }
+    if (n < 2)
+        return KEY_NONE;
+
+    size_t used = 2;
+    int key = KEY_ESC;
+    if (p[1] == '[') {
+        // CSI: parameters, then a final byte in 0x40..0x7e
+        size_t i = 2;
+        while (i < n && (p[i] < 0x40 || p[i] > 0x7e)) i++;
+        if (i == n)
+            return KEY_NONE;
+        used = i + 1;
+        char params[16] = "";
+        size_t plen = i - 2 < sizeof(params) - 1 ? i - 2 : sizeof(params) - 1;
+        memcpy(params, p + 2, plen);
+        params[plen] = '\0';
+
+        switch (p[i]) {
+        case 'A': key = KEY_UP; break;
+        case 'B': key = KEY_DOWN; break;
+        case 'C': key = strcmp(params, "1;5") == 0 || strcmp(params, "1;3") == 0 ? KEY_WORD_RIGHT : KEY_RIGHT; break;
+        case 'D': key = strcmp(params, "1;5") == 0 || strcmp(params, "1;3") == 0 ? KEY_WORD_LEFT : KEY_LEFT; break;
+        case 'H': key = KEY_HOME; break;
+        case 'F': key = KEY_END; break;
+        case '~':
+            if (strcmp(params, "1") == 0 || strcmp(params, "7") == 0) key = KEY_HOME;
+            else if (strcmp(params, "4") == 0 || strcmp(params, "8") == 0) key = KEY_END;
+            else if (strcmp(params, "3") == 0) key = KEY_DELETE;
+            else if (strcmp(params, "200") == 0) key = KEY_PASTE_START;
+            else if (strcmp(params, "201") == 0) key = KEY_PASTE_END;
+            else key = KEY_NONE;
+            break;
+        default: key = KEY_NONE; break;
+        }
+    } else if (p[1] == 'O') {
+        if (n < 3)
+            return KEY_NONE;
+        used = 3;
+        switch (p[2]) {
+        case 'H': key = KEY_HOME; break;
+        case 'F': key = KEY_END; break;
+        case 'A': key = KEY_UP; break;
+        case 'B': key = KEY_DOWN; break;
+        case 'C': key = KEY_RIGHT; break;
+        case 'D': key = KEY_LEFT; break;
+        default: key = KEY_NONE; break;
+        }
+    } else if (p[1] == 'b') {
+        key = KEY_WORD_LEFT;
+    } else if (p[1] == 'f') {
+        key = KEY_WORD_RIGHT;
+    } else {
+        used = 1;      // a lone ESC followed by an ordinary key
+    }
+
+    input_start += used;
+    input_len -= used;
+    return key == KEY_NONE ? editor_next_key() : key;
+}
+
+// --- output ---
+
+static EditBuf frame;            // bytes of the frame being built
+
+static void editor_flush(void) {
+    size_t off = 0;
+    while (off < frame.len) {
+        ssize_t n = write(STDOUT_FILENO, frame.data + off, frame.len - off);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        off += (size_t)n;
+    }
+    frame.len = 0;
+}
+
+static volatile sig_atomic_t winch_flag = 0;
+
+static void sigwinch_handler(int sig) {
+    (void)sig;
+    winch_flag = 1;
+}
+
+static int terminal_columns(void) {
+    struct winsize ws;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0)
+        return ws.ws_col;
+    return 80;
+}
+
+// What the screen currently shows for this line: the prefix (prompt or
+// search label) followed by the line, and the cursor's column counted from
+// the start of the prefix. Wrapped rows continue the count.
+static struct {
+    EditBuf text;
+    size_t prefix_len;
+    size_t cursor;
+    size_t end;
+    int cols;
+} screen;
+
+// Display width of text[from..to): escape sequences in the prefix take no
+// room, control characters in the line are shown as ^X, and UTF-8
+// continuation bytes add nothing.
+static size_t display_width(const char *text, size_t prefix_len, size_t from, size_t to) {
+    size_t w = 0;
+    for (size_t i = from; i < to; i++) {
+        unsigned char c = (unsigned char)text[i];
+        if (i < prefix_len) {
+            if (c == 27) {
+                // skip CSI up to its final byte
+                if (i + 1 < to && text[i + 1] == '[') {
+                    i += 2;
+                    while (i < to && ((unsigned char)text[i] < 0x40 || (unsigned char)text[i] > 0x7e)) i++;
+                }
+                continue;
+            }
+            if ((c & 0xc0) == 0x80 || c < 32) continue;
+            w++;
+        } else if (c < 32 || c == 127) {
+            w += 2;
+        } else if ((c & 0xc0) != 0x80) {
+            w++;
+        }
+    }
+    return w;
+}
+
+static void move_cursor(size_t from, size_t to) {
+    int cols = screen.cols;
+    size_t r1 = from / cols, c1 = from % cols;
+    size_t r2 = to / cols, c2 = to % cols;
+    if (r2 < r1) editbuf_printf(&frame, "\x1b[%zuA", r1 - r2);
+    else if (r2 > r1) editbuf_printf(&frame, "\x1b[%zuB", r2 - r1);
+    if (c2 != c1) {
+        editbuf_append(&frame, "\r", 1);
+        if (c2 > 0) editbuf_printf(&frame, "\x1b[%zuC", c2);
+    }
+}
+
+static void write_line_bytes(const char *s, size_t len) {
+    size_t run = 0;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)s[i];
+        if (c < 32 || c == 127) {
+            editbuf_append(&frame, s + run, i - run);
+            char caret[2] = { '^', c == 127 ? '?' : (char)(c + '@') };
+            editbuf_append(&frame, caret, 2);
+            run = i + 1;
+        }
+    }
+    editbuf_append(&frame, s + run, len - run);
+}
+
+// --- line buffer ---
+//
+// The line lives in a gap buffer: the text before the cursor sits at the
+// start of data, the text after it at the end, with free space (the gap)
+// in between. Typing and deleting at the cursor are O(1), and moving the
+// cursor only shifts the bytes it passes over. `dirty` remembers the
+// lowest offset changed since the last frame so the renderer starts there.
+
+typedef struct {
+    char *data;
+    size_t cap;
+    size_t gap_start;    // == cursor
+    size_t gap_end;
+    size_t dirty;        // SIZE_MAX when nothing changed
+} GapBuffer;
+
+static inline size_t gb_len(const GapBuffer *gb) {
+    return gb->cap - (gb->gap_end - gb->gap_start);
+}
+
+static inline char gb_at(const GapBuffer *gb, size_t i) {
+    return i < gb->gap_start ? gb->data[i] : gb->data[i + (gb->gap_end - gb->gap_start)];
+}
+
+static inline void gb_touch(GapBuffer *gb, size_t from) {
+    if (from < gb->dirty) gb->dirty = from;
+}
+
+static void gb_grow(GapBuffer *gb, size_t need) {
+    if (gb->gap_end - gb->gap_start >= need)
+        return;
+    size_t len = gb_len(gb);
+    size_t cap = gb->cap ? gb->cap : 256;
+    while (cap - len < need) cap *= 2;
+    char *p = realloc(gb->data, cap);
+    if (!p) {
+        perror("realloc failed");
+        exit(1);
+    }
+    size_t after = gb->cap - gb->gap_end;
+    memmove(p + cap - after, p + gb->gap_end, after);
+    gb->data = p;
+    gb->gap_end = cap - after;
+    gb->cap = cap;
+}
+
+static void gb_move_to(GapBuffer *gb, size_t pos) {
+    size_t gap = gb->gap_end - gb->gap_start;
+    if (pos < gb->gap_start) {
+        size_t n = gb->gap_start - pos;
+        memmove(gb->data + gb->gap_end - n, gb->data + pos, n);
+    } else if (pos > gb->gap_start) {
+        size_t n = pos - gb->gap_start;
+        memmove(gb->data + gb->gap_start, gb->data + gb->gap_end, n);
+    }
+    gb->gap_start = pos;
+    gb->gap_end = pos + gap;
+}
+
+static void gb_insert(GapBuffer *gb, const char *s, size_t n) {
+    gb_grow(gb, n);
+    memcpy(gb->data + gb->gap_start, s, n);
+    gb_touch(gb, gb->gap_start);
+    gb->gap_start += n;
+}
+
+static void gb_delete_before(GapBuffer *gb, size_t n) {
+    if (n > gb->gap_start) n = gb->gap_start;
+    gb->gap_start -= n;
+    gb_touch(gb, gb->gap_start);
+}
+
+static void gb_delete_after(GapBuffer *gb, size_t n) {
+    size_t after = gb->cap - gb->gap_end;
+    if (n > after) n = after;
+    gb->gap_end += n;
+    gb_touch(gb, gb->gap_start);
+}
+
+static void gb_clear(GapBuffer *gb) {
+    gb->gap_start = 0;
+    gb->gap_end = gb->cap;
+    gb_touch(gb, 0);
+}
+
+// Copies bytes [from, to) of the line into dest.
+static void gb_copy(const GapBuffer *gb, size_t from, size_t to, char *dest) {
+    if (from < gb->gap_start) {
+        size_t n = (to < gb->gap_start ? to : gb->gap_start) - from;
+        memcpy(dest, gb->data + from, n);
+        dest += n;
+        from += n;
+    }
+    if (from < to)
+        memcpy(dest, gb->data + from + (gb->gap_end - gb->gap_start), to - from);
+}
+
+static void gb_set(GapBuffer *gb, const char *s, size_t n) {
+    gb_clear(gb);
+    gb_insert(gb, s, n);
+}
+
+// Brings the screen up to date with prefix + line and the cursor at the
+// gap. Only the part from the first changed byte on is redrawn.
+static void editor_render(const char *prefix, size_t prefix_len, GapBuffer *gb) {
+    if (winch_flag) {
+        winch_flag = 0;
+        screen.cols = terminal_columns();
+        // the old layout is unknown now; redraw from the first row we know
+        move_cursor(screen.cursor, 0);
+        editbuf_append(&frame, "\r\x1b[J", 4);
+        screen.text.len = 0;
+        screen.prefix_len = 0;
+        screen.cursor = screen.end = 0;
+    }
+
+    size_t len = gb_len(gb);
+    size_t total = prefix_len + len;
+    size_t d = 0;
+    if (screen.prefix_len == prefix_len && screen.text.len >= prefix_len &&
+        memcmp(screen.text.data, prefix, prefix_len) == 0) {
+        d = screen.text.len;
+        if (gb->dirty != SIZE_MAX && prefix_len + gb->dirty < d)
+            d = prefix_len + gb->dirty;
+        if (d > total)
+            d = total;
+        // never start in the middle of a UTF-8 character
+        while (d > prefix_len && (gb_at(gb, d - prefix_len) & 0xc0) == 0x80)
+            d--;
+    }
+    gb->dirty = SIZE_MAX;
+
+    // the screen copy is kept up to date from d on
+    screen.text.len = d;
+    if (d < prefix_len)
+        editbuf_append(&screen.text, prefix + d, prefix_len - d);
+    size_t from = d > prefix_len ? d - prefix_len : 0;
+    editbuf_reserve(&screen.text, len - from);
+    gb_copy(gb, from, len, screen.text.data + screen.text.len);
+    screen.text.len += len - from;
+    const char *text = screen.text.data;
+
+    size_t col_d = display_width(text, prefix_len, 0, d);
+    size_t new_end = col_d + display_width(text, prefix_len, d, total);
+    size_t new_cursor = display_width(text, prefix_len, 0, prefix_len + gb->gap_start);
+
+    if (d < total || new_end < screen.end) {
+        move_cursor(screen.cursor, col_d);
+        if (d < prefix_len) {
+            editbuf_append(&frame, prefix + d, prefix_len - d);
+            write_line_bytes(text + prefix_len, len);
+        } else {
+            write_line_bytes(text + d, total - d);
+        }
+        // a full last row leaves the terminal's cursor waiting to wrap
+        if (new_end > col_d && new_end % screen.cols == 0)
+            editbuf_append(&frame, "\r\n", 2);
+        if (new_end < screen.end)
+            editbuf_append(&frame, "\x1b[J", 3);
+        screen.cursor = new_end;
+    }
+    move_cursor(screen.cursor, new_cursor);
+    screen.cursor = new_cursor;
+    screen.end = new_end;
+    screen.prefix_len = prefix_len;
+}
+
+// --- editing ---
+
+typedef struct {
+    GapBuffer line;
+    int history_index;   // -1 while editing a new line
+    const char *prompt;
+
+    int searching;
+    char query[256];
+    size_t qlen;
+    int fuzzy;
+    int failed;
+    long match;
+    FuzzyResult results[SEARCH_FUZZY_RESULTS];
+    int nresults;
+    int ri;
+    char *saved;         // line before Ctrl-R, restored by Ctrl-G
+    size_t saved_len;
+
+    int tabs;            // Tabs in a row; the second one lists candidates
+} LineState;
+
+static int is_word_char(char c) {
+    unsigned char u = (unsigned char)c;
+    return u >= 0x80 || (u >= '0' && u <= '9') || (u >= 'a' && u <= 'z') ||
+           (u >= 'A' && u <= 'Z') || u == '_';
+}
+
+// Byte offset of the character before / after pos, UTF-8 aware.
+static size_t char_before(const GapBuffer *gb, size_t pos) {
+    if (pos == 0) return 0;
+    pos--;
+    while (pos > 0 && (gb_at(gb, pos) & 0xc0) == 0x80) pos--;
+    return pos;
+}
+
+static size_t char_after(const GapBuffer *gb, size_t pos) {
+    size_t len = gb_len(gb);
+    if (pos >= len) return len;
+    pos++;
+    while (pos < len && (gb_at(gb, pos) & 0xc0) == 0x80) pos++;
+    return pos;
+}
+
+static size_t word_before(const GapBuffer *gb, size_t pos) {
+    while (pos > 0 && !is_word_char(gb_at(gb, pos - 1))) pos--;
+    while (pos > 0 && is_word_char(gb_at(gb, pos - 1))) pos--;
+    return pos;
+}
+
+static size_t word_after(const GapBuffer *gb, size_t pos) {
+    size_t len = gb_len(gb);
+    while (pos < len && !is_word_char(gb_at(gb, pos))) pos++;
+    while (pos < len && is_word_char(gb_at(gb, pos))) pos++;
+    return pos;
+}
+
+static void history_step(LineState *ls, int up) {
+    int total = count_commands();
+    if (total == 0) return;
+    if (up) {
+        if (ls->history_index == -1)
+            ls->history_index = total - 1;
+        else if (ls->history_index > 0)
+            ls->history_index--;
+    } else {
+        if (ls->history_index == -1)
+            return;
+        if (ls->history_index >= total - 1) {
+            ls->history_index = -1;
+            gb_clear(&ls->line);
+            return;
+        }
+        ls->history_index++;
+    }
+    HistoryEntry e = last_command(ls->history_index);
+    if (e.command)
+        gb_set(&ls->line, e.command, e.len);
+}
+
+// Ctrl-R: incremental reverse search over the history. Typing refines the
+// query, Ctrl-R steps to the next older (or next best ranked) match, Ctrl-T
+// toggles fuzzy ranking and Ctrl-G restores the original line. Enter runs
+// the match; any other key leaves it on the line and is then handled as
+// usual.
+static void search_start(LineState *ls) {
+    ls->searching = 1;
+    ls->qlen = 0;
+    ls->fuzzy = ls->failed = 0;
+    ls->match = -1;
+    ls->nresults = ls->ri = 0;
+    free(ls->saved);
+    ls->saved_len = gb_len(&ls->line);
+    ls->saved = malloc(ls->saved_len + 1);
+    if (ls->saved) gb_copy(&ls->line, 0, ls->saved_len, ls->saved);
+}
+
+static void search_update(LineState *ls, int research, int next) {
+    HistoryEntry e = {NULL, 0, -1};
+    if (ls->fuzzy) {
+        if (research) {
+            ls->nresults = history_search_fuzzy(ls->query, ls->qlen, ls->results, SEARCH_FUZZY_RESULTS);
+            ls->ri = 0;
+        } else if (next && ls->ri + 1 < ls->nresults) {
+            ls->ri++;
+        }
+        ls->match = ls->nresults > 0 ? (long)ls->results[ls->ri].seq : -1;
+        ls->failed = ls->nresults == 0 && ls->qlen > 0;
+    } else {
+        size_t before = history_seq_end();
+        const char *skip = NULL;
+        size_t skip_len = 0;
+        if (next && ls->match >= 0 && history_by_seq((size_t)ls->match, &e)) {
+            before = (size_t)ls->match;
+            skip = e.command;
+            skip_len = e.len;
+        }
+        long found = history_search_substring(ls->query, ls->qlen, before, skip, skip_len);
+        ls->failed = found < 0 && ls->qlen > 0;
+        if (found >= 0 || research)
+            ls->match = found;
+    }
+
+    if (ls->match >= 0 && history_by_seq((size_t)ls->match, &e))
+        gb_set(&ls->line, e.command, e.len);
+    else
+        gb_clear(&ls->line);
+}
+
+// Returns 1 if the key was consumed by the search, 0 if search ended and
+// the key should be handled by the editor.
+static int search_key(LineState *ls, int key) {
+    if (key == CTRL_KEY('r')) {
+        search_update(ls, 0, 1);
+    } else if (key == CTRL_KEY('t')) {
+        ls->fuzzy = !ls->fuzzy;
+        search_update(ls, 1, 0);
+    } else if (key == 127 || key == CTRL_KEY('h')) {
+        if (ls->qlen > 0) ls->qlen--;
+        search_update(ls, 1, 0);
+    } else if (key == CTRL_KEY('g')) {
+        if (ls->saved) gb_set(&ls->line, ls->saved, ls->saved_len);
+        ls->searching = 0;
+    } else if (key >= 32 && key < 256) {
+        if (ls->qlen < sizeof(ls->query)) ls->query[ls->qlen++] = (char)key;
+        search_update(ls, 1, 0);
+    } else {
+        ls->searching = 0;
+        return key == KEY_ESC;   // ESC only leaves the search
+    }
+    return 1;
+}
+
+// --- completion ---
+
+static int is_word_break(char c) {
+    return c && strchr(" \t\n|&;<>()", c) != NULL;
+}
+
+// Inserts s with the characters the lexer would treat specially escaped.
+static void insert_escaped(GapBuffer *gb, const char *s) {
+    for (; *s; s++) {
+        if (strchr(" \t\\'\"$&|;<>()*?`!#", *s))
+            gb_insert(gb, "\\", 1);
+        gb_insert(gb, s, 1);
+    }
+}
+
+// Prints the candidates in columns below the line; the prompt and line are
+// drawn again under them.
+static void editor_list(const CompResult *r) {
+    move_cursor(screen.cursor, screen.end);
+    editbuf_append(&frame, "\r\n", 2);
+    size_t width = 0;
+    for (size_t i = 0; i < r->nitems; i++)
+        if (strlen(r->items[i]) > width) width = strlen(r->items[i]);
+    width += 2;
+    size_t cols = (size_t)screen.cols / width;
+    if (cols == 0) cols = 1;
+    size_t rows = (r->nitems + cols - 1) / cols;
+    for (size_t row = 0; row < rows; row++) {
+        for (size_t col = 0; col < cols; col++) {
+            size_t i = col * rows + row;
+            if (i >= r->nitems) break;
+            size_t len = strlen(r->items[i]);
+            editbuf_append(&frame, r->items[i], len);
+            if (col + 1 < cols && i + rows < r->nitems)
+                for (; len < width; len++) editbuf_append(&frame, " ", 1);
+        }
+        editbuf_append(&frame, "\r\n", 2);
+    }
+    if (r->count > r->nitems)
+        editbuf_printf(&frame, "... and %zu more\r\n", r->count - r->nitems);
+    screen.text.len = 0;
+    screen.prefix_len = 0;
+    screen.cursor = screen.end = 0;
+}
+
+// Tab: extends the word before the cursor as far as its candidates agree.
+// When that adds nothing, a second Tab lists them.
+static void editor_complete(LineState *ls) {
+    GapBuffer *gb = &ls->line;
+    size_t cur = gb->gap_start;
+    size_t start = cur;
+    while (start > 0 && !(is_word_break(gb_at(gb, start - 1)) &&
+                          !(start >= 2 && gb_at(gb, start - 2) == '\\')))
+        start--;
+    size_t before = start;
+    while (before > 0 && (gb_at(gb, before - 1) == ' ' || gb_at(gb, before - 1) == '\t'))
+        before--;
+    int command = before == 0 || strchr("|&;(\n", gb_at(gb, before - 1));
+
+    // the word as the lexer will see it: no quotes, no escapes
+    char word[PATH_MAX];
+    size_t wlen = 0;
+    for (size_t i = start; i < cur && wlen < sizeof(word) - 1; i++) {
+        char c = gb_at(gb, i);
+        if (c == '\\' && i + 1 < cur)
+            c = gb_at(gb, ++i);
+        else if (c == '\'' || c == '"')
+            continue;
+        word[wlen++] = c;
+    }
+    word[wlen] = '\0';
+    const char *slash = strrchr(word, '/');
+    size_t blen = strlen(slash ? slash + 1 : word);
+
+    CompResult r = {0};
+    int list = ls->tabs > 1;
+    if (command && !slash)
+        complete_command(word, list, &r);
+    else
+        complete_file(word, list, &r);
+
+    size_t added = r.common && strlen(r.common) > blen ? strlen(r.common) - blen : 0;
+    if (added)
+        insert_escaped(gb, r.common + blen);
+    if (r.count == 1) {
+        gb_insert(gb, r.is_dir ? "/" : " ", 1);
+        ls->tabs = 0;
+    } else if (r.count == 0 || (!added && !list)) {
+        editbuf_append(&frame, "\a", 1);
+    } else if (!added) {
+        editor_list(&r);
+    }
+    comp_result_free(&r);
+}
+
+static void editor_draw(LineState *ls) {
+    if (ls->searching) {
+        char label[sizeof(ls->query) + 48];
+        int n = snprintf(label, sizeof(label), "(%s%s)`%.*s': ", ls->failed ? "failing " : "",
+                         ls->fuzzy ? "fuzzy-search" : "reverse-i-search", (int)ls->qlen, ls->query);
+        if (n >= (int)sizeof(label)) n = sizeof(label) - 1;
+        editor_render(label, (size_t)n, &ls->line);
+    } else {
+        editor_render(ls->prompt, strlen(ls->prompt), &ls->line);
+    }
+}
+
+// Applies one key to the line. Returns 1 when the key ends the line.
+static int editor_key(LineState *ls, int key) {
+    GapBuffer *gb = &ls->line;
+    size_t len = gb_len(gb);
+    size_t cur = gb->gap_start;
+    if (key == '\t')
+        ls->tabs++;
+    else
+        ls->tabs = 0;
+
+    switch (key) {
+    case '\n':
+    case '\r':
+        return 1;
+    case '\t':
+        editor_complete(ls);
+        break;
+    case KEY_UP:
+    case KEY_DOWN:
+        history_step(ls, key == KEY_UP);
+        return 0;
+    case CTRL_KEY('r'):
+        search_start(ls);
+        search_update(ls, 1, 0);
+        return 0;
+    case KEY_LEFT:
+    case CTRL_KEY('b'):
+        gb_move_to(gb, char_before(gb, cur));
+        return 0;
+    case KEY_RIGHT:
+    case CTRL_KEY('f'):
+        gb_move_to(gb, char_after(gb, cur));
+        return 0;
+    case KEY_HOME:
+    case CTRL_KEY('a'):
+        gb_move_to(gb, 0);
+        return 0;
+    case KEY_END:
+    case CTRL_KEY('e'):
+        gb_move_to(gb, len);
+        return 0;
+    case KEY_WORD_LEFT:
+        gb_move_to(gb, word_before(gb, cur));
+        return 0;
+    case KEY_WORD_RIGHT:
+        gb_move_to(gb, word_after(gb, cur));
+        return 0;
+    case 127:
+    case CTRL_KEY('h'):
+        gb_delete_before(gb, cur - char_before(gb, cur));
+        break;
+    case KEY_DELETE:
+    case CTRL_KEY('d'):
+        gb_delete_after(gb, char_after(gb, cur) - cur);
+        break;
+    case CTRL_KEY('w'):
+        gb_delete_before(gb, cur - word_before(gb, cur));
+        break;
+    case CTRL_KEY('u'):
+        gb_delete_before(gb, cur);
+        break;
+    case CTRL_KEY('k'):
+        gb_delete_after(gb, len - cur);
+        break;
+    default:
+        if (key >= 32 && key < 256) {
+            char c = (char)key;
+            gb_insert(gb, &c, 1);
+            break;
+        }
+        return 0;
+    }
+    ls->history_index = -1;
+    return 0;
+}
+
+// Reads one physical line after prompt into ls->line. Returns 0 at EOF
+// with nothing typed, 1 otherwise.
+static int editor_read_line(LineState *ls) {
+    signal(SIGWINCH, sigwinch_handler);
+    fflush(stdout);
+    screen.cols = terminal_columns();
+    screen.text.len = 0;
+    screen.prefix_len = 0;
+    screen.cursor = screen.end = 0;
+    ls->history_index = -1;
+    ls->tabs = 0;
+    gb_clear(&ls->line);
+
+    editbuf_append(&frame, "\x1b[?2004h", 8);
+    editor_draw(ls);
+
+    int done = 0, eof = 0;
+    while (!done) {
+        editor_flush();
+        if (!editor_fill()) {
+            eof = 1;
+            break;
+        }
+        // a lone ESC at the end of a burst: wait briefly for the rest
+        if (input_len == 1 && input_buf[input_start] == 27 && !input_ready(50)) {
+            input_start++;
+            input_len--;
+            if (ls->searching) search_key(ls, KEY_ESC);
+            editor_draw(ls);
+            continue;
+        }
+
+        int key;
+        while (!done && (key = editor_next_key()) != KEY_NONE) {
+            if (key == KEY_PASTE_START) { in_paste = 1; continue; }
+            if (key == KEY_PASTE_END) { in_paste = 0; continue; }
+            if (in_paste) {
+                if (key < 256) {
+                    char c = key == '\r' ? '\n' : (char)key;
+                    gb_insert(&ls->line, &c, 1);
+                }
+                continue;
+            }
+            if (ls->searching && search_key(ls, key))
+                continue;
+            done = editor_key(ls, key);
+        }
+        editor_draw(ls);
+    }
+
+    ls->searching = 0;
+    editor_draw(ls);
+    move_cursor(screen.cursor, screen.end);
+    editbuf_append(&frame, "\x1b[?2004l\r\n", 10);
+    editor_flush();
+    return !(eof && gb_len(&ls->line) == 0);
+}
+
+static EditBuf command_buf;
+
+// Reads a command, drawing the prompt rendered last by render_prompt and
+// "> " for continuation lines (after a trailing backslash, |, && or ||, or
+// inside an open quote). The result has no length limit and stays
+// valid until the next call; NULL at EOF.
+char *read_command(void) {
+    static LineState ls;
+    command_buf.len = 0;
+    ls.prompt = prompt_buf;
+
+    for (;;) {
+        if (!editor_read_line(&ls)) {
+            if (command_buf.len == 0)
+                return NULL;
+            break;
+        }
+        size_t len = gb_len(&ls.line);
+        editbuf_reserve(&command_buf, len + 1);
+        gb_copy(&ls.line, 0, len, command_buf.data + command_buf.len);
+        command_buf.len += len;
+        int more = lex_needs_more(command_buf.data, command_buf.len);
+        if (!more)
+            break;
+        if (more == 2)
+            command_buf.len--;     // drop the backslash-newline
+        else
+            command_buf.data[command_buf.len++] = '\n';
+        ls.prompt = "> ";
+    }
+
+    free(ls.saved);
+    ls.saved = NULL;
+    editbuf_reserve(&command_buf, 1);
+    command_buf.data[command_buf.len] = '\0';
+    return command_buf.data;
+}
+
+#endif
@@ -0,0 +1,266 @@
+#ifndef EXEC_H
+#define EXEC_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "parser.h"
+#include "expand.h"
+
+// ---------------- Execution -----------------
+//
+// Walks a parse tree. Nothing here changes the tree, which may be cached
+// and run again; builtins were resolved by the parser, so a command is
+// dispatched without comparing its name.
+
+static int errexit = 0;             // set -e: stop at the first failure
+static int exit_requested = 0;      // `exit`, or a failure under set -e
+static int exec_condition = 0;      // running the left side of && / ||
+
+static int exec_node(Node *n, int background);
+
+// Sets NAME=value for the length of one command, keeping the old values in
+// saved for exec_unassign.
+static void exec_assign(const Assign *as, int n, char **saved) {
+    for (int i = 0; i < n; i++) {
+        const char *old = getenv(as[i].name);
+        saved[i] = old ? strdup(old) : NULL;
+        setenv(as[i].name, as[i].value, 1);
+    }
+}
+
+static void exec_unassign(const Assign *as, int n, char **saved) {
+    // backwards, so A=1 A=2 cmd restores the value from before both
+    for (int i = n - 1; i >= 0; i--) {
+        if (saved[i]) {
+            setenv(as[i].name, saved[i], 1);
+            free(saved[i]);
+        } else {
+            unsetenv(as[i].name);
+        }
+    }
+}
+
+// --- builtins ---
+//
+// A builtin runs in the shell even when it is redirected: each redirected
+// fd is first copied out of the way (close-on-exec, above the fds a
+// command would use), the redirection is applied, and the copy is put
+// back once the builtin returns. `pwd > f` costs an open and a few dup2s
+// instead of a fork. In a pipeline outside an interactive terminal, one
+// builtin that cannot change the shell's state also runs in the shell, on
+// its pipe ends (see Pipe_commands); any other builtin stage is forked, as
+// sh would.
+
+typedef struct {
+    int fd;
+    int saved;              // copy of the shell's fd, -1 if it was closed
+} SavedFd;
+
+static void exec_restore_fds(SavedFd *saved, int n) {
+    fflush(stdout);
+    fflush(stderr);
+    for (int i = n - 1; i >= 0; i--) {
+        if (saved[i].saved >= 0) {
+            dup2(saved[i].saved, saved[i].fd);
+            close(saved[i].saved);
+        } else {
+            close(saved[i].fd);
+        }
+    }
+}
+
+// Applies the redirections to the shell's fds, recording in saved[] (room
+// for one per redirection) what to put back. Returns -1 after printing the
+// error if one fails; what was already applied is in saved.
+static int exec_redirect_fds(const Redirect *redirs, SavedFd *saved, int *nsaved) {
+    fflush(stdout);
+    fflush(stderr);
+    for (const Redirect *r = redirs; r; r = r->next) {
+        int seen = 0;
+        for (int i = 0; i < *nsaved; i++)
+            seen |= saved[i].fd == r->fd;
+        if (!seen) {
+            saved[*nsaved].fd = r->fd;
+            saved[*nsaved].saved = fcntl(r->fd, F_DUPFD_CLOEXEC, 10);
+            (*nsaved)++;
+        }
+        if (redirect_apply(r) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+static int exec_builtin(Node *n) {
+    int count = 0;
+    for (const Redirect *r = n->cmd.redirs; r; r = r->next) count++;
+    SavedFd saved[count + 1];
+    int nsaved = 0, status = 1;
+    if (exec_redirect_fds(n->cmd.redirs, saved, &nsaved) == 0)
+        status = n->cmd.builtin->fn(n->cmd.argc, n->cmd.argv);
+    exec_restore_fds(saved, nsaved);
+    set_pipestatus(1);
+    return last_status = pipestatus[0] = status;
+}
+
+static int exec_command(Node *n, int background, const char *cmdline) {
+    int status = 0;
+    if (n->cmd.dynamic) {
+        Expand x = {.status = -1};
+        Node copy;
+        if (expand_command(&x, n, &copy) == 0) {
+            exec_command(&copy, background, cmdline);
+            // x=$(cmd) alone has the status of cmd
+            if (copy.cmd.argc == 0 && last_status == 0 && x.status > 0)
+                last_status = pipestatus[0] = x.status;
+        } else {
+            set_pipestatus(1);
+            last_status = pipestatus[0] = 1;
+        }
+        expand_free(&x);
+        return last_status;
+    }
+    if (n->cmd.argc == 0) {
+        // assignments alone stay set; a redirection alone creates its file
+        for (int i = 0; i < n->cmd.nassigns; i++)
+            setenv(n->cmd.assigns[i].name, n->cmd.assigns[i].value, 1);
+        for (const Redirect *r = n->cmd.redirs; r; r = r->next) {
+            if (r->kind != REDIR_OPEN)
+                continue;
+            int fd = open(r->path, r->flags | O_CLOEXEC, 0644);
+            if (fd < 0) {
+                fprintf(stderr, "myshell: %s: %s\n", r->path, strerror(errno));
+                status = 1;
+                break;
+            }
+            close(fd);
+        }
+        set_pipestatus(1);
+        return last_status = pipestatus[0] = status;
+    }
+
+    if (n->cmd.builtin && background) {
+        // `cat big > f &` must not hold up the prompt: run it in a subshell job
+        PipeStage s = {NULL, NULL, n, 0};
+        return Pipe_commands(&s, 1, 1, cmdline);
+    }
+
+    char *saved[n->cmd.nassigns + 1];
+    exec_assign(n->cmd.assigns, n->cmd.nassigns, saved);
+    if (n->cmd.builtin) {
+        exec_builtin(n);
+    } else if (n->cmd.redirs) {
+        redirect_commands(n->cmd.argv, n->cmd.redirs, background, cmdline);
+    } else {
+        run_job(n->cmd.argv, NULL, background, cmdline);
+    }
+    exec_unassign(n->cmd.assigns, n->cmd.nassigns, saved);
+    return last_status;
+}
+
+// Copies the stages of n into stages with their words expanded. A command
+// that turns out to name a builtin becomes a body stage, like one the
+// parser resolved. Returns -1 if a redirection target expands to nothing.
+static int exec_expand_stages(Expand *x, Node *n, PipeStage *stages) {
+    for (int i = 0; i < n->pipe.n; i++) {
+        Node *c = n->pipe.nodes[i];
+        PipeStage *s = &stages[i];
+        *s = n->pipe.stages[i];
+        int failed = 0;
+        if (c->type == NODE_SUBSHELL) {
+            s->redirs = expand_redirs(x, c->sub.redirs, &failed);
+        } else if (s->argv && c->cmd.dynamic) {
+            Node *e = expand_keep(x, malloc(sizeof(Node)));
+            failed = expand_command(x, c, e) < 0;
+            if (e->cmd.builtin || e->cmd.argc == 0)
+                *s = (PipeStage){NULL, NULL, e, e->cmd.builtin && e->cmd.builtin->pure};
+            else
+                *s = (PipeStage){e->cmd.argv, e->cmd.redirs, NULL, 0};
+        }
+        if (failed)
+            return -1;
+    }
+    return 0;
+}
+
+static int exec_pipeline(Node *n, int background) {
+    Node *first = n->pipe.nodes[0];
+    UsageMark mark;
+    if (n->pipe.timed)
+        usage_begin(&mark);
+    if (n->pipe.n == 1 && first->type == NODE_COMMAND) {
+        exec_command(first, background, n->pipe.cmdline);
+    } else if (n->pipe.dynamic) {
+        Expand x = {0};
+        PipeStage stages[n->pipe.n];
+        if (exec_expand_stages(&x, n, stages) == 0) {
+            Pipe_commands(stages, n->pipe.n, background, n->pipe.cmdline);
+        } else {
+            set_pipestatus(1);
+            last_status = pipestatus[0] = 1;
+        }
+        expand_free(&x);
+    } else {
+        Pipe_commands(n->pipe.stages, n->pipe.n, background, n->pipe.cmdline);
+    }
+    if (n->pipe.timed) {
+        CmdUsage u;
+        usage_end(&mark, &u);
+        fflush(stdout);
+        fputc('\n', stderr);
+        usage_print(stderr, &u);
+        if (n->pipe.n > 1 && !background)
+            pipeusage_print(stderr);
+    }
+    // as in sh, a failed test of && / || does not count
+    if (errexit && last_status != 0 && !exec_condition)
+        exit_requested = 1;
+    return last_status;
+}
+
+static int exec_node(Node *n, int background) {
+    switch (n->type) {
+    case NODE_COMMAND:
+        return exec_command(n, background, "");
+    case NODE_SUBSHELL: {
+        Expand x = {0};
+        int failed = 0;
+        PipeStage s = {NULL, expand_redirs(&x, n->sub.redirs, &failed), n->sub.body, 0};
+        if (failed)
+            last_status = 1;
+        else
+            Pipe_commands(&s, 1, background, "");
+        expand_free(&x);
+        return last_status;
+    }
+    case NODE_PIPELINE:
+        return exec_pipeline(n, background);
+    case NODE_AND:
+    case NODE_OR:
+        exec_condition++;
+        exec_node(n->bin.left, 0);
+        exec_condition--;
+        if (!exit_requested && (last_status == 0) == (n->type == NODE_AND))
+            exec_node(n->bin.right, 0);
+        return last_status;
+    case NODE_LIST:
+        for (int i = 0; i < n->list.n && !exit_requested; i++) {
+            ListItem *item = &n->list.items[i];
+            if (item->background && item->node->type != NODE_PIPELINE) {
+                // a && b &: the whole list runs in a background subshell
+                PipeStage s = {NULL, NULL, item->node, 0};
+                Pipe_commands(&s, 1, 1, item->cmdline);
+            } else {
+                exec_node(item->node, item->background);
+            }
+        }
+        return last_status;
+    }
+    return last_status;
+}
+
+int exec_subshell_body(void *body) {
+    return exec_node(body, 0);
+}
+
+#endif
@@ -0,0 +1,526 @@
+#ifndef EXPAND_H
+#define EXPAND_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "parser.h"
+
+// ---------------- Expansion -----------------
+//
+// Words the lexer flagged are expanded each time their command runs:
+//
+//   $name ${name}   the environment variable, empty if unset
+//   $?  $$          the last exit status, the shell's pid
+//   $(cmd) `cmd`    the output of cmd, trailing newlines removed
+//
+// Unquoted results are split at blanks and newlines into separate words;
+// inside double quotes they stay one word. NAME=value, redirection targets
+// and here-strings are never split, and here-document bodies expand as if
+// double-quoted when their delimiter was not quoted.
+//
+// A substitution runs the cached parse tree of its text in one of three
+// ways, cheapest first:
+//
+//   - only builtins that leave the shell alone (`$(pwd)`): in the shell,
+//     with stdout on a memfd, which cannot fill up while nobody reads it
+//   - one external command: posix_spawn'ed with stdout on a pipe
+//   - anything else: a forked subshell, also writing to a pipe
+//
+// The pipe is raised to SUBST_PIPE_SIZE so a big output costs fewer
+// wakeups, and is read straight into a buffer that doubles when full, so
+// no chunk is ever copied through a bounce buffer. Newlines are trimmed
+// and words split in that buffer in place: a field that is a whole word
+// becomes an argv entry pointing into it, with its delimiter overwritten
+// by the NUL.
+
+#define SUBST_PIPE_SIZE (1 << 20)
+#define SUBST_BUF_MIN 4096
+
+static int exec_node(Node *n, int background);
+
+typedef struct {
+    char **argv;            // finished words
+    size_t argc, cap;
+    char *word;             // the word being built
+    size_t len, wcap;
+    int owned;              // word is malloc'd; else it points into a capture
+    int have_word;          // a word has started, even if only with ""
+    void **allocs;          // freed by expand_free
+    size_t nallocs, acap;
+    int status;             // of the last substitution, -1 before one ran
+} Expand;
+
+typedef enum {
+    EXPAND_WORDS,           // a command word: split unquoted results
+    EXPAND_ONE,             // NAME=value, a redirection target: one word
+    EXPAND_HEREDOC,         // quotes are plain characters
+} ExpandMode;
+
+static Arena expand_scratch;        // tokens of a substitution being parsed
+static pid_t expand_pid;            // $$
+
+static void *expand_keep(Expand *x, void *p) {
+    if (!p) {
+        perror("malloc failed");
+        exit(1);
+    }
+    if (x->nallocs == x->acap) {
+        x->acap = x->acap ? x->acap * 2 : 16;
+        x->allocs = realloc(x->allocs, x->acap * sizeof(void *));
+        if (!x->allocs) {
+            perror("realloc failed");
+            exit(1);
+        }
+    }
+    x->allocs[x->nallocs++] = p;
+    return p;
+}
+
+static void expand_free(Expand *x) {
+    for (size_t i = 0; i < x->nallocs; i++)
+        free(x->allocs[i]);
+    if (x->owned) free(x->word);
+    free(x->allocs);
+    free(x->argv);
+    memset(x, 0, sizeof(*x));
+}
+
+// Appends n bytes to the word, copying it out of a capture first if need be.
+static void expand_put(Expand *x, const char *s, size_t n) {
+    if (!x->owned || x->len + n + 1 > x->wcap) {
+        size_t cap = x->wcap;
+        while (cap < x->len + n + 1)
+            cap = cap ? cap * 2 : 64;
+        char *w = x->owned ? realloc(x->word, cap) : malloc(cap);
+        if (!w) {
+            perror("malloc failed");
+            exit(1);
+        }
+        if (!x->owned && x->len)
+            memcpy(w, x->word, x->len);
+        x->word = w;
+        x->wcap = cap;
+        x->owned = 1;
+    }
+    memcpy(x->word + x->len, s, n);
+    x->len += n;
+    x->have_word = 1;
+}
+
+// Adds bytes of a capture buffer, which has room for a NUL after them.
+static void expand_slice(Expand *x, char *s, size_t n) {
+    if (x->have_word) {
+        expand_put(x, s, n);
+        return;
+    }
+    x->word = s;
+    x->len = n;
+    x->owned = 0;
+    x->have_word = 1;
+}
+
+static void expand_end_word(Expand *x) {
+    if (!x->have_word)
+        return;
+    x->word[x->len] = '\0';
+    if (x->owned)
+        expand_keep(x, x->word);
+    if (x->argc + 1 >= x->cap) {
+        x->cap = x->cap ? x->cap * 2 : 16;
+        x->argv = realloc(x->argv, x->cap * sizeof(char *));
+        if (!x->argv) {
+            perror("realloc failed");
+            exit(1);
+        }
+    }
+    x->argv[x->argc++] = x->word;
+    x->word = NULL;
+    x->len = x->wcap = 0;
+    x->owned = x->have_word = 0;
+}
+
+static inline int expand_is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\n';
+}
+
+// Adds an unquoted result: blanks in it end the word. Fields of a
+// writable capture are used in place.
+static void expand_split(Expand *x, char *s, size_t n, int writable) {
+    size_t i = 0;
+    while (i < n) {
+        if (expand_is_blank(s[i])) {
+            while (i < n && expand_is_blank(s[i])) i++;
+            expand_end_word(x);
+            continue;
+        }
+        size_t start = i;
+        while (i < n && !expand_is_blank(s[i])) i++;
+        if (writable) expand_slice(x, s + start, i - start);
+        else expand_put(x, s + start, i - start);
+    }
+}
+
+// --- command substitution ---
+
+typedef struct {
+    char *data;
+    size_t len, cap;
+} SubstBuf;
+
+// Reads fd to EOF straight into b, doubling it whenever it fills.
+static void subst_read(int fd, SubstBuf *b) {
+    for (;;) {
+        if (b->cap - b->len < 2) {
+            size_t cap = b->cap ? b->cap * 2 : SUBST_BUF_MIN;
+            char *data = realloc(b->data, cap);
+            if (!data) {
+                perror("realloc failed");
+                exit(1);
+            }
+            b->data = data;
+            b->cap = cap;
+        }
+        ssize_t n = read(fd, b->data + b->len, b->cap - b->len - 1);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        b->len += (size_t)n;
+    }
+}
+
+// Whether the tree is only builtins that may run in the shell.
+static int subst_pure(const Node *n) {
+    switch (n->type) {
+    case NODE_COMMAND:
+        return n->cmd.builtin && n->cmd.builtin->pure && n->cmd.nassigns == 0;
+    case NODE_PIPELINE:
+        return n->pipe.n == 1 && !n->pipe.timed && subst_pure(n->pipe.nodes[0]);
+    case NODE_AND:
+    case NODE_OR:
+        return subst_pure(n->bin.left) && subst_pure(n->bin.right);
+    case NODE_LIST:
+        for (int i = 0; i < n->list.n; i++)
+            if (n->list.items[i].background || !subst_pure(n->list.items[i].node))
+                return 0;
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+// The single external command the tree consists of, or NULL.
+static Node *subst_simple(Node *n) {
+    if (n->type == NODE_LIST && n->list.n == 1 && !n->list.items[0].background)
+        n = n->list.items[0].node;
+    if (n->type == NODE_PIPELINE && n->pipe.n == 1 && !n->pipe.timed)
+        n = n->pipe.nodes[0];
+    if (n->type != NODE_COMMAND || n->cmd.argc == 0 || n->cmd.builtin || n->cmd.nassigns)
+        return NULL;
+    return n;
+}
+
+static void subst_in_shell(Node *root, SubstBuf *b) {
+    int mfd = memfd_create("myshell-subst", MFD_CLOEXEC);
+    if (mfd < 0) {
+        perror("memfd_create");
+        return;
+    }
+    fflush(stdout);
+    int saved = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+    dup2(mfd, STDOUT_FILENO);
+    exec_node(root, 0);
+    fflush(stdout);
+    if (saved >= 0) {
+        dup2(saved, STDOUT_FILENO);
+        close(saved);
+    } else {
+        close(STDOUT_FILENO);
+    }
+    clearerr(stdout);
+
+    off_t size = lseek(mfd, 0, SEEK_CUR);
+    if (size > 0) {
+        b->data = malloc((size_t)size + 1);
+        if (!b->data) {
+            perror("malloc failed");
+            exit(1);
+        }
+        b->cap = (size_t)size + 1;
+        ssize_t n = pread(mfd, b->data, (size_t)size, 0);
+        b->len = n > 0 ? (size_t)n : 0;
+    }
+    close(mfd);
+}
+
+static int expand_command(Expand *x, const Node *n, Node *out);
+
+// Runs root with stdout on the pipe p and reads it into b. The child is
+// posix_spawn'ed when root is one external command, forked otherwise.
+static void subst_child(Node *root, int p[2], SubstBuf *b) {
+    Node *c = subst_simple(root);
+    Node expanded;
+    Expand y = {0};
+    pid_t pid = -1;
+    if (c && c->cmd.dynamic) {
+        if (expand_command(&y, c, &expanded) < 0 || expanded.cmd.argc == 0 || expanded.cmd.builtin)
+            c = NULL;       // became something else: let a subshell run it
+        else
+            c = &expanded;
+    }
+    if (c) {
+        posix_spawn_file_actions_t fa;
+        posix_spawn_file_actions_init(&fa);
+        posix_spawn_file_actions_adddup2(&fa, p[1], STDOUT_FILENO);
+        if (add_redirects(&fa, c->cmd.redirs) == 0)
+            pid = spawn_command(c->cmd.argv, &fa);
+        redirect_release();
+        posix_spawn_file_actions_destroy(&fa);
+    } else {
+        pid = fork_subshell(root, -1, p[1], p[0], NULL, -1);
+    }
+    close(p[1]);
+    subst_read(p[0], b);
+    close(p[0]);
+    int status = 0;
+    if (pid > 0) {
+        while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+            ;
+        last_status = status_to_code(status);
+    } else {
+        last_status = 127;
+    }
+    expand_free(&y);
+}
+
+// Runs the n bytes of cmd and returns its output (kept by x) with the
+// trailing newlines cut off, in *len. The buffer has room for a NUL.
+static char *expand_subst(Expand *x, const char *cmd, size_t n, size_t *len) {
+    char *line = strndup(cmd, n);
+    if (!line) {
+        perror("malloc failed");
+        exit(1);
+    }
+    ParseEntry *e = parse_cached(line, &expand_scratch);
+    arena_reset(&expand_scratch);
+    free(line);
+
+    SubstBuf b = {0};
+    if (!e) {
+        last_status = 2;
+    } else if (subst_pure(e->root)) {
+        subst_in_shell(e->root, &b);
+    } else {
+        int p[2];
+        if (pipe2(p, O_CLOEXEC) < 0) {
+            perror("pipe");
+            last_status = 1;
+        } else {
+            fcntl(p[1], F_SETPIPE_SZ, SUBST_PIPE_SIZE);
+            subst_child(e->root, p, &b);
+        }
+    }
+    if (e)
+        parse_release(e);
+    x->status = last_status;
+
+    if (!b.data) {
+        b.data = malloc(1);
+        b.len = 0;
+    }
+    expand_keep(x, b.data);
+    while (b.len > 0 && b.data[b.len - 1] == '\n')
+        b.len--;
+    *len = b.len;
+    return b.data;
+}
+
+// --- words ---
+
+// Expands the $ or ` at s and returns what follows it. split: the result
+// is unquoted.
+static const char *expand_dollar(Expand *x, const char *s, int split) {
+    if (*s == '`' || s[1] == '(') {
+        const char *end = lex_skip_subst(s);
+        if (!end) end = s + strlen(s) + 1;      // cannot happen after the lexer
+        size_t len;
+        char *out;
+        if (*s == '`') {
+            // inside backticks, \ quotes only \ ` and $
+            char *cmd = malloc((size_t)(end - s));
+            size_t n = 0;
+            for (const char *p = s + 1; p < end - 1; p++) {
+                if (*p == '\\' && (p[1] == '\\' || p[1] == '`' || p[1] == '$')) p++;
+                cmd[n++] = *p;
+            }
+            out = expand_subst(x, cmd, n, &len);
+            free(cmd);
+        } else {
+            out = expand_subst(x, s + 2, (size_t)(end - s - 3), &len);
+        }
+        if (split) expand_split(x, out, len, 1);
+        else expand_slice(x, out, len);
+        return end;
+    }
+
+    char num[24];
+    const char *value = NULL;
+    const char *next = s + 1;
+    if (s[1] == '?' || s[1] == '$') {
+        if (!expand_pid) expand_pid = getpid();
+        snprintf(num, sizeof(num), "%d", s[1] == '?' ? last_status : (int)expand_pid);
+        value = num;
+        next = s + 2;
+    } else {
+        const char *name = s + 1;
+        int braced = *name == '{';
+        if (braced) name++;
+        size_t n = 0;
+        while (name[n] == '_' || (name[n] >= 'a' && name[n] <= 'z') || (name[n] >= 'A' && name[n] <= 'Z') ||
+               (n > 0 && name[n] >= '0' && name[n] <= '9'))
+            n++;
+        if (n == 0 || (braced && name[n] != '}')) {
+            expand_put(x, "$", 1);      // not an expansion after all
+            return s + 1;
+        }
+        char var[n + 1];
+        memcpy(var, name, n);
+        var[n] = '\0';
+        value = getenv(var);
+        next = name + n + braced;
+    }
+    if (value) {
+        if (split) expand_split(x, (char *)value, strlen(value), 0);
+        else expand_put(x, value, strlen(value));
+    }
+    return next;
+}
+
+// Expands text into words in x; the last word is left open.
+static void expand_text(Expand *x, const char *s, ExpandMode mode) {
+    int dq = 0;
+    int heredoc = mode == EXPAND_HEREDOC;
+    const char *special = heredoc ? "\\$`" : "'\"\\$`";
+    while (*s) {
+        size_t plain = strcspn(s, special);
+        if (plain) {
+            expand_put(x, s, plain);
+            s += plain;
+            continue;
+        }
+        char c = *s;
+        if (c == '\'' && !dq) {
+            const char *close = strchr(s + 1, '\'');
+            if (!close) close = s + strlen(s);
+            expand_put(x, s + 1, (size_t)(close - s - 1));
+            s = *close ? close + 1 : close;
+        } else if (c == '\'') {
+            expand_put(x, s++, 1);
+        } else if (c == '"') {
+            dq = !dq;
+            expand_put(x, "", 0);
+            s++;
+        } else if (c == '\\') {
+            char n = s[1];
+            int quoted = dq || heredoc;
+            if (n == '\n') {
+                s += 2;
+            } else if (!n || (quoted && n != '$' && n != '`' && n != '\\' && !(dq && n == '"'))) {
+                expand_put(x, s++, 1);
+            } else {
+                expand_put(x, s + 1, 1);
+                s += 2;
+            }
+        } else {
+            s = expand_dollar(x, s, mode == EXPAND_WORDS && !dq);
+        }
+    }
+}
+
+// Expands text that must make exactly one word; returns it, kept by x.
+static char *expand_one(Expand *x, const char *text, ExpandMode mode) {
+    size_t mark = x->argc;
+    expand_text(x, text, mode);
+    if (!x->have_word)
+        expand_put(x, "", 0);
+    expand_end_word(x);
+    x->argc = mark;
+    return x->argv[mark];
+}
+
+// Copies n's command with every flagged word, value and redirection
+// expanded into out. The copy lives until expand_free(x). Returns -1 after
+// printing the error when a redirection target is empty.
+static int expand_command(Expand *x, const Node *n, Node *out) {
+    *out = *n;
+    out->cmd.expand = NULL;
+    out->cmd.dynamic = 0;
+
+    if (n->cmd.nassigns) {
+        out->cmd.assigns = expand_keep(x, malloc(n->cmd.nassigns * sizeof(Assign)));
+        for (int i = 0; i < n->cmd.nassigns; i++) {
+            out->cmd.assigns[i] = n->cmd.assigns[i];
+            if (n->cmd.assigns[i].expand)
+                out->cmd.assigns[i].value = expand_one(x, n->cmd.assigns[i].value, EXPAND_ONE);
+        }
+    }
+
+    Redirect **tail = &out->cmd.redirs;
+    for (const Redirect *r = n->cmd.redirs; r; r = r->next) {
+        Redirect *c = expand_keep(x, malloc(sizeof(Redirect)));
+        *c = *r;
+        c->next = NULL;
+        if (r->expand) {
+            char *text = expand_one(x, r->path, r->expand == 2 ? EXPAND_HEREDOC : EXPAND_ONE);
+            if (r->kind == REDIR_OPEN && !*text) {
+                fprintf(stderr, "myshell: %s: ambiguous redirect\n", r->path);
+                return -1;
+            }
+            c->path = text;
+            c->len = strlen(text);
+            c->expand = 0;
+        }
+        *tail = c;
+        tail = &c->next;
+    }
+
+    size_t mark = x->argc;
+    for (int i = 0; i < n->cmd.argc; i++) {
+        if (n->cmd.expand && n->cmd.expand[i]) {
+            expand_text(x, n->cmd.argv[i], EXPAND_WORDS);
+            expand_end_word(x);
+        } else {
+            // a plain word is used as it is
+            expand_slice(x, n->cmd.argv[i], strlen(n->cmd.argv[i]));
+            expand_end_word(x);
+        }
+    }
+    out->cmd.argc = (int)(x->argc - mark);
+    out->cmd.argv = expand_keep(x, malloc((x->argc - mark + 1) * sizeof(char *)));
+    memcpy(out->cmd.argv, x->argv + mark, (x->argc - mark) * sizeof(char *));
+    out->cmd.argv[out->cmd.argc] = NULL;
+    x->argc = mark;
+    if (n->cmd.expand && n->cmd.expand[0])
+        out->cmd.builtin = out->cmd.argc ? builtin_lookup(out->cmd.argv[0]) : NULL;
+    return 0;
+}
+
+// The redirections with flagged targets expanded, or r itself if none is.
+static const Redirect *expand_redirs(Expand *x, const Redirect *r, int *failed) {
+    Node n = {0}, out;
+    n.type = NODE_COMMAND;
+    n.cmd.redirs = (Redirect *)r;
+    for (const Redirect *p = r; p; p = p->next)
+        n.cmd.dynamic |= p->expand != 0;
+    if (!n.cmd.dynamic)
+        return r;
+    *failed = expand_command(x, &n, &out) < 0;
+    return out.cmd.redirs;
+}
+
+#endif
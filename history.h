@@ -0,0 +1,389 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+// ---------------- History Store -----------------
+//
+// Commands are copied once into a fixed-size byte arena that is used as a
+// ring: new entries go after the newest one and the oldest entries are
+// evicted when their bytes are needed again. A second ring of slots holds
+// the offset and length of each live entry, so appending and looking an
+// entry up by index are both O(1). Lookups hand out views into the arena;
+// a view stays valid until that entry is evicted.
+//
+// Entries from earlier sessions come from the history file instead (see
+// "History File" below) and are numbered before the ones of this session.
+
+#define HISTORY_DEFAULT_ENTRIES 100000
+#define HISTORY_ARENA_SIZE (8u << 20)
+
+typedef struct {
+    const char *command;  // not owned and not NUL-terminated; use len
+    size_t len;
+    int index;
+} HistoryEntry;
+
+typedef struct {
+    uint32_t offset;
+    uint32_t len;
+} HistorySlot;
+
+typedef struct {
+    char *arena;
+    size_t arena_size;
+    size_t head;          // where the next entry is written
+    HistorySlot *slots;
+    size_t max_entries;
+    size_t first;         // slot of the oldest entry
+    size_t count;
+    size_t evicted;       // entries dropped from the ring so far
+
+    // history file, mapped read-only at startup
+    int fd;
+    int idx_fd;
+    const char *file_data;
+    size_t file_size;
+    const uint64_t *file_index;
+    size_t file_index_size;
+    size_t file_count;
+} HistoryStore;
+
+HistoryStore history;
+
+// ---------------- History File -----------------
+//
+// ~/.myshell_history (or $MYSHELL_HISTFILE) holds one command per line and
+// is only ever appended to. A newline inside a command (a continued line)
+// is stored as a NUL byte, which no command contains, so every '\n' in the
+// file ends an entry and the index can be rebuilt from the data alone. Next to it, <file>.idx holds one 64-bit record
+// per entry: the entry's byte offset in the upper 40 bits and its length
+// in the lower 24. At startup both files are mmap'd and entries are served
+// straight from the mapping, so loading costs no parsing however large the
+// file is. Sessions append under an exclusive flock on the history file,
+// with O_APPEND on both files, so concurrent shells interleave whole
+// entries and nobody ever rewrites the file.
+
+#define HISTORY_LEN_BITS 24
+#define HISTORY_LEN_MAX ((1u << HISTORY_LEN_BITS) - 1)
+
+static inline uint64_t history_record(uint64_t offset, size_t len) {
+    return (offset << HISTORY_LEN_BITS) | (uint64_t)len;
+}
+
+static inline uint64_t history_record_offset(uint64_t rec) {
+    return rec >> HISTORY_LEN_BITS;
+}
+
+static inline size_t history_record_len(uint64_t rec) {
+    return (size_t)(rec & HISTORY_LEN_MAX);
+}
+
+static char *history_file_path(const char *suffix) {
+    const char *file = getenv("MYSHELL_HISTFILE");
+    char *path = NULL;
+    if (file && *file) {
+        if (asprintf(&path, "%s%s", file, suffix) < 0) return NULL;
+    } else {
+        const char *home = getenv("HOME");
+        if (!home) return NULL;
+        if (asprintf(&path, "%s/.myshell_history%s", home, suffix) < 0) return NULL;
+    }
+    return path;
+}
+
+// Indexes the part of the history file that the index does not cover yet:
+// a missing or deleted .idx file, or a session that died between its two
+// writes. Called with the exclusive lock held.
+static void history_index_tail(int fd, int idx_fd) {
+    struct stat ds, is;
+    if (fstat(fd, &ds) == -1 || fstat(idx_fd, &is) == -1)
+        return;
+
+    size_t nrec = (size_t)is.st_size / sizeof(uint64_t);
+    uint64_t end = 0;
+    if (nrec > 0) {
+        uint64_t rec;
+        if (pread(idx_fd, &rec, sizeof(rec), (off_t)((nrec - 1) * sizeof(rec))) != sizeof(rec))
+            return;
+        end = history_record_offset(rec) + history_record_len(rec) + 1;
+    }
+    if ((off_t)end >= ds.st_size)
+        return;
+
+    size_t len = (size_t)(ds.st_size - (off_t)end);
+    size_t skew = end % (uint64_t)sysconf(_SC_PAGESIZE);
+    char *tail = mmap(NULL, len + skew, PROT_READ, MAP_PRIVATE, fd, (off_t)(end - skew));
+    if (tail == MAP_FAILED)
+        return;
+    const char *p = tail + skew, *stop = p + len;
+
+    uint64_t buf[1024];
+    size_t n = 0;
+    while (p < stop) {
+        const char *nl = memchr(p, '\n', (size_t)(stop - p));
+        if (!nl) break;    // partial line from a writer that is not done
+        size_t elen = (size_t)(nl - p);
+        if (elen <= HISTORY_LEN_MAX)
+            buf[n++] = history_record(end, elen);
+        end += elen + 1;
+        p = nl + 1;
+        if (n == sizeof(buf) / sizeof(buf[0])) {
+            if (write(idx_fd, buf, n * sizeof(buf[0])) == -1) break;
+            n = 0;
+        }
+    }
+    if (n > 0 && write(idx_fd, buf, n * sizeof(buf[0])) == -1)
+        perror("history");
+    munmap(tail, len + skew);
+}
+
+void history_load_file(void) {
+    char *path = history_file_path("");
+    char *idx_path = history_file_path(".idx");
+    if (!path || !idx_path) {
+        free(path);
+        free(idx_path);
+        return;
+    }
+
+    history.fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    history.idx_fd = open(idx_path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    free(path);
+    free(idx_path);
+    if (history.fd == -1 || history.idx_fd == -1) {
+        perror("history");
+        if (history.fd != -1) close(history.fd);
+        if (history.idx_fd != -1) close(history.idx_fd);
+        history.fd = history.idx_fd = -1;
+        return;
+    }
+
+    flock(history.fd, LOCK_EX);
+    history_index_tail(history.fd, history.idx_fd);
+
+    struct stat ds, is;
+    if (fstat(history.fd, &ds) == 0 && fstat(history.idx_fd, &is) == 0 &&
+        ds.st_size > 0 && is.st_size >= (off_t)sizeof(uint64_t)) {
+        history.file_size = (size_t)ds.st_size;
+        history.file_index_size = (size_t)is.st_size - (size_t)is.st_size % sizeof(uint64_t);
+        // private and writable: last_command turns stored NULs back into
+        // newlines in place
+        void *data = mmap(NULL, history.file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, history.fd, 0);
+        void *index = mmap(NULL, history.file_index_size, PROT_READ, MAP_SHARED, history.idx_fd, 0);
+        if (data != MAP_FAILED && index != MAP_FAILED) {
+            history.file_data = data;
+            history.file_index = index;
+            history.file_count = history.file_index_size / sizeof(uint64_t);
+            // a torn index can point past the data; drop those records
+            while (history.file_count > 0) {
+                uint64_t rec = history.file_index[history.file_count - 1];
+                if (history_record_offset(rec) + history_record_len(rec) < history.file_size)
+                    break;
+                history.file_count--;
+            }
+        } else {
+            if (data != MAP_FAILED) munmap(data, history.file_size);
+            if (index != MAP_FAILED) munmap(index, history.file_index_size);
+            history.file_size = history.file_index_size = 0;
+        }
+    }
+    flock(history.fd, LOCK_UN);
+}
+
+static void history_append_file(const char *command, size_t len) {
+    if (history.fd == -1 || len > HISTORY_LEN_MAX)
+        return;
+
+    char *stored = NULL;
+    if (memchr(command, '\n', len)) {
+        stored = malloc(len);
+        if (!stored) return;
+        for (size_t i = 0; i < len; i++)
+            stored[i] = command[i] == '\n' ? '\0' : command[i];
+    }
+
+    flock(history.fd, LOCK_EX);
+    // another session may have died between its data and index writes
+    history_index_tail(history.fd, history.idx_fd);
+    off_t offset = lseek(history.fd, 0, SEEK_END);
+    struct iovec iov[2] = {
+        { stored ? stored : (void *)command, len },
+        { "\n", 1 },
+    };
+    if (offset != -1 && writev(history.fd, iov, 2) == (ssize_t)(len + 1)) {
+        uint64_t rec = history_record((uint64_t)offset, len);
+        if (write(history.idx_fd, &rec, sizeof(rec)) != sizeof(rec))
+            perror("history");
+    }
+    flock(history.fd, LOCK_UN);
+    free(stored);
+}
+
+void history_init(void) {
+    size_t max = HISTORY_DEFAULT_ENTRIES;
+    const char *hs = getenv("HISTSIZE");
+    if (hs && atol(hs) > 0)
+        max = (size_t)atol(hs);
+
+    history.arena = malloc(HISTORY_ARENA_SIZE);
+    history.slots = malloc(max * sizeof(HistorySlot));
+    if (!history.arena || !history.slots) {
+        perror("malloc failed");
+        exit(1);
+    }
+    history.arena_size = HISTORY_ARENA_SIZE;
+    history.max_entries = max;
+    history.head = 0;
+    history.first = 0;
+    history.count = 0;
+    history.evicted = 0;
+    history.fd = -1;
+    history.idx_fd = -1;
+    history_load_file();
+}
+
+void history_free(void) {
+    if (history.file_data)
+        munmap((void *)history.file_data, history.file_size);
+    if (history.file_index)
+        munmap((void *)history.file_index, history.file_index_size);
+    if (history.fd != -1) close(history.fd);
+    if (history.idx_fd != -1) close(history.idx_fd);
+    free(history.arena);
+    free(history.slots);
+    memset(&history, 0, sizeof(history));
+}
+
+static void history_evict_oldest(void) {
+    history.first = (history.first + 1) % history.max_entries;
+    history.count--;
+    history.evicted++;
+}
+
+int count_commands() {
+    return (int)(history.file_count + history.count);
+}
+
+HistoryEntry last_command(int index) {
+    HistoryEntry entry = {NULL, 0, -1};
+    int total = count_commands();
+    if (total == 0)
+        return entry;
+    if (index < 0)
+        index = 0;
+    else if (index >= total)
+        index = total - 1;
+
+    if ((size_t)index < history.file_count) {
+        uint64_t rec = history.file_index[index];
+        char *command = (char *)history.file_data + history_record_offset(rec);
+        size_t len = history_record_len(rec);
+        for (char *z = memchr(command, '\0', len); z; z = memchr(z, '\0', len - (size_t)(z - command)))
+            *z = '\n';
+        entry.command = command;
+        entry.len = len;
+    } else {
+        size_t i = (size_t)index - history.file_count;
+        HistorySlot *slot = &history.slots[(history.first + i) % history.max_entries];
+        entry.command = history.arena + slot->offset;
+        entry.len = slot->len;
+    }
+    entry.index = index;
+    return entry;
+}
+
+// Sequence numbers never change once given out, unlike indexes, which shift
+// down as the ring evicts. Entries from the file keep their index as their
+// sequence number; entry k of this session is file_count + k.
+size_t history_seq_end(void) {
+    return history.file_count + history.evicted + history.count;
+}
+
+int history_by_seq(size_t seq, HistoryEntry *entry) {
+    if (seq >= history.file_count) {
+        size_t k = seq - history.file_count;
+        if (k < history.evicted || k >= history.evicted + history.count)
+            return 0;
+        seq = history.file_count + (k - history.evicted);
+    }
+    *entry = last_command((int)seq);
+    return 1;
+}
+
+void add_to_history(const char *command) {
+    size_t len = strlen(command);
+    size_t need = len + 1;
+    if (!history.arena || need > history.arena_size)
+        return;
+
+    if (history.count == history.max_entries)
+        history_evict_oldest();
+
+    // Find room for need contiguous bytes at head, wrapping to the start
+    // of the arena when the tail is too short and evicting whatever is in
+    // the way. Live bytes are [tail, head) or, once wrapped, [tail, end)
+    // followed by [0, head).
+    for (;;) {
+        if (history.count == 0) {
+            if (history.head + need > history.arena_size)
+                history.head = 0;
+            break;
+        }
+        size_t tail = history.slots[history.first].offset;
+        if (history.head > tail) {
+            if (history.head + need <= history.arena_size)
+                break;
+            history.head = 0;
+            continue;
+        }
+        if (tail - history.head >= need)
+            break;
+        history_evict_oldest();
+    }
+
+    memcpy(history.arena + history.head, command, need);
+    HistorySlot *slot = &history.slots[(history.first + history.count) % history.max_entries];
+    slot->offset = (uint32_t)history.head;
+    slot->len = (uint32_t)len;
+    history.count++;
+    history.head += need;
+
+    history_append_file(command, len);
+}
+
+// history [n] - list the last n entries (all by default), numbered from 1.
+void history_commands(char **args) {
+    size_t total = (size_t)count_commands();
+    size_t start = 0;
+    if (args[1] != NULL) {
+        long n = atol(args[1]);
+        if (n < 0) {
+            fprintf(stderr, "history: %s: invalid count\n", args[1]);
+            return;
+        }
+        if ((size_t)n < total)
+            start = total - (size_t)n;
+    }
+    for (size_t i = start; i < total; i++) {
+        HistoryEntry e = last_command((int)i);
+        printf("%5zu  ", i + 1);
+        fwrite(e.command, 1, e.len, stdout);
+        putchar('\n');
+    }
+}
+
+#endif
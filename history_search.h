@@ -0,0 +1,419 @@
+#ifndef HISTORY_SEARCH_H
+#define HISTORY_SEARCH_H
+
+#include <stdint.h>
+#include <math.h>
+#include "history.h"
+
+// ---------------- History Search -----------------
+//
+// Index behind Ctrl-R. Every history entry is broken into trigrams and a
+// hash table maps each trigram to the ascending list of sequence numbers
+// (see history_by_seq) of the entries containing it. A substring query
+// only walks the shortest posting list among its trigrams, newest first,
+// and confirms each candidate with memmem, so a keystroke touches a few
+// entries instead of the whole history.
+//
+// Fuzzy mode ranks distinct commands instead: the query only has to be a
+// subsequence of the command, and the match score is weighted by how often
+// and how recently the command was run. A 64-bit character mask per
+// distinct command rejects most non-matches without looking at the text.
+//
+// The index is built the first time it is needed and afterwards catches up
+// with new entries on every query.
+
+#define SEARCH_FUZZY_RESULTS 32
+
+typedef struct {
+    uint32_t key;        // 0 = empty slot
+    uint32_t count;
+    uint32_t cap;
+    uint32_t *seqs;
+} TrigramPosting;
+
+typedef struct {
+    uint64_t hash;
+    uint64_t mask;
+    uint32_t newest;     // sequence number of the latest run
+    uint32_t runs;
+    uint32_t len;
+} DistinctCommand;
+
+typedef struct {
+    uint32_t seq;
+    double score;
+} FuzzyResult;
+
+typedef struct {
+    TrigramPosting *postings;
+    size_t postings_size;      // power of two
+    size_t postings_used;
+
+    DistinctCommand *distinct;
+    size_t distinct_count;
+    size_t distinct_cap;
+    uint32_t *distinct_table;  // distinct index + 1, 0 = empty
+    size_t distinct_table_size;
+
+    size_t indexed;            // sequence numbers below this are indexed
+
+    // Distinct commands that matched the last fuzzy query. Typing only
+    // extends the query, and a command that is not a subsequence match for
+    // a query cannot match a longer one, so the next keystroke rescans only
+    // these plus commands added since.
+    uint32_t *fuzzy_cand;
+    size_t fuzzy_ncand;
+    size_t fuzzy_cap;
+    size_t fuzzy_scanned;      // distinct commands considered so far
+    char fuzzy_query[256];
+    size_t fuzzy_qlen;
+} HistoryIndex;
+
+static HistoryIndex history_index;
+
+static inline uint32_t trigram_key(const char *p) {
+    return ((uint32_t)(unsigned char)p[0] << 16) |
+           ((uint32_t)(unsigned char)p[1] << 8) |
+           (uint32_t)(unsigned char)p[2];
+}
+
+static inline size_t search_hash32(uint32_t key) {
+    return (size_t)(key * 2654435761u);
+}
+
+static uint64_t search_hash_bytes(const char *s, size_t len) {
+    uint64_t h = 1469598103934665603ull;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+// One bit per letter (case folded), digit and a few punctuation classes.
+static inline uint64_t search_char_bit(unsigned char c) {
+    if (c >= 'A' && c <= 'Z') c = (unsigned char)(c - 'A' + 'a');
+    if (c >= 'a' && c <= 'z') return 1ull << (c - 'a');
+    if (c >= '0' && c <= '9') return 1ull << (26 + c - '0');
+    if (c == ' ' || c == '\t') return 0;
+    return 1ull << (36 + c % 28);
+}
+
+static uint64_t search_char_mask(const char *s, size_t len) {
+    uint64_t mask = 0;
+    for (size_t i = 0; i < len; i++)
+        mask |= search_char_bit((unsigned char)s[i]);
+    return mask;
+}
+
+static TrigramPosting *trigram_slot(uint32_t key) {
+    size_t m = history_index.postings_size - 1;
+    for (size_t i = search_hash32(key) & m;; i = (i + 1) & m) {
+        TrigramPosting *p = &history_index.postings[i];
+        if (p->key == key || p->key == 0)
+            return p;
+    }
+}
+
+static void trigram_table_grow(void) {
+    TrigramPosting *old = history_index.postings;
+    size_t old_size = history_index.postings_size;
+
+    history_index.postings_size = old_size ? old_size * 2 : 4096;
+    history_index.postings = calloc(history_index.postings_size, sizeof(TrigramPosting));
+    if (!history_index.postings) {
+        perror("calloc failed");
+        exit(1);
+    }
+    for (size_t i = 0; i < old_size; i++)
+        if (old[i].key)
+            *trigram_slot(old[i].key) = old[i];
+    free(old);
+}
+
+static void trigram_add(uint32_t key, uint32_t seq) {
+    if ((history_index.postings_used + 1) * 4 > history_index.postings_size * 3)
+        trigram_table_grow();
+
+    TrigramPosting *p = trigram_slot(key);
+    if (p->key == 0) {
+        p->key = key;
+        history_index.postings_used++;
+    }
+    // the same trigram twice in one entry is listed once
+    if (p->count > 0 && p->seqs[p->count - 1] == seq)
+        return;
+    if (p->count == p->cap) {
+        p->cap = p->cap ? p->cap * 2 : 4;
+        p->seqs = realloc(p->seqs, p->cap * sizeof(uint32_t));
+        if (!p->seqs) {
+            perror("realloc failed");
+            exit(1);
+        }
+    }
+    p->seqs[p->count++] = seq;
+}
+
+static void distinct_table_grow(void) {
+    free(history_index.distinct_table);
+    history_index.distinct_table_size = history_index.distinct_table_size
+        ? history_index.distinct_table_size * 2 : 4096;
+    history_index.distinct_table = calloc(history_index.distinct_table_size, sizeof(uint32_t));
+    if (!history_index.distinct_table) {
+        perror("calloc failed");
+        exit(1);
+    }
+    size_t m = history_index.distinct_table_size - 1;
+    for (size_t d = 0; d < history_index.distinct_count; d++) {
+        size_t i = (size_t)history_index.distinct[d].hash & m;
+        while (history_index.distinct_table[i])
+            i = (i + 1) & m;
+        history_index.distinct_table[i] = (uint32_t)d + 1;
+    }
+}
+
+static void distinct_add(const char *s, size_t len, uint32_t seq) {
+    if ((history_index.distinct_count + 1) * 2 > history_index.distinct_table_size)
+        distinct_table_grow();
+
+    uint64_t h = search_hash_bytes(s, len);
+    size_t m = history_index.distinct_table_size - 1;
+    size_t i = (size_t)h & m;
+    for (; history_index.distinct_table[i]; i = (i + 1) & m) {
+        DistinctCommand *d = &history_index.distinct[history_index.distinct_table[i] - 1];
+        if (d->hash != h || d->len != len)
+            continue;
+        // a hash collision must not hide a different command; once the
+        // stored run has left the history, its text cannot be shown anyway
+        HistoryEntry e;
+        if (!history_by_seq(d->newest, &e) || !e.command || memcmp(e.command, s, len) == 0) {
+            d->newest = seq;
+            d->runs++;
+            return;
+        }
+    }
+
+    if (history_index.distinct_count == history_index.distinct_cap) {
+        history_index.distinct_cap = history_index.distinct_cap ? history_index.distinct_cap * 2 : 1024;
+        history_index.distinct = realloc(history_index.distinct,
+                                         history_index.distinct_cap * sizeof(DistinctCommand));
+        if (!history_index.distinct) {
+            perror("realloc failed");
+            exit(1);
+        }
+    }
+    DistinctCommand *d = &history_index.distinct[history_index.distinct_count++];
+    d->hash = h;
+    d->mask = search_char_mask(s, len);
+    d->newest = seq;
+    d->runs = 1;
+    d->len = (uint32_t)len;
+    history_index.distinct_table[i] = (uint32_t)history_index.distinct_count;
+}
+
+void history_search_update(void) {
+    size_t end = history_seq_end();
+    if (history_index.postings_size == 0)
+        trigram_table_grow();
+
+    for (size_t seq = history_index.indexed; seq < end; seq++) {
+        HistoryEntry e;
+        if (!history_by_seq(seq, &e))
+            continue;
+        for (size_t i = 0; i + 3 <= e.len; i++)
+            trigram_add(trigram_key(e.command + i), (uint32_t)seq);
+        distinct_add(e.command, e.len, (uint32_t)seq);
+    }
+    history_index.indexed = end;
+}
+
+void history_search_free(void) {
+    for (size_t i = 0; i < history_index.postings_size; i++)
+        free(history_index.postings[i].seqs);
+    free(history_index.postings);
+    free(history_index.distinct);
+    free(history_index.distinct_table);
+    free(history_index.fuzzy_cand);
+    memset(&history_index, 0, sizeof(history_index));
+}
+
+// Newest entry older than `before` that contains query[0..qlen) and differs
+// from the text in skip (if any). Returns its sequence number, or -1.
+long history_search_substring(const char *query, size_t qlen, size_t before,
+                              const char *skip, size_t skip_len) {
+    history_search_update();
+    if (qlen == 0)
+        return -1;
+
+    if (qlen < 3) {
+        // too short for a trigram; matches this loose are rarely far back
+        for (size_t seq = before; seq-- > 0;) {
+            HistoryEntry e;
+            if (!history_by_seq(seq, &e)) {
+                // evicted from the ring; skip straight to the file entries
+                if (seq > history.file_count) seq = history.file_count;
+                continue;
+            }
+            if (memmem(e.command, e.len, query, qlen) &&
+                !(skip && e.len == skip_len && memcmp(e.command, skip, skip_len) == 0))
+                return (long)seq;
+        }
+        return -1;
+    }
+
+    // every trigram must be present; scan the rarest one's list
+    TrigramPosting *best = NULL;
+    for (size_t i = 0; i + 3 <= qlen; i++) {
+        TrigramPosting *p = trigram_slot(trigram_key(query + i));
+        if (p->key == 0)
+            return -1;
+        if (!best || p->count < best->count)
+            best = p;
+    }
+
+    // binary search for the first seq >= before, then walk back
+    size_t lo = 0, hi = best->count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (best->seqs[mid] < before) lo = mid + 1;
+        else hi = mid;
+    }
+    for (size_t i = lo; i-- > 0;) {
+        HistoryEntry e;
+        if (!history_by_seq(best->seqs[i], &e))
+            continue;
+        if (memmem(e.command, e.len, query, qlen) &&
+            !(skip && e.len == skip_len && memcmp(e.command, skip, skip_len) == 0))
+            return (long)best->seqs[i];
+    }
+    return -1;
+}
+
+static inline unsigned char search_fold(unsigned char c) {
+    return (c >= 'A' && c <= 'Z') ? (unsigned char)(c - 'A' + 'a') : c;
+}
+
+static inline int search_word_start(const char *s, size_t i) {
+    if (i == 0) return 1;
+    switch (s[i - 1]) {
+    case ' ': case '/': case '-': case '_': case '.': case '=':
+        return 1;
+    }
+    return 0;
+}
+
+// Case-insensitive subsequence match. Consecutive matches and matches at
+// the start of a word score extra; -1 when the query does not match.
+static double fuzzy_match_score(const char *s, size_t len, const char *q, size_t qlen) {
+    double score = 0;
+    size_t qi = 0;
+    size_t prev = (size_t)-2;
+    unsigned char want = search_fold((unsigned char)q[0]);
+    for (size_t i = 0; i < len; i++) {
+        if (search_fold((unsigned char)s[i]) != want)
+            continue;
+        score += 1;
+        if (i == prev + 1)
+            score += 2;
+        if (search_word_start(s, i))
+            score += 1.5;
+        prev = i;
+        if (++qi == qlen)
+            return score / (1.0 + (double)len / 64.0);
+        want = search_fold((unsigned char)q[qi]);
+    }
+    return -1;
+}
+
+static void fuzzy_keep(uint32_t d, size_t *n) {
+    if (*n == history_index.fuzzy_cap) {
+        history_index.fuzzy_cap = history_index.fuzzy_cap ? history_index.fuzzy_cap * 2 : 1024;
+        history_index.fuzzy_cand = realloc(history_index.fuzzy_cand,
+                                           history_index.fuzzy_cap * sizeof(uint32_t));
+        if (!history_index.fuzzy_cand) {
+            perror("realloc failed");
+            exit(1);
+        }
+    }
+    history_index.fuzzy_cand[(*n)++] = d;
+}
+
+// Scores distinct command d against the query and inserts it into the
+// descending top-`max` results. Returns 0 when it does not match at all.
+static int fuzzy_rank(uint32_t d, const char *query, size_t qlen, uint64_t qmask, double newest,
+                      FuzzyResult *results, int *n, int max) {
+    DistinctCommand *dc = &history_index.distinct[d];
+    if ((dc->mask & qmask) != qmask)
+        return 0;
+
+    double age = newest - (double)dc->newest;
+    double recency = 1.0 / (1.0 + age / 1000.0);
+    double frequency = log2(1.0 + dc->runs);
+    double weight = 1.0 + 0.25 * frequency + recency;
+
+    // The first query character scores at most 2.5 and the others 4.5, so
+    // when even a perfect match could not make the list, skip reading the
+    // text. The command stays a candidate since it was not ruled out.
+    double best = (2.5 + 4.5 * (double)(qlen - 1)) / (1.0 + (double)dc->len / 64.0);
+    if (*n == max && best * weight <= results[*n - 1].score)
+        return 1;
+
+    HistoryEntry e;
+    if (!history_by_seq(dc->newest, &e))
+        return 0;
+    double match = fuzzy_match_score(e.command, e.len, query, qlen);
+    if (match < 0)
+        return 0;
+
+    double score = match * weight;
+    if (*n == max && score <= results[*n - 1].score)
+        return 1;
+    int i = *n < max ? (*n)++ : max - 1;
+    while (i > 0 && results[i - 1].score < score) {
+        results[i] = results[i - 1];
+        i--;
+    }
+    results[i].seq = dc->newest;
+    results[i].score = score;
+    return 1;
+}
+
+// Fills results with the best-ranked distinct commands for query, best
+// first, and returns how many there are.
+int history_search_fuzzy(const char *query, size_t qlen, FuzzyResult *results, int max) {
+    history_search_update();
+    if (qlen == 0 || max <= 0 || qlen > sizeof(history_index.fuzzy_query)) {
+        history_index.fuzzy_qlen = 0;
+        history_index.fuzzy_scanned = 0;
+        return 0;
+    }
+
+    uint64_t qmask = search_char_mask(query, qlen);
+    double newest = (double)history_seq_end();
+    int n = 0;
+    size_t kept = 0;
+
+    int narrowing = history_index.fuzzy_qlen > 0 && history_index.fuzzy_qlen <= qlen &&
+                    memcmp(history_index.fuzzy_query, query, history_index.fuzzy_qlen) == 0;
+    size_t from = 0;
+    if (narrowing) {
+        for (size_t i = 0; i < history_index.fuzzy_ncand; i++) {
+            uint32_t d = history_index.fuzzy_cand[i];
+            if (fuzzy_rank(d, query, qlen, qmask, newest, results, &n, max))
+                history_index.fuzzy_cand[kept++] = d;
+        }
+        from = history_index.fuzzy_scanned;
+    }
+    // newest first, so the pruning above kicks in early
+    for (size_t d = history_index.distinct_count; d-- > from;)
+        if (fuzzy_rank((uint32_t)d, query, qlen, qmask, newest, results, &n, max))
+            fuzzy_keep((uint32_t)d, &kept);
+
+    history_index.fuzzy_ncand = kept;
+    history_index.fuzzy_scanned = history_index.distinct_count;
+    memcpy(history_index.fuzzy_query, query, qlen);
+    history_index.fuzzy_qlen = qlen;
+    return n;
+}
+
+#endif
@@ -0,0 +1,539 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/pidfd.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+// --- Job control ---
+//
+// Every command line runs as a job: its processes share one process group
+// (set at spawn time, no extra fork), and a foreground job owns the
+// terminal through tcsetpgrp, so Ctrl-C and Ctrl-Z reach the whole
+// pipeline and never the shell.
+//
+// Jobs are kept in two hash maps, one from every member pid to its process
+// and one from job number to job, plus a list in job-number order for
+// `jobs` and for picking the current job. Every lookup and state change is
+// O(1) however many jobs are running.
+//
+// Background jobs are reaped as soon as they change state: the shell
+// blocks SIGCHLD and reads it from a signalfd, and each process also has a
+// pidfd. While the line editor waits for a key it sleeps in epoll on the
+// terminal, the signalfd and the pidfds, so a finished job is collected at
+// once. Its "Done" line is printed before the next prompt.
+//
+// Every wait goes through wait4 or the raw waitid syscall, so each process
+// leaves its resource usage behind when it is reaped.
+
+typedef enum { JOB_RUNNING = 0, JOB_STOPPED = 1, JOB_DONE = 2 } JobStatus;
+
+struct Job;
+
+typedef struct JobProc {
+    pid_t pid;
+    int pidfd;              // -1 once reaped
+    JobStatus status;
+    int wait_status;        // last stop or exit status from waitpid
+    struct rusage usage;    // filled in when the process is reaped
+    struct Job *job;
+    struct JobProc *hash_next;
+} JobProc;
+
+typedef struct Job {
+    pid_t pgid;
+    int jid;
+    char *cmdline;
+    JobStatus status;
+    int queued;             // waiting in the notify queue
+    int nprocs;
+    int nrunning, nstopped; // processes in each state
+    JobProc *procs;         // one per pipeline stage
+    struct timespec started, finished;
+    struct Job *hash_next;
+    struct Job *prev, *next;                // job-number order
+    struct Job *notify_prev, *notify_next;  // state changes to report
+} Job;
+
+typedef struct {
+    void **buckets;
+    size_t size;            // power of two
+    size_t count;
+} JobMap;
+
+static JobMap procs_by_pid, jobs_by_jid;
+static Job *job_first, *job_last;
+static Job *notify_first, *notify_last;
+
+// Largest max RSS (KiB) of any process reaped so far; `time` resets it.
+static long job_peak_rss;
+
+static int event_fd = -1;       // epoll set
+static int sigchld_fd = -1;
+static int event_tty = 0;       // stdin is in the epoll set
+static char ev_tty_tag, ev_sigchld_tag;
+
+// Cleared in a forked subshell: its commands stay in the subshell's own
+// process group and the terminal is left to whoever owns it.
+static int job_control = 1;
+
+extern volatile sig_atomic_t sigint_flag;
+
+static inline size_t job_hash(int key, size_t size) {
+    return ((unsigned int)key * 2654435761u) & (size - 1);
+}
+
+// The two maps differ only in the entry type; `is_job` selects it.
+static inline void **job_chain(void *e, int is_job) {
+    return is_job ? (void **)&((Job *)e)->hash_next : (void **)&((JobProc *)e)->hash_next;
+}
+
+static inline int job_key(const void *e, int is_job) {
+    return is_job ? ((const Job *)e)->jid : ((const JobProc *)e)->pid;
+}
+
+static void job_map_insert(JobMap *map, void *e, int is_job) {
+    if (map->count >= map->size) {
+        size_t size = map->size ? map->size * 2 : 64;
+        void **buckets = calloc(size, sizeof(void *));
+        if (!buckets) {
+            perror("calloc failed");
+            exit(1);
+        }
+        for (size_t i = 0; i < map->size; i++) {
+            void *x = map->buckets[i];
+            while (x) {
+                void *next = *job_chain(x, is_job);
+                size_t h = job_hash(job_key(x, is_job), size);
+                *job_chain(x, is_job) = buckets[h];
+                buckets[h] = x;
+                x = next;
+            }
+        }
+        free(map->buckets);
+        map->buckets = buckets;
+        map->size = size;
+    }
+    size_t h = job_hash(job_key(e, is_job), map->size);
+    *job_chain(e, is_job) = map->buckets[h];
+    map->buckets[h] = e;
+    map->count++;
+}
+
+static void job_map_remove(JobMap *map, void *e, int is_job) {
+    if (!map->size) return;
+    void **p = &map->buckets[job_hash(job_key(e, is_job), map->size)];
+    while (*p) {
+        if (*p == e) {
+            *p = *job_chain(e, is_job);
+            map->count--;
+            return;
+        }
+        p = job_chain(*p, is_job);
+    }
+}
+
+static void *job_map_find(const JobMap *map, int key, int is_job) {
+    if (!map->size) return NULL;
+    void *e = map->buckets[job_hash(key, map->size)];
+    while (e && job_key(e, is_job) != key)
+        e = *job_chain(e, is_job);
+    return e;
+}
+
+static JobProc *find_proc_by_pid(pid_t pid) {
+    return job_map_find(&procs_by_pid, pid, 0);
+}
+
+static Job *find_job_by_pid(pid_t pid) {
+    JobProc *p = find_proc_by_pid(pid);
+    return p ? p->job : NULL;
+}
+
+static Job *find_job_by_jid(int jid) {
+    return job_map_find(&jobs_by_jid, jid, 1);
+}
+
+// The job fg and bg act on without an argument: the newest one.
+static Job *current_job(void) {
+    return job_last;
+}
+
+// "%n" is a job number, anything else a pid of one of the job's processes.
+static Job *find_job_spec(const char *spec) {
+    if (!spec) return current_job();
+    if (spec[0] == '%') {
+        if (spec[1] == '\0' || strcmp(spec, "%%") == 0 || strcmp(spec, "%+") == 0)
+            return current_job();
+        return find_job_by_jid(atoi(spec + 1));
+    }
+    return find_job_by_pid(atoi(spec));
+}
+
+static void job_close_pidfd(JobProc *p) {
+    if (p->pidfd < 0) return;
+    if (event_fd >= 0)
+        epoll_ctl(event_fd, EPOLL_CTL_DEL, p->pidfd, NULL);
+    close(p->pidfd);
+    p->pidfd = -1;
+}
+
+static void job_queue_notify(Job *j) {
+    if (j->queued) return;
+    j->queued = 1;
+    j->notify_next = NULL;
+    j->notify_prev = notify_last;
+    if (notify_last) notify_last->notify_next = j;
+    else notify_first = j;
+    notify_last = j;
+}
+
+static void job_dequeue_notify(Job *j) {
+    if (!j->queued) return;
+    if (j->notify_prev) j->notify_prev->notify_next = j->notify_next;
+    else notify_first = j->notify_next;
+    if (j->notify_next) j->notify_next->notify_prev = j->notify_prev;
+    else notify_last = j->notify_prev;
+    j->queued = 0;
+}
+
+// Registers the processes of one command line (pids[0] leads the process
+// group) as a running job. Failed spawns (pid <= 0) are recorded as already
+// done with status 127. Returns the job, or NULL if out of memory.
+static Job *add_job(pid_t pgid, const pid_t *pids, int n, const char *cmdline) {
+    Job *j = calloc(1, sizeof(Job));
+    JobProc *procs = calloc((size_t)n, sizeof(JobProc));
+    if (!j || !procs) {
+        free(j);
+        free(procs);
+        return NULL;
+    }
+    j->pgid = pgid;
+    // numbers restart once every job is gone, like other shells
+    j->jid = job_last ? job_last->jid + 1 : 1;
+    j->cmdline = strdup(cmdline ? cmdline : "");
+    j->status = JOB_RUNNING;
+    j->procs = procs;
+    j->nprocs = n;
+    clock_gettime(CLOCK_MONOTONIC, &j->started);
+    for (int i = 0; i < n; i++) {
+        JobProc *p = &procs[i];
+        p->job = j;
+        p->pid = pids[i];
+        p->pidfd = -1;
+        if (pids[i] <= 0) {
+            p->status = JOB_DONE;
+            p->wait_status = W_EXITCODE(127, 0);
+            continue;
+        }
+        p->status = JOB_RUNNING;
+        j->nrunning++;
+        p->pidfd = pidfd_open(p->pid, 0);
+        if (p->pidfd >= 0 && event_fd >= 0) {
+            struct epoll_event ev = { .events = EPOLLIN, .data.ptr = p };
+            epoll_ctl(event_fd, EPOLL_CTL_ADD, p->pidfd, &ev);
+        }
+        job_map_insert(&procs_by_pid, p, 0);
+    }
+    if (j->nrunning == 0)
+        j->status = JOB_DONE;
+
+    j->prev = job_last;
+    if (job_last) job_last->next = j;
+    else job_first = j;
+    job_last = j;
+    job_map_insert(&jobs_by_jid, j, 1);
+    return j;
+}
+
+static void remove_job(Job *job) {
+    if (!job) return;
+    for (int i = 0; i < job->nprocs; i++) {
+        JobProc *p = &job->procs[i];
+        if (p->pid > 0)
+            job_map_remove(&procs_by_pid, p, 0);
+        job_close_pidfd(p);
+    }
+    job_map_remove(&jobs_by_jid, job, 1);
+    if (job->prev) job->prev->next = job->next;
+    else job_first = job->next;
+    if (job->next) job->next->prev = job->prev;
+    else job_last = job->prev;
+    job_dequeue_notify(job);
+    free(job->procs);
+    free(job->cmdline);
+    free(job);
+}
+
+// Wait status of the job as a whole: that of its last stage.
+static int job_wait_status(const Job *j) {
+    return j->procs[j->nprocs - 1].wait_status;
+}
+
+// "Running", "Stopped", "Done", "Exit 2", "Killed", ...
+static const char *job_state(const Job *j, char *buf, size_t size) {
+    if (j->status == JOB_RUNNING) return "Running";
+    if (j->status == JOB_STOPPED) return "Stopped";
+    int st = job_wait_status(j);
+    if (WIFEXITED(st) && WEXITSTATUS(st) != 0) {
+        snprintf(buf, size, "Exit %d", WEXITSTATUS(st));
+        return buf;
+    }
+    if (WIFSIGNALED(st)) {
+        snprintf(buf, size, "%s%s", strsignal(WTERMSIG(st)), WCOREDUMP(st) ? " (core dumped)" : "");
+        return buf;
+    }
+    return "Done";
+}
+
+static void print_job(const Job *j) {
+    char buf[64];
+    printf("[%d] %s %d %s\n", j->jid, job_state(j, buf, sizeof(buf)), j->pgid, j->cmdline);
+}
+
+static void job_set_proc(JobProc *p, JobStatus status) {
+    Job *j = p->job;
+    if (p->status == JOB_RUNNING) j->nrunning--;
+    if (p->status == JOB_STOPPED) j->nstopped--;
+    p->status = status;
+    if (status == JOB_RUNNING) j->nrunning++;
+    if (status == JOB_STOPPED) j->nstopped++;
+}
+
+// Records a state change reported by wait4/waitid, with the usage of a
+// process that exited (ru may be NULL). Returns the job whose overall state
+// changed, if any.
+static Job *job_update(pid_t pid, int status, const struct rusage *ru) {
+    JobProc *p = find_proc_by_pid(pid);
+    if (!p || p->status == JOB_DONE) return NULL;
+    Job *j = p->job;
+    if (WIFSTOPPED(status)) {
+        job_set_proc(p, JOB_STOPPED);
+        p->wait_status = status;
+    } else if (WIFCONTINUED(status)) {
+        job_set_proc(p, JOB_RUNNING);
+    } else {
+        job_set_proc(p, JOB_DONE);
+        p->wait_status = status;
+        if (ru) {
+            p->usage = *ru;
+            if (ru->ru_maxrss > job_peak_rss)
+                job_peak_rss = ru->ru_maxrss;
+        }
+        job_close_pidfd(p);
+    }
+
+    JobStatus old = j->status;
+    if (j->nrunning > 0)
+        j->status = JOB_RUNNING;
+    else if (j->nstopped > 0)
+        j->status = JOB_STOPPED;
+    else
+        j->status = JOB_DONE;
+    if (j->status == old)
+        return NULL;
+    if (j->status == JOB_DONE)
+        clock_gettime(CLOCK_MONOTONIC, &j->finished);
+    if (j->status != JOB_RUNNING)
+        job_queue_notify(j);
+    return j;
+}
+
+// Marks the stopped processes of a job running again after SIGCONT.
+static void job_continue(Job *j) {
+    for (int i = 0; i < j->nprocs; i++)
+        if (j->procs[i].status == JOB_STOPPED)
+            job_set_proc(&j->procs[i], JOB_RUNNING);
+    if (j->nrunning > 0)
+        j->status = JOB_RUNNING;
+    job_dequeue_notify(j);
+}
+
+// Collects every child that has changed state without blocking.
+static void jobs_reap(void) {
+    int status;
+    pid_t pid;
+    struct rusage ru;
+    while ((pid = wait4(-1, &status, WNOHANG | WUNTRACED | WCONTINUED, &ru)) > 0)
+        job_update(pid, status, &ru);
+}
+
+// A process's pidfd became readable: it exited.
+static void job_pidfd_ready(JobProc *p) {
+    if (p->pidfd < 0) return;
+    siginfo_t info;
+    struct rusage ru;
+    info.si_pid = 0;
+    // the syscall, unlike glibc's waitid(), also reports the rusage
+    if (syscall(SYS_waitid, P_PIDFD, p->pidfd, &info, WEXITED | WNOHANG, &ru) != 0 || info.si_pid == 0)
+        return;
+    int status = info.si_code == CLD_EXITED ? W_EXITCODE(info.si_status, 0)
+                                            : W_EXITCODE(0, info.si_status) | (info.si_code == CLD_DUMPED ? 0x80 : 0);
+    job_update(info.si_pid, status, &ru);
+}
+
+// Prints the jobs that changed state since the last prompt and forgets the
+// finished ones.
+static void jobs_notify(void) {
+    jobs_reap();
+    while (notify_first) {
+        Job *j = notify_first;
+        job_dequeue_notify(j);
+        print_job(j);
+        if (j->status == JOB_DONE)
+            remove_job(j);
+    }
+    fflush(stdout);
+}
+
+static void list_jobs(void) {
+    jobs_reap();
+    Job *j = job_first;
+    while (j) {
+        Job *next = j->next;
+        print_job(j);
+        if (j->status == JOB_DONE)
+            remove_job(j);
+        else
+            job_dequeue_notify(j);
+        j = next;
+    }
+}
+
+// Blocks until the given job (or every running job when j is NULL) has
+// finished, sleeping in poll on the pidfds of the processes still running.
+// Stopped jobs are not waited for. Returns -1 if interrupted by Ctrl-C.
+static int jobs_wait(Job *target) {
+    sigint_flag = 0;
+    struct pollfd *fds = NULL;
+    JobProc **procs = NULL;
+    size_t cap = 0;
+    int rc = 0;
+    for (;;) {
+        size_t n = 0;
+        for (Job *j = target ? target : job_first; j; j = target ? NULL : j->next) {
+            if (j->status != JOB_RUNNING) continue;
+            for (int i = 0; i < j->nprocs; i++) {
+                JobProc *p = &j->procs[i];
+                if (p->status != JOB_RUNNING || p->pidfd < 0) continue;
+                if (n == cap) {
+                    cap = cap ? cap * 2 : 16;
+                    fds = realloc(fds, cap * sizeof(*fds));
+                    procs = realloc(procs, cap * sizeof(*procs));
+                    if (!fds || !procs) {
+                        perror("realloc failed");
+                        exit(1);
+                    }
+                }
+                fds[n] = (struct pollfd){ p->pidfd, POLLIN, 0 };
+                procs[n++] = p;
+            }
+        }
+        if (n == 0)
+            break;
+        int ready = poll(fds, n, -1);
+        if (ready < 0) {
+            if (errno == EINTR && sigint_flag) {
+                rc = -1;
+                break;
+            }
+            continue;
+        }
+        for (size_t i = 0; i < n; i++)
+            if (fds[i].revents)
+                job_pidfd_ready(procs[i]);
+    }
+    free(fds);
+    free(procs);
+    return rc;
+}
+
+// --- Event loop ---
+
+// Blocks SIGCHLD in favour of a signalfd and sets up the epoll set. If any
+// of it fails the shell still works; jobs are then only reaped at prompts.
+static void jobs_init(void) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) != 0) {
+        perror("sigprocmask");
+        return;
+    }
+    sigchld_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    event_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (sigchld_fd < 0 || event_fd < 0) {
+        perror("jobs_init");
+        return;
+    }
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &ev_sigchld_tag };
+    epoll_ctl(event_fd, EPOLL_CTL_ADD, sigchld_fd, &ev);
+    ev.data.ptr = &ev_tty_tag;
+    // fails with EPERM when stdin is a regular file; reads never block then
+    event_tty = epoll_ctl(event_fd, EPOLL_CTL_ADD, STDIN_FILENO, &ev) == 0;
+}
+
+// Without a prompt to report them at (scripts, -c), finished jobs are
+// reaped and forgotten quietly.
+static void jobs_discard_done(void) {
+    jobs_reap();
+    for (Job *j = job_first, *next; j; j = next) {
+        next = j->next;
+        if (j->status == JOB_DONE) remove_job(j);
+    }
+}
+
+// Called in a forked subshell. The parent's jobs are not its children, and
+// the epoll set is shared with the parent, so both are dropped without
+// touching the set (closing a copy of a pidfd leaves it registered).
+static void jobs_reset_child(void) {
+    if (event_fd >= 0) close(event_fd);
+    if (sigchld_fd >= 0) close(sigchld_fd);
+    event_fd = sigchld_fd = -1;
+    event_tty = 0;
+    while (job_first)
+        remove_job(job_first);
+    job_control = 0;
+}
+
+// Waits until the terminal has input, handling job events meanwhile.
+static void jobs_wait_input(void) {
+    if (event_fd < 0 || !event_tty)
+        return;
+    struct epoll_event evs[16];
+    for (;;) {
+        int n = epoll_wait(event_fd, evs, 16, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        int ready = 0;
+        for (int i = 0; i < n; i++) {
+            void *tag = evs[i].data.ptr;
+            if (tag == &ev_tty_tag) {
+                ready = 1;
+            } else if (tag == &ev_sigchld_tag) {
+                struct signalfd_siginfo si;
+                while (read(sigchld_fd, &si, sizeof(si)) == sizeof(si))
+                    ;
+                jobs_reap();
+            } else {
+                job_pidfd_ready(tag);
+            }
+        }
+        if (ready) return;
+    }
+}
+
+#endif
@@ -0,0 +1,552 @@
+#ifndef LEXER_H
+#define LEXER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ---------------- Arena -----------------
+//
+// Everything built while running one command line (tokens, argv arrays)
+// comes from a bump allocator that is reset once the line has run, so a
+// line with thousands of arguments costs no mallocs after the first few
+// lines have grown the arena.
+
+#define ARENA_BLOCK_MIN (64 * 1024)
+
+typedef struct ArenaBlock {
+    struct ArenaBlock *next;
+    size_t size;
+    size_t used;
+    char data[];
+} ArenaBlock;
+
+typedef struct {
+    ArenaBlock *head;
+    ArenaBlock *cur;
+    void *last;             // most recent allocation, may grow in place
+    size_t block_min;       // first block size; 0 means ARENA_BLOCK_MIN
+} Arena;
+
+static void *arena_alloc(Arena *a, size_t n) {
+    n = (n + 15) & ~(size_t)15;
+    ArenaBlock *b = a->cur;
+    while (b && b->used + n > b->size) {
+        b = b->next;
+        if (b) b->used = 0;
+    }
+    if (!b) {
+        size_t size = a->cur ? a->cur->size * 2 : a->block_min ? a->block_min : ARENA_BLOCK_MIN;
+        while (size < n) size *= 2;
+        b = malloc(sizeof(ArenaBlock) + size);
+        if (!b) {
+            perror("malloc failed");
+            exit(1);
+        }
+        b->size = size;
+        b->used = 0;
+        b->next = NULL;
+        if (a->cur) {
+            // keep later blocks after the new one so none is lost
+            b->next = a->cur->next;
+            a->cur->next = b;
+        } else {
+            a->head = b;
+        }
+    }
+    a->cur = b;
+    void *p = b->data + b->used;
+    b->used += n;
+    a->last = p;
+    return p;
+}
+
+// Grows p (of old bytes) to n bytes, in place when p was the last
+// allocation and its block has room.
+static void *arena_grow(Arena *a, void *p, size_t old, size_t n) {
+    if (p && p == a->last) {
+        ArenaBlock *b = a->cur;
+        size_t start = (size_t)((char *)p - b->data);
+        size_t need = (n + 15) & ~(size_t)15;
+        if (start + need <= b->size) {
+            b->used = start + need;
+            return p;
+        }
+    }
+    void *q = arena_alloc(a, n);
+    if (p) memcpy(q, p, old);
+    return q;
+}
+
+static void arena_reset(Arena *a) {
+    if (a->head) a->head->used = 0;
+    a->cur = a->head;
+    a->last = NULL;
+}
+
+static void arena_free(Arena *a) {
+    ArenaBlock *b = a->head;
+    while (b) {
+        ArenaBlock *next = b->next;
+        free(b);
+        b = next;
+    }
+    memset(a, 0, sizeof(*a));
+}
+
+// ---------------- Lexer -----------------
+//
+// One pass over the line. Words are slices of the line itself: quotes and
+// backslashes are removed by moving the rest of the word down in place, and
+// the byte after the word becomes its NUL terminator, so argv entries point
+// straight into the input.
+//
+//   '...'   literal            "..."  \ escapes only \ " $ ` and newline
+//   \c      literal c           \newline  removed
+//   # ...   comment at the start of a word
+//   $name ${name} $? $$ $(...) `...`  expanded when the command runs; the
+//           lexer only flags the word (blanks and operators inside $( )
+//           and ` ` do not end it) and the parser keeps it as typed
+//   |  ||  &&  ;  &  (  )
+//   [n]<  [n]>  [n]>>  [n]>|  [n]<>  [n]>&m  [n]<&m  &>  &>>  <<<
+//   [n]<< word / [n]<<- word: a here-document, whose body is the lines
+//       after the next newline up to one that is just word (<<- strips
+//       leading tabs). The body is moved to the operator token.
+//   newline  ends a command like ; (scripts, continued lines)
+
+typedef enum {
+    TOK_WORD,
+    TOK_PIPE,       // |
+    TOK_OR,         // ||
+    TOK_AND,        // &&
+    TOK_SEMI,       // ;
+    TOK_NEWLINE,
+    TOK_AMP,        // &
+    TOK_LPAREN,     // (
+    TOK_RPAREN,     // )
+    TOK_LESS,       // <
+    TOK_GREAT,      // > and >|
+    TOK_DGREAT,     // >>
+    TOK_LESSGREAT,  // <>
+    TOK_GREATAND,   // >&
+    TOK_LESSAND,    // <&
+    TOK_ANDGREAT,   // &>
+    TOK_ANDDGREAT,  // &>>
+    TOK_DLESS,      // << (text: the body)
+    TOK_DLESSDASH,  // <<-
+    TOK_TLESS,      // <<<
+    TOK_END
+} TokenType;
+
+typedef struct {
+    TokenType type;
+    char *text;         // TOK_WORD: NUL-terminated, unescaped; heredocs: body
+    size_t len;
+    int fd;             // redirections: explicit [n], or -1
+    int quoted;         // TOK_WORD: some part was quoted or escaped
+    int assign;         // TOK_WORD: NAME=value with NAME unquoted
+    int expand;         // TOK_WORD: has $ or ` outside single quotes
+    size_t start, end;  // source span in the original line
+} Token;
+
+typedef enum {
+    LEX_OK = 0,
+    LEX_INCOMPLETE,     // open quote, trailing backslash or unended heredoc
+} LexStatus;
+
+#define LEX_HEREDOCS_MAX 16     // here-documents waiting for one newline
+
+typedef struct {
+    Token *tokens;
+    size_t count;
+    LexStatus status;
+} LexResult;
+
+static inline int lex_is_blank(char c) {
+    return c == ' ' || c == '\t';
+}
+
+static inline int lex_is_operator(char c) {
+    return c == '|' || c == '&' || c == ';' || c == '<' || c == '>' || c == '(' || c == ')' ||
+           c == '\n';
+}
+
+static Token *lex_push(Arena *a, LexResult *r, size_t *cap) {
+    if (r->count == *cap) {
+        size_t ncap = *cap ? *cap * 2 : 64;
+        r->tokens = arena_grow(a, r->tokens, *cap * sizeof(Token), ncap * sizeof(Token));
+        *cap = ncap;
+    }
+    Token *t = &r->tokens[r->count++];
+    memset(t, 0, sizeof(*t));
+    t->fd = -1;
+    return t;
+}
+
+// Returns the end of the $(...) or `...` at p, just past its closing ) or
+// `, or NULL if it is still open at the end of the text. Quotes and
+// nested substitutions inside are skipped whole.
+static const char *lex_skip_subst(const char *p) {
+    if (*p == '`') {
+        for (p++; *p && *p != '`'; p++)
+            if (*p == '\\' && p[1]) p++;
+        return *p ? p + 1 : NULL;
+    }
+    int depth = 1;
+    for (p += 2; *p; p++) {
+        char c = *p;
+        if (c == '\\' && p[1]) {
+            p++;
+        } else if (c == '\'') {
+            const char *close = strchr(p + 1, '\'');
+            if (!close) return NULL;
+            p = close;
+        } else if (c == '"') {
+            for (p++; *p && *p != '"'; p++) {
+                if (*p == '\\' && p[1]) {
+                    p++;
+                } else if ((*p == '$' && p[1] == '(') || *p == '`') {
+                    p = lex_skip_subst(p);
+                    if (!p) return NULL;
+                    p--;
+                }
+            }
+            if (!*p) return NULL;
+        } else if ((c == '$' && p[1] == '(') || c == '`') {
+            p = lex_skip_subst(p);
+            if (!p) return NULL;
+            p--;
+        } else if (c == '(') {
+            depth++;
+        } else if (c == ')' && --depth == 0) {
+            return p + 1;
+        }
+    }
+    return NULL;
+}
+
+// Copies the substitution at *pp down to *wp as it is and flags t.
+static void lex_copy_subst(LexResult *r, Token *t, char **pp, char **wp) {
+    const char *end = lex_skip_subst(*pp);
+    if (!end) {
+        r->status = LEX_INCOMPLETE;
+        end = *pp + strlen(*pp);
+    }
+    size_t n = (size_t)(end - *pp);
+    memmove(*wp, *pp, n);
+    *wp += n;
+    *pp += n;
+    t->expand = 1;
+}
+
+// Decodes the redirection operator starting with c ('<' or '>') at *pp
+// and moves past it. *pp itself may already be a word's terminator.
+static TokenType lex_redirect_op(char c, char **pp) {
+    char *p = *pp;
+    TokenType type;
+    if (c == '<') {
+        if (p[1] == '<' && p[2] == '<') type = TOK_TLESS, p += 3;
+        else if (p[1] == '<' && p[2] == '-') type = TOK_DLESSDASH, p += 3;
+        else if (p[1] == '<') type = TOK_DLESS, p += 2;
+        else if (p[1] == '>') type = TOK_LESSGREAT, p += 2;
+        else if (p[1] == '&') type = TOK_LESSAND, p += 2;
+        else type = TOK_LESS, p += 1;
+    } else {
+        if (p[1] == '>') type = TOK_DGREAT, p += 2;
+        else if (p[1] == '&') type = TOK_GREATAND, p += 2;
+        else if (p[1] == '|') type = TOK_GREAT, p += 2;
+        else type = TOK_GREAT, p += 1;
+    }
+    *pp = p;
+    return type;
+}
+
+// Reads the body of the here-document op from the lines at *pp, ending at
+// a line that is just delim, and stores it in op. The body is moved down
+// over its stripped tabs and NUL-terminated in place.
+static int lex_heredoc_body(char **pp, Token *op, const char *delim) {
+    char *p = *pp, *w = p;
+    size_t dlen = strlen(delim);
+    op->text = p;
+    for (;;) {
+        if (op->type == TOK_DLESSDASH)
+            while (*p == '\t') p++;
+        char *eol = strchrnul(p, '\n');
+        if ((size_t)(eol - p) == dlen && memcmp(p, delim, dlen) == 0) {
+            op->len = (size_t)(w - op->text);
+            *w = '\0';
+            *pp = *eol ? eol + 1 : eol;
+            return 0;
+        }
+        if (*eol == '\0') {
+            op->len = 0;
+            *w = '\0';
+            *pp = eol;
+            return -1;
+        }
+        size_t n = (size_t)(eol + 1 - p);
+        memmove(w, p, n);
+        w += n;
+        p = eol + 1;
+    }
+}
+
+// Splits line (modified in place) into tokens allocated from a. The last
+// token is always TOK_END.
+static LexResult lex_line(Arena *a, char *line) {
+    LexResult r = {NULL, 0, LEX_OK};
+    size_t cap = 0;
+    char *p = line;
+    char saved = 0;     // operator byte that became a word's terminator
+    size_t heredocs[LEX_HEREDOCS_MAX];  // their operator tokens, in order
+    int nheredocs = 0;
+
+    for (;;) {
+        char c = saved;
+        saved = 0;
+        if (!c) {
+            // a backslash-newline between words is not an empty word
+            while (lex_is_blank(*p) || (p[0] == '\\' && p[1] == '\n'))
+                p += *p == '\\' ? 2 : 1;
+            if (*p == '\0')
+                break;
+            if (*p == '#') {
+                while (*p && *p != '\n') p++;
+                continue;
+            }
+            c = *p;
+        }
+
+        Token *t = lex_push(a, &r, &cap);
+        t->start = (size_t)(p - line);
+        if (lex_is_operator(c)) {
+            char n = p[1];
+            if (c == '<' || c == '>') {
+                t->type = lex_redirect_op(c, &p);
+            } else if (c == '&' && n == '>') {
+                t->type = p[2] == '>' ? TOK_ANDDGREAT : TOK_ANDGREAT;
+                p += t->type == TOK_ANDDGREAT ? 3 : 2;
+            } else {
+                p++;
+                switch (c) {
+                case '|': t->type = n == '|' ? TOK_OR : TOK_PIPE; break;
+                case '&': t->type = n == '&' ? TOK_AND : TOK_AMP; break;
+                case ';': t->type = TOK_SEMI; break;
+                case '\n': t->type = TOK_NEWLINE; break;
+                case '(': t->type = TOK_LPAREN; break;
+                case ')': t->type = TOK_RPAREN; break;
+                }
+                if (t->type == TOK_OR || t->type == TOK_AND)
+                    p++;
+            }
+            t->end = (size_t)(p - line);
+            if (t->type == TOK_DLESS || t->type == TOK_DLESSDASH) {
+                if (nheredocs < LEX_HEREDOCS_MAX)
+                    heredocs[nheredocs++] = r.count - 1;
+            } else if (t->type == TOK_NEWLINE && nheredocs > 0) {
+                // the bodies follow this newline, one after the other
+                for (int i = 0; i < nheredocs; i++) {
+                    Token *op = &r.tokens[heredocs[i]];
+                    const char *delim = op[1].type == TOK_WORD ? op[1].text : "";
+                    if (lex_heredoc_body(&p, op, delim) != 0)
+                        r.status = LEX_INCOMPLETE;
+                }
+                nheredocs = 0;
+            }
+            continue;
+        }
+
+        // a word; w trails p as quotes and backslashes are dropped
+        char *w = p;
+        t->type = TOK_WORD;
+        t->text = p;
+        int all_digits = 1;
+        int name = 1;       // everything so far could be a variable name
+        while (*p && !lex_is_blank(*p) && !lex_is_operator(*p)) {
+            c = *p;
+            if (c == '\'') {
+                t->quoted = 1;
+                all_digits = 0;
+                name = 0;
+                char *close = strchr(p + 1, '\'');
+                if (!close) {
+                    r.status = LEX_INCOMPLETE;
+                    close = p + strlen(p);
+                }
+                size_t n = (size_t)(close - p - 1);
+                memmove(w, p + 1, n);
+                w += n;
+                p = *close ? close + 1 : close;
+            } else if (c == '"') {
+                t->quoted = 1;
+                all_digits = 0;
+                name = 0;
+                p++;
+                while (*p && *p != '"') {
+                    if ((*p == '$' && p[1] == '(') || *p == '`') {
+                        lex_copy_subst(&r, t, &p, &w);
+                        continue;
+                    }
+                    if (*p == '$')
+                        t->expand = 1;
+                    if (*p == '\\' && (p[1] == '\\' || p[1] == '"' || p[1] == '$' ||
+                                       p[1] == '`' || p[1] == '\n')) {
+                        if (p[1] == '\n') { p += 2; continue; }
+                        p++;
+                    }
+                    *w++ = *p++;
+                }
+                if (*p == '"') p++;
+                else r.status = LEX_INCOMPLETE;
+            } else if ((c == '$' && p[1] == '(') || c == '`') {
+                all_digits = 0;
+                name = 0;
+                lex_copy_subst(&r, t, &p, &w);
+            } else if (c == '\\') {
+                t->quoted = 1;
+                all_digits = 0;
+                name = 0;
+                if (p[1] == '\0') {
+                    r.status = LEX_INCOMPLETE;
+                    p++;
+                } else if (p[1] == '\n') {
+                    p += 2;
+                } else {
+                    *w++ = p[1];
+                    p += 2;
+                }
+            } else {
+                if (c < '0' || c > '9') all_digits = 0;
+                if (c == '$' && p[1]) t->expand = 1;
+                if (name && c == '=' && w > t->text) {
+                    t->assign = 1;
+                    name = 0;
+                } else if (name && !(c == '_' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+                                     (c >= '0' && c <= '9' && w > t->text))) {
+                    name = 0;
+                }
+                *w++ = *p++;
+            }
+        }
+        t->end = (size_t)(p - line);
+        t->len = (size_t)(w - t->text);
+
+        // "2>file": the digits are the redirection's fd, not a word
+        if (all_digits && t->len > 0 && t->len < 4 && (*p == '<' || *p == '>')) {
+            int fd = atoi(t->text);
+            t->start = t->end;
+            t->type = lex_redirect_op(*p, &p);
+            t->fd = fd;
+            t->text = NULL;
+            t->len = 0;
+            t->end = (size_t)(p - line);
+            if ((t->type == TOK_DLESS || t->type == TOK_DLESSDASH) && nheredocs < LEX_HEREDOCS_MAX)
+                heredocs[nheredocs++] = r.count - 1;
+            continue;
+        }
+
+        // terminate in place. Without quotes removed, w sits on the
+        // delimiter: a blank can simply be overwritten, an operator is
+        // remembered and lexed from `saved` next time round.
+        if (w == p && lex_is_operator(*p))
+            saved = *p;         // p stays on it for the operator branch
+        else if (w == p && *p)
+            p++;
+        *w = '\0';
+    }
+
+    if (nheredocs > 0)
+        r.status = LEX_INCOMPLETE;      // no newline, so no body yet
+    Token *end = lex_push(a, &r, &cap);
+    end->type = TOK_END;
+    end->start = end->end = (size_t)(p - line);
+    return r;
+}
+
+typedef struct {
+    char word[256];     // delimiter with quotes and backslashes dropped
+    size_t len;
+    int dash;           // <<-: tabs before the delimiter are allowed
+} LexHereDelim;
+
+// Whether line needs another line to be complete: 2 for a trailing
+// backslash (the backslash-newline is dropped), 1 for an open quote or
+// backtick, an unclosed (, a trailing |, && or || or a here-document
+// without its delimiter line (the newline is kept), 0 if complete.
+static int lex_needs_more(const char *line, size_t len) {
+    char quote = 0;
+    int pending_op = 0;
+    int depth = 0;
+    LexHereDelim heredocs[LEX_HEREDOCS_MAX];
+    int nheredocs = 0;
+    for (size_t i = 0; i < len; i++) {
+        char c = line[i];
+        if (quote == '\'') {
+            if (c == '\'') quote = 0;
+            continue;
+        }
+        if (c == '\\') {
+            if (i + 1 == len) return 2;
+            i++;
+            pending_op = 0;
+            continue;
+        }
+        if (quote == '"' || quote == '`') {
+            if (c == quote) quote = 0;
+            continue;
+        }
+        if (c == '\'' || c == '"' || c == '`') {
+            quote = c;
+            pending_op = 0;
+        } else if (c == '#' && (i == 0 || lex_is_blank(line[i - 1]) || line[i - 1] == '\n')) {
+            while (i < len && line[i] != '\n') i++;
+        } else if (c == '<' && i + 1 < len && line[i + 1] == '<' &&
+                   (i + 2 == len || line[i + 2] != '<')) {
+            i += 2;
+            LexHereDelim *h = nheredocs < LEX_HEREDOCS_MAX ? &heredocs[nheredocs++] : NULL;
+            int dash = i < len && line[i] == '-';
+            if (dash) i++;
+            while (i < len && lex_is_blank(line[i])) i++;
+            size_t n = 0;
+            for (; i < len && !lex_is_blank(line[i]) && !lex_is_operator(line[i]); i++) {
+                char d = line[i];
+                if (d == '\'' || d == '"' || d == '\\') continue;
+                if (h && n < sizeof(h->word)) h->word[n++] = d;
+            }
+            if (h) {
+                h->len = n;
+                h->dash = dash;
+            }
+            i--;
+            pending_op = 0;
+        } else if (c == '\n' && nheredocs > 0) {
+            // skip the bodies, each up to its delimiter line
+            size_t k = i + 1;
+            for (int h = 0; h < nheredocs; h++) {
+                for (;;) {
+                    if (k >= len) return 1;
+                    size_t s = k;
+                    if (heredocs[h].dash)
+                        while (s < len && line[s] == '\t') s++;
+                    size_t eol = s;
+                    while (eol < len && line[eol] != '\n') eol++;
+                    k = eol + 1;
+                    if (eol - s == heredocs[h].len && memcmp(line + s, heredocs[h].word, eol - s) == 0)
+                        break;
+                }
+            }
+            nheredocs = 0;
+            i = k - 1;
+        } else if (c == '|' || (c == '&' && i + 1 < len && line[i + 1] == '&')) {
+            pending_op = 1;
+            if (c == '&') i++;
+        } else if (!lex_is_blank(c) && c != '\n') {
+            if (c == '(') depth++;
+            else if (c == ')' && depth > 0) depth--;
+            pending_op = 0;
+        }
+    }
+    return quote != 0 || pending_op || depth > 0 || nheredocs > 0;
+}
+
+#endif
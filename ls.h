@@ -0,0 +1,547 @@
+#ifndef LS_H
+#define LS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <grp.h>
+#include <pwd.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "threadpool.h"
+
+// ---------------- ls -----------------
+//
+// ls runs in the shell itself. Directories are read with getdents64 into a
+// 1 MiB buffer, and statx is asked only for what the flags need: nothing
+// for a plain listing, the size for -S, the mtime for -t and the full long
+// format for -l. Large long listings fetch their statx batches on the
+// thread pool. -U prints each getdents batch as soon as it is read, so a
+// huge directory starts scrolling immediately.
+//
+// Supported flags: -l -a -S -t -U -r -1. Anything else is passed on to
+// /bin/ls.
+
+#define LS_DENTS_BUF (1 << 20)
+#define LS_PARALLEL_MIN 2048     // entries before statx goes to the pool
+
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+typedef struct {
+    size_t name;          // offset into LsList.names
+    size_t len;
+    unsigned char type;   // DT_*
+    mode_t mode;
+    uint32_t nlink;
+    uid_t uid;
+    gid_t gid;
+    uint64_t size;
+    uint64_t blocks;
+    int64_t mtime;
+    uint32_t mtime_nsec;
+} LsEntry;
+
+typedef struct {
+    LsEntry *v;
+    size_t n, cap;
+    char *names;
+    size_t names_len, names_cap;
+    int fd;               // directory the names are relative to
+} LsList;
+
+typedef struct {
+    int all, long_fmt, by_size, by_time, unsorted, reverse, one_per_line;
+    unsigned int mask;    // statx fields needed, 0 = no statx at all
+    int jobs;
+    int cols;             // terminal width, 0 when stdout is not a tty
+} LsOpts;
+
+static LsOpts ls_opts;
+
+// --- output ---
+// Lines are collected in a buffer and written in large chunks, so a long
+// listing costs a handful of writes instead of one per line.
+
+static char ls_out[1 << 16];
+static size_t ls_out_len;
+
+static void ls_flush(void) {
+    if (ls_out_len) fwrite(ls_out, 1, ls_out_len, stdout);
+    ls_out_len = 0;
+    fflush(stdout);
+}
+
+static void ls_write(const char *s, size_t n) {
+    if (ls_out_len + n > sizeof(ls_out)) {
+        fwrite(ls_out, 1, ls_out_len, stdout);
+        ls_out_len = 0;
+        if (n > sizeof(ls_out)) {
+            fwrite(s, 1, n, stdout);
+            return;
+        }
+    }
+    memcpy(ls_out + ls_out_len, s, n);
+    ls_out_len += n;
+}
+
+static void ls_puts(const char *s) {
+    ls_write(s, strlen(s));
+}
+
+static void ls_pad(size_t n) {
+    static const char spaces[] = "                                ";
+    while (n > 0) {
+        size_t k = n < sizeof(spaces) - 1 ? n : sizeof(spaces) - 1;
+        ls_write(spaces, k);
+        n -= k;
+    }
+}
+
+// --- reading ---
+
+static void ls_list_add(LsList *l, const char *name, size_t len, unsigned char type) {
+    if (l->n == l->cap) {
+        l->cap = l->cap ? l->cap * 2 : 256;
+        l->v = realloc(l->v, l->cap * sizeof(LsEntry));
+    }
+    if (l->names_len + len + 1 > l->names_cap) {
+        while (l->names_len + len + 1 > l->names_cap)
+            l->names_cap = l->names_cap ? l->names_cap * 2 : 16384;
+        l->names = realloc(l->names, l->names_cap);
+    }
+    if (!l->v || !l->names) {
+        perror("realloc failed");
+        exit(1);
+    }
+    memcpy(l->names + l->names_len, name, len + 1);
+    LsEntry *e = &l->v[l->n++];
+    memset(e, 0, sizeof(*e));
+    e->name = l->names_len;
+    e->len = len;
+    e->type = type;
+    l->names_len += len + 1;
+}
+
+static void ls_list_reset(LsList *l) {
+    l->n = 0;
+    l->names_len = 0;
+}
+
+static void ls_list_free(LsList *l) {
+    free(l->v);
+    free(l->names);
+    memset(l, 0, sizeof(*l));
+}
+
+static void ls_fill_stat(LsEntry *e, const struct statx *stx) {
+    e->mode = stx->stx_mode;
+    e->nlink = stx->stx_nlink;
+    e->uid = stx->stx_uid;
+    e->gid = stx->stx_gid;
+    e->size = stx->stx_size;
+    e->blocks = stx->stx_blocks;
+    e->mtime = stx->stx_mtime.tv_sec;
+    e->mtime_nsec = stx->stx_mtime.tv_nsec;
+    if (e->type == DT_UNKNOWN)
+        e->type = IFTODT(stx->stx_mode);
+}
+
+static void ls_stat_range(LsList *l, size_t from, size_t to) {
+    struct statx stx;
+    for (size_t i = from; i < to; i++) {
+        LsEntry *e = &l->v[i];
+        if (statx(l->fd, l->names + e->name, AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC,
+                  ls_opts.mask, &stx) == 0)
+            ls_fill_stat(e, &stx);
+    }
+}
+
+typedef struct {
+    LsList *list;
+    size_t from, to;
+} LsChunk;
+
+static void ls_stat_task(void *arg, int worker) {
+    (void)worker;
+    LsChunk *c = arg;
+    ls_stat_range(c->list, c->from, c->to);
+}
+
+// Fills in statx fields for entries [from, n), across threads if there are
+// many of them.
+static void ls_stat_entries(LsList *l, size_t from) {
+    size_t n = l->n - from;
+    if (!ls_opts.mask || n == 0)
+        return;
+    if (ls_opts.jobs < 2 || n < LS_PARALLEL_MIN) {
+        ls_stat_range(l, from, l->n);
+        return;
+    }
+
+    size_t chunk = n / ((size_t)ls_opts.jobs * 4);
+    if (chunk < 512) chunk = 512;
+    size_t nchunks = (n + chunk - 1) / chunk;
+    LsChunk *chunks = malloc(nchunks * sizeof(LsChunk));
+    ThreadPool *pool = chunks ? pool_create(ls_opts.jobs) : NULL;
+    if (!pool) {
+        free(chunks);
+        ls_stat_range(l, from, l->n);
+        return;
+    }
+    for (size_t i = 0; i < nchunks; i++) {
+        size_t a = from + i * chunk;
+        chunks[i] = (LsChunk){l, a, a + chunk < l->n ? a + chunk : l->n};
+        pool_submit(pool, 0, ls_stat_task, &chunks[i]);
+    }
+    pool_run(pool);
+    pool_destroy(pool);
+    free(chunks);
+}
+
+// --- sorting ---
+
+static int ls_compare(const void *a, const void *b, void *names) {
+    const LsEntry *x = a, *y = b;
+    int r = 0;
+    if (ls_opts.by_size) {
+        r = x->size < y->size ? 1 : x->size > y->size ? -1 : 0;
+    } else if (ls_opts.by_time) {
+        r = x->mtime < y->mtime ? 1 : x->mtime > y->mtime ? -1 : 0;
+        if (!r) r = x->mtime_nsec < y->mtime_nsec ? 1 : x->mtime_nsec > y->mtime_nsec ? -1 : 0;
+    }
+    if (!r) r = strcmp((char *)names + x->name, (char *)names + y->name);
+    return ls_opts.reverse ? -r : r;
+}
+
+// --- formatting ---
+
+typedef struct {
+    unsigned int id;
+    char name[32];
+} LsName;
+
+static LsName ls_users[16], ls_groups[16];
+static int ls_nusers, ls_ngroups;
+
+static const char *ls_id_name(LsName *cache, int *count, unsigned int id, int group) {
+    for (int i = 0; i < *count; i++)
+        if (cache[i].id == id) return cache[i].name;
+    LsName *slot = &cache[*count < 16 ? (*count)++ : (int)(id % 16)];
+    slot->id = id;
+    const char *name = NULL;
+    if (group) {
+        struct group *gr = getgrgid(id);
+        if (gr) name = gr->gr_name;
+    } else {
+        struct passwd *pw = getpwuid(id);
+        if (pw) name = pw->pw_name;
+    }
+    if (name)
+        snprintf(slot->name, sizeof(slot->name), "%s", name);
+    else
+        snprintf(slot->name, sizeof(slot->name), "%u", id);
+    return slot->name;
+}
+
+static void ls_mode_string(mode_t m, char out[11]) {
+    const char *types = "?pc?d?b?-?l?s???";
+    out[0] = types[(m >> 12) & 0xf];
+    const char *rwx = "rwxrwxrwx";
+    for (int i = 0; i < 9; i++)
+        out[1 + i] = (m & (0400 >> i)) ? rwx[i] : '-';
+    if (m & S_ISUID) out[3] = (m & S_IXUSR) ? 's' : 'S';
+    if (m & S_ISGID) out[6] = (m & S_IXGRP) ? 's' : 'S';
+    if (m & S_ISVTX) out[9] = (m & S_IXOTH) ? 't' : 'T';
+    out[10] = '\0';
+}
+
+static int ls_digits(uint64_t v) {
+    int d = 1;
+    while (v >= 10) { v /= 10; d++; }
+    return d;
+}
+
+// Display width of a name: bytes minus UTF-8 continuation bytes.
+static size_t ls_width(const char *s, size_t len) {
+    size_t w = 0;
+    for (size_t i = 0; i < len; i++)
+        if (((unsigned char)s[i] & 0xc0) != 0x80) w++;
+    return w;
+}
+
+static void ls_print_long(LsList *l, int show_total) {
+    int w_nlink = 1, w_user = 1, w_group = 1, w_size = 1;
+    uint64_t blocks = 0;
+    for (size_t i = 0; i < l->n; i++) {
+        LsEntry *e = &l->v[i];
+        int d;
+        if ((d = ls_digits(e->nlink)) > w_nlink) w_nlink = d;
+        if ((d = ls_digits(e->size)) > w_size) w_size = d;
+        if ((d = strlen(ls_id_name(ls_users, &ls_nusers, e->uid, 0))) > w_user) w_user = d;
+        if ((d = strlen(ls_id_name(ls_groups, &ls_ngroups, e->gid, 1))) > w_group) w_group = d;
+        blocks += e->blocks;
+    }
+    char line[512];
+    if (show_total) {
+        snprintf(line, sizeof(line), "total %llu\n", (unsigned long long)(blocks / 2));
+        ls_puts(line);
+    }
+
+    time_t now = time(NULL);
+    for (size_t i = 0; i < l->n; i++) {
+        LsEntry *e = &l->v[i];
+        char mode[11], date[32];
+        ls_mode_string(e->mode, mode);
+        struct tm tm;
+        time_t mt = (time_t)e->mtime;
+        localtime_r(&mt, &tm);
+        // like coreutils: show the year instead of the time beyond ~6 months
+        if (now - mt > 15778476 || mt - now > 3600)
+            strftime(date, sizeof(date), "%b %e  %Y", &tm);
+        else
+            strftime(date, sizeof(date), "%b %e %H:%M", &tm);
+        int n = snprintf(line, sizeof(line), "%s %*u %-*s %-*s %*llu %s ", mode, w_nlink, e->nlink,
+                         w_user, ls_id_name(ls_users, &ls_nusers, e->uid, 0),
+                         w_group, ls_id_name(ls_groups, &ls_ngroups, e->gid, 1),
+                         w_size, (unsigned long long)e->size, date);
+        ls_write(line, n < (int)sizeof(line) ? (size_t)n : sizeof(line) - 1);
+        const char *name = l->names + e->name;
+        ls_write(name, e->len);
+        if (S_ISLNK(e->mode)) {
+            char target[PATH_MAX];
+            ssize_t t = readlinkat(l->fd, name, target, sizeof(target));
+            if (t > 0) {
+                ls_write(" -> ", 4);
+                ls_write(target, (size_t)t);
+            }
+        }
+        ls_write("\n", 1);
+    }
+}
+
+// Names in columns, filled top to bottom like ls, with the largest number
+// of columns that fits the terminal.
+static void ls_print_columns(LsList *l) {
+    size_t n = l->n;
+    if (n == 0) return;
+    if (ls_opts.one_per_line || ls_opts.cols <= 0) {
+        for (size_t i = 0; i < n; i++) {
+            ls_write(l->names + l->v[i].name, l->v[i].len);
+            ls_write("\n", 1);
+        }
+        return;
+    }
+
+    size_t *w = malloc(n * sizeof(size_t));
+    size_t min_w = SIZE_MAX;
+    for (size_t i = 0; w && i < n; i++) {
+        w[i] = ls_width(l->names + l->v[i].name, l->v[i].len);
+        if (w[i] < min_w) min_w = w[i];
+    }
+    size_t width = (size_t)ls_opts.cols;
+    size_t max_cols = w ? width / (min_w + 2) : 1;
+    if (max_cols < 1) max_cols = 1;
+    if (max_cols > n) max_cols = n;
+
+    size_t *colw = malloc(max_cols * sizeof(size_t));
+    size_t cols = 1, rows = n;
+    for (size_t c = max_cols; colw && c > 1; c--) {
+        size_t r = (n + c - 1) / c;
+        if ((n + r - 1) / r != c) continue;    // would leave an empty column
+        size_t total = 0;
+        memset(colw, 0, c * sizeof(size_t));
+        // the last column needs no gap after it
+        for (size_t i = 0; i < n && total <= width + 2; i++) {
+            size_t col = i / r;
+            if (w[i] + 2 > colw[col]) {
+                total += w[i] + 2 - colw[col];
+                colw[col] = w[i] + 2;
+            }
+        }
+        if (total - 2 <= width) {
+            cols = c;
+            rows = r;
+            break;
+        }
+    }
+    if (cols > 1) {
+        memset(colw, 0, cols * sizeof(size_t));
+        for (size_t i = 0; i < n; i++)
+            if (w[i] + 2 > colw[i / rows]) colw[i / rows] = w[i] + 2;
+    }
+
+    for (size_t r = 0; r < rows; r++) {
+        for (size_t c = 0; c < cols; c++) {
+            size_t i = c * rows + r;
+            if (i >= n) break;
+            ls_write(l->names + l->v[i].name, l->v[i].len);
+            if (c + 1 < cols && i + rows < n)
+                ls_pad(colw[c] - w[i]);
+        }
+        ls_write("\n", 1);
+    }
+    free(colw);
+    free(w);
+}
+
+static void ls_print(LsList *l, int show_total) {
+    if (ls_opts.long_fmt)
+        ls_print_long(l, show_total);
+    else
+        ls_print_columns(l);
+}
+
+// --- directories ---
+
+static int ls_directory(const char *path, LsList *l) {
+    l->fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (l->fd < 0) {
+        fprintf(stderr, "ls: cannot open directory '%s': %s\n", path, strerror(errno));
+        return 1;
+    }
+    char *buf = malloc(LS_DENTS_BUF);
+    if (!buf) {
+        perror("malloc failed");
+        close(l->fd);
+        return 1;
+    }
+
+    ls_list_reset(l);
+    int status = 0;
+    for (;;) {
+        long nread = syscall(SYS_getdents64, l->fd, buf, LS_DENTS_BUF);
+        if (nread < 0) {
+            fprintf(stderr, "ls: reading directory '%s': %s\n", path, strerror(errno));
+            status = 1;
+            break;
+        }
+        if (nread == 0)
+            break;
+        for (long off = 0; off < nread;) {
+            struct linux_dirent64 *d = (struct linux_dirent64 *)(buf + off);
+            off += d->d_reclen;
+            if (d->d_name[0] == '.' && !ls_opts.all)
+                continue;
+            ls_list_add(l, d->d_name, strlen(d->d_name), d->d_type);
+        }
+        if (ls_opts.unsorted) {
+            // stream: print this batch and forget it
+            ls_stat_entries(l, 0);
+            ls_print(l, 0);
+            ls_flush();
+            ls_list_reset(l);
+        }
+    }
+    free(buf);
+
+    if (!ls_opts.unsorted) {
+        ls_stat_entries(l, 0);
+        qsort_r(l->v, l->n, sizeof(LsEntry), ls_compare, l->names);
+        ls_print(l, 1);
+    }
+    close(l->fd);
+    return status;
+}
+
+// Spawns the real ls for flags the builtin does not handle.
+static int ls_external(char **args) {
+    return run_job(args, NULL, 0, "ls");
+}
+
+int ls_commands(char **args) {
+    memset(&ls_opts, 0, sizeof(ls_opts));
+    int i = 1;
+    for (; args[i] && args[i][0] == '-' && args[i][1]; i++) {
+        if (strcmp(args[i], "--") == 0) { i++; break; }
+        for (const char *f = args[i] + 1; *f; f++) {
+            switch (*f) {
+            case 'a': ls_opts.all = 1; break;
+            case 'l': ls_opts.long_fmt = 1; break;
+            case 'S': ls_opts.by_size = 1; ls_opts.by_time = 0; break;
+            case 't': ls_opts.by_time = 1; ls_opts.by_size = 0; break;
+            case 'U': ls_opts.unsorted = 1; break;
+            case 'r': ls_opts.reverse = 1; break;
+            case '1': ls_opts.one_per_line = 1; break;
+            default: return ls_external(args);
+            }
+        }
+    }
+    if (ls_opts.unsorted)
+        ls_opts.by_size = ls_opts.by_time = ls_opts.reverse = 0;
+    if (ls_opts.long_fmt)
+        ls_opts.mask = STATX_TYPE | STATX_MODE | STATX_NLINK | STATX_UID | STATX_GID |
+                       STATX_SIZE | STATX_MTIME | STATX_BLOCKS;
+    if (ls_opts.by_size) ls_opts.mask |= STATX_SIZE;
+    if (ls_opts.by_time) ls_opts.mask |= STATX_MTIME;
+    ls_opts.jobs = pool_default_workers();
+    if (isatty(STDOUT_FILENO) && !ls_opts.unsorted) {
+        struct winsize ws;
+        ls_opts.cols = ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0 ? ws.ws_col : 80;
+    }
+
+    char *dot[] = {".", NULL};
+    char **paths = args[i] ? args + i : dot;
+    int npaths = 0;
+    while (paths[npaths]) npaths++;
+
+    // operands that are not directories are listed first, together
+    int status = 0;
+    LsList files = {0};
+    files.fd = AT_FDCWD;
+    char *is_dir = calloc((size_t)npaths, 1);
+    unsigned int saved_mask = ls_opts.mask;
+    ls_opts.mask |= STATX_TYPE;
+    for (int p = 0; p < npaths; p++) {
+        struct statx stx;
+        if (statx(AT_FDCWD, paths[p], AT_STATX_DONT_SYNC, ls_opts.mask, &stx) != 0) {
+            fprintf(stderr, "ls: cannot access '%s': %s\n", paths[p], strerror(errno));
+            status = 2;
+            continue;
+        }
+        if (S_ISDIR(stx.stx_mode)) {
+            if (is_dir) is_dir[p] = 1;
+        } else {
+            ls_list_add(&files, paths[p], strlen(paths[p]), DT_UNKNOWN);
+            ls_fill_stat(&files.v[files.n - 1], &stx);
+        }
+    }
+    ls_opts.mask = saved_mask;
+    if (files.n) {
+        if (!ls_opts.unsorted)
+            qsort_r(files.v, files.n, sizeof(LsEntry), ls_compare, files.names);
+        ls_print(&files, 0);
+    }
+
+    LsList list = {0};
+    int printed = files.n > 0;
+    for (int p = 0; p < npaths; p++) {
+        if (!is_dir || !is_dir[p])
+            continue;
+        if (npaths > 1) {
+            if (printed) ls_write("\n", 1);
+            ls_puts(paths[p]);
+            ls_write(":\n", 2);
+        }
+        if (ls_directory(paths[p], &list))
+            status = status ? status : 1;
+        printed = 1;
+    }
+    ls_flush();
+    ls_list_free(&list);
+    ls_list_free(&files);
+    free(is_dir);
+    return status;
+}
+
+#endif
@@ -4,10 +4,18 @@
 #include <termios.h>
 #include <unistd.h>
 #include "command.h"
+#include "lexer.h"
+#include "builtins.h"
+#include "parser.h"
+#include "exec.h"
+#include "script.h"
+#include "ls.h"
+#include "history.h"
+#include "history_search.h"
 #include "promt.h"
-
-char *history = NULL; 
-int current_history_index = -1;
+#include "editor.h"
+#include "parallel.h"
+#include "copy.h"
 
 #include <signal.h>
 #include <sys/wait.h>
@@ -27,245 +35,241 @@ void sigint_handler(int sig) {
     sigint_flag = 1;
 }
 
+// A foreground job owns the terminal, so Ctrl-Z normally reaches it
+// directly; this covers jobs the shell could not hand the terminal to.
 void sigtstp_handler(int sig) {
     (void)sig;
     if (fg_pid != 0) {
         kill(fg_pid, SIGTSTP); 
     }
-    const char msg[] = "\n[Stopped]\n";
-    write(STDOUT_FILENO, msg, sizeof(msg) - 1);
     sigtstp_flag = 1;
 }
 
-void commands_operator(char *input) {
-    char *args[100];
-    int i = 0;
+static Arena line_arena;     // tokens of the line being parsed
 
-    char *token = strtok(input, " \t\n");
-    while (token && i < 99) {
-        args[i++] = token;
-        token = strtok(NULL, " \t\n");
+void commands_operator(char *input) {
+    ParseEntry *e = parse_cached(input, &line_arena);
+    if (e) {
+        exec_node(e->root, 0);
+        parse_release(e);
+    } else {
+        last_status = 2;
     }
-    args[i] = NULL;
+    arena_reset(&line_arena);
+}
 
-    if (args[0] == NULL) return;
+// ------------------ BUILT-IN COMMANDS ------------------
 
-    // handle background operator '&' (if last token)
-    int background = 0;
-    int argc = i;
-    if (argc > 0 && strcmp(args[argc - 1], "&") == 0) {
-        background = 1;
-        args[argc - 1] = NULL;
-        argc--;
-    }
+static int builtin_rmdir(int argc, char **argv) {
+    (void)argc;
+    return rmdir_commands(argv);
+}
 
-    // ------------------ PIPE HANDLING ------------------
-    int pipe_index = -1;
-    for (int j = 0; args[j] != NULL; j++) {
-        if (strcmp(args[j], "|") == 0) {
-            pipe_index = j;
-            break;
-        }
-    }
+static int builtin_cd(int argc, char **argv) {
+    return cd_commands(argc > 1 ? argv[1] : "");
+}
 
-    if (pipe_index != -1) {
-        char *cmd1_args[pipe_index + 1];
-        for (int i = 0; i < pipe_index; i++)
-            cmd1_args[i] = args[i];
-        cmd1_args[pipe_index] = NULL;
-
-        int cmd2_len = 0;
-        for (int i = pipe_index + 1; args[i] != NULL; i++)
-            cmd2_len++;
-        char *cmd2_args[cmd2_len + 1];
-        for (int i = 0; i < cmd2_len; i++)
-            cmd2_args[i] = args[pipe_index + 1 + i];
-        cmd2_args[cmd2_len] = NULL;
-
-        Pipe_commands(cmd1_args, cmd2_args);
-        return;
-    }
+static int builtin_ls(int argc, char **argv) {
+    (void)argc;
+    return ls_commands(argv);
+}
 
-    // ------------------ REDIRECTION HANDLING (<, >, >>) ------------------
-    char *output_file = NULL;
-    char *input_file = NULL;
-    int append = 0;
+static int builtin_pwd(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    pwd_commands();
+    return 0;
+}
 
-    for (int j = 0; args[j] != NULL; j++) {
-        if (strcmp(args[j], ">") == 0) {
-            output_file = args[j + 1];
-            append = 0;
-            args[j] = NULL;
-            break;
-        }
-        else if (strcmp(args[j], ">>") == 0) {
-            output_file = args[j + 1];
-            append = 1;
-            args[j] = NULL;
-            break;
-        }
-        else if (strcmp(args[j], "<") == 0) {
-            input_file = args[j + 1];
-            args[j] = NULL;
-            break;
-        }
+static int builtin_touch(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "touch: missing file operand\n");
+        return 1;
     }
+    return touch_commands(argv[1]);
+}
 
-    if (output_file || input_file) {
-        redirect_commands(args, output_file, input_file, append);
-        return;
+static int builtin_rm(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "rm: missing file operand\n");
+        return 1;
     }
+    return rm_commands(argv[1]);
+}
 
-    // ------------------ BUILT-IN COMMANDS ------------------
-    if (strcmp(args[0], "rmdir") == 0) {
-        if (args[1] != NULL)
-            rm_r_recursive(args[1]);
-        else
-            fprintf(stderr, "rmdir: missing directory operand\n");
-        return;
-    }
+static int builtin_help(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    help_commands();
+    return 0;
+}
 
-    if (strcmp(args[0], "cd") == 0) {
-        if (args[1] != NULL)
-            cd_commands(args[1]);
-        else
-            cd_commands("");
-        return;
-    }
+static int builtin_history(int argc, char **argv) {
+    (void)argc;
+    history_commands(argv);
+    return 0;
+}
 
-    if (strcmp(args[0], "ls") == 0 && args[1] == NULL) {
-        ls_commands(args);
-        return;
-    }
+static int builtin_hash(int argc, char **argv) {
+    (void)argc;
+    hash_commands(argv);
+    return 0;
+}
 
-    if (strcmp(args[0], "pwd") == 0 && args[1] == NULL) {
-        pwd_commands();
-        return;
+static int builtin_source(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "source: missing virtual environment name\n");
+        return 1;
     }
+    activate_virtualenv(argv[1]);
+    return 0;
+}
 
-    if (strcmp(args[0], "touch") == 0) {
-        if (args[1] != NULL)
-            touch_commands(args[1]);
-        else
-            fprintf(stderr, "touch: missing file operand\n");
-        return;
-    }
+static int builtin_deactivate(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    deactivate_virtualenv();
+    return 0;
+}
 
-    if (strcmp(args[0], "rm") == 0) {
-        if (args[1] != NULL)
-            rm_commands(args[1]);
-        else
-            fprintf(stderr, "rm: missing file operand\n");
-        return;
-    }
+// exit [n]: leaves the shell (or subshell) with n, or the last status
+static int builtin_exit(int argc, char **argv) {
+    exit_requested = 1;
+    return argc > 1 ? atoi(argv[1]) & 0xff : last_status;
+}
 
-    if (strcmp(args[0], "help") == 0) {
-        help_commands();
-        return;
+// set -e / set +e
+static int builtin_set(int argc, char **argv) {
+    if (argc == 1) {
+        printf("errexit\t%s\n", errexit ? "on" : "off");
+        return 0;
     }
-
-    if (args[1] && strcmp(args[1], "--version") == 0) {
-        version_command(args[0]);
-        return;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-e") == 0) {
+            errexit = 1;
+        } else if (strcmp(argv[i], "+e") == 0) {
+            errexit = 0;
+        } else {
+            fprintf(stderr, "set: %s: unsupported option\n", argv[i]);
+            return 2;
+        }
     }
+    return 0;
+}
 
-    if (strcmp(args[0], "source") == 0) {
-        if (args[1] != NULL)
-            activate_virtualenv(args[1]);
-        else
-            fprintf(stderr, "source: missing virtual environment name\n");
-        return;
-    }
+static int builtin_pipestatus(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    pipestatus_commands();
+    return 0;
+}
 
-    // --- job control builtins ---
-    if (strcmp(args[0], "jobs") == 0) {
-        list_jobs();
-        return;
-    }
+// --- job control builtins ---
 
-    if (strcmp(args[0], "fg") == 0) {
-        // fg [%%jid | pid]
-        Job *j = NULL;
-        if (args[1] == NULL) {
-            // pick most recent job (job_list head)
-            if (job_list) j = job_list;
-        } else {
-            int jid = 0;
-            if (args[1][0] == '%') jid = atoi(args[1] + 1);
-            else jid = atoi(args[1]);
-            if (jid > 0) j = find_job_by_jid(jid);
-        }
-        if (!j) {
-            fprintf(stderr, "fg: no such job\n");
-            return;
-        }
-        // continue and wait
-        kill(j->pid, SIGCONT);
-        mark_job_running(j->pid);
-        fg_pid = j->pid;
-        int status = 0;
-        waitpid(j->pid, &status, WUNTRACED);
-        if (WIFSTOPPED(status)) {
-            mark_job_stopped(j->pid);
-        } else {
-            // finished
-            remove_job(j);
-        }
-        fg_pid = 0;
-        return;
-    }
+static int builtin_jobs(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    list_jobs();
+    return 0;
+}
 
-    if (strcmp(args[0], "bg") == 0) {
-        // bg [%jid | pid]
-        Job *j = NULL;
-        if (args[1] == NULL) {
-            if (job_list) j = job_list;
-        } else {
-            int jid = 0;
-            if (args[1][0] == '%') jid = atoi(args[1] + 1);
-            else jid = atoi(args[1]);
-            if (jid > 0) j = find_job_by_jid(jid);
-        }
-        if (!j) {
-            fprintf(stderr, "bg: no such job\n");
-            return;
-        }
-        kill(j->pid, SIGCONT);
-        mark_job_running(j->pid);
-        printf("[%d] %d\n", j->jid, j->pid);
-        return;
+// fg [%jid | pid]
+static int builtin_fg(int argc, char **argv) {
+    (void)argc;
+    Job *j = find_job_spec(argv[1]);
+    if (!j) {
+        fprintf(stderr, "fg: no such job\n");
+        return 1;
     }
-
-    // ------------------ NORMAL EXECUTION ------------------
-    pid_t pid = spawn_command(args, NULL);
-    if (pid < 0)
-        return;
-
-    if (background) {
-        int jid = add_job(pid, input, JOB_RUNNING);
-        if (jid < 0)
-            fprintf(stderr, "failed to add background job\n");
-        else
-            printf("[%d] %d\n", jid, pid);
-        // do not wait
-        return;
+    if (j->status == JOB_DONE) {
+        fprintf(stderr, "fg: job has terminated\n");
+        print_job(j);
+        remove_job(j);
+        return 1;
     }
+    printf("%s\n", j->cmdline);
+    fflush(stdout);
+    kill(-j->pgid, SIGCONT);
+    job_continue(j);
+    return wait_foreground_job(j);
+}
 
-    fg_pid = pid;
-    int status = 0;
-    waitpid(pid, &status, WUNTRACED);
-    if (WIFSTOPPED(status)) {
-        // add to job list as stopped
-        add_job(pid, input, JOB_STOPPED);
-        printf("\n[%d] Stopped %d %s\n", next_jid-1, pid, input);
-    } else {
-        // if finished, ensure it's removed from jobs if present
-        Job *j = find_job_by_pid(pid);
-        if (j) remove_job(j);
+// bg [%jid | pid]
+static int builtin_bg(int argc, char **argv) {
+    (void)argc;
+    Job *j = find_job_spec(argv[1]);
+    if (!j) {
+        fprintf(stderr, "bg: no such job\n");
+        return 1;
+    }
+    if (j->status == JOB_DONE) {
+        fprintf(stderr, "bg: job has terminated\n");
+        return 1;
     }
-    fg_pid = 0;
+    kill(-j->pgid, SIGCONT);
+    job_continue(j);
+    printf("[%d] %s &\n", j->jid, j->cmdline);
+    return 0;
 }
 
+static int builtin_stats(int argc, char **argv) {
+    (void)argc;
+    return stats_commands(argv);
+}
+
+static int builtin_parallel(int argc, char **argv) {
+    (void)argc;
+    return parallel_commands(argv);
+}
+
+static int builtin_cat(int argc, char **argv) {
+    (void)argc;
+    return cat_commands(argv);
+}
+
+static int builtin_cp(int argc, char **argv) {
+    (void)argc;
+    return cp_commands(argv);
+}
+
+static int builtin_tee(int argc, char **argv) {
+    (void)argc;
+    return tee_commands(argv);
+}
+
+static int builtin_wait(int argc, char **argv) {
+    (void)argc;
+    return wait_commands(argv);
+}
+
+const Builtin builtin_table[] = {
+    {"cd", builtin_cd, 0},
+    {"ls", builtin_ls, 1},
+    {"pwd", builtin_pwd, 1},
+    {"touch", builtin_touch, 1},
+    {"rm", builtin_rm, 1},
+    {"rmdir", builtin_rmdir, 1},
+    {"help", builtin_help, 1},
+    {"history", builtin_history, 1},
+    {"hash", builtin_hash, 0},
+    {"source", builtin_source, 0},
+    {"deactivate", builtin_deactivate, 0},
+    {"pipestatus", builtin_pipestatus, 1},
+    {"jobs", builtin_jobs, 1},
+    {"fg", builtin_fg, 0},
+    {"bg", builtin_bg, 0},
+    {"wait", builtin_wait, 0},
+    {"exit", builtin_exit, 0},
+    {"quit", builtin_exit, 0},
+    {"set", builtin_set, 0},
+    {"stats", builtin_stats, 1},
+    {"parallel", builtin_parallel, 1},
+    {"cat", builtin_cat, 1},
+    {"cp", builtin_cp, 1},
+    {"tee", builtin_tee, 1},
+};
+const size_t builtin_count = sizeof(builtin_table) / sizeof(builtin_table[0]);
+
 
 
 void enable_raw_mode(struct termios *orig_termios) {
@@ -278,118 +282,122 @@ void disable_raw_mode(struct termios *orig_termios) {
     tcsetattr(STDIN_FILENO, TCSAFLUSH, orig_termios);
 }
 
-int main() {
-    char command[1024];
+// Publishes the cost of an interactive command line: CMD_DURATION (ms) for
+// the prompt and scripts, and a full report when it took at least
+// MYSHELL_REPORTTIME seconds.
+static void report_usage(const char *command, const CmdUsage *u) {
+    char ms[32];
+    last_duration = u->real;
+    snprintf(ms, sizeof(ms), "%.0f", u->real * 1e3);
+    setenv("CMD_DURATION", ms, 1);
+
+    const char *threshold = getenv("MYSHELL_REPORTTIME");
+    if (threshold && *threshold && u->real >= atof(threshold)) {
+        fflush(stdout);
+        fprintf(stderr, "\n%s\n", command);
+        usage_print(stderr, u);
+    }
+    stats_record(command, u, last_status);
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: myshell [-e] [-c command | script]\n");
+    exit(2);
+}
+
+// Scripts, -c and piped stdin: no terminal setup, prompt or history.
+static int run_noninteractive(const char *command, const char *script) {
+    job_control = 0;
+    builtins_init();
+    stats_init(0);
+    int status;
+    if (command) {
+        script_run_string(command);
+        status = last_status;
+    } else if (script) {
+        status = script_run_file(script);
+    } else {
+        script_run_fd(STDIN_FILENO);
+        status = last_status;
+    }
+    parse_cache_free();
+    arena_free(&line_arena);
+    return status;
+}
+
+int main(int argc, char **argv) {
+    const char *command = NULL, *script = NULL;
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-' && argv[i][1]; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        } else if (strcmp(argv[i], "-c") == 0) {
+            if (++i == argc) usage();
+            command = argv[i];
+        } else if (strcmp(argv[i], "-e") == 0) {
+            errexit = 1;
+        } else {
+            usage();
+        }
+    }
+    if (!command && i < argc)
+        script = argv[i];
+    if (command || script || !isatty(STDIN_FILENO))
+        return run_noninteractive(command, script);
+
     struct termios orig_termios;
     tcgetattr(STDIN_FILENO, &orig_termios);
+    history_init();
     system("clear");
+    // the shell hands the terminal to pipelines with tcsetpgrp and must be
+    // able to take it back while in the background process group
+    signal(SIGTTOU, SIG_IGN);
+    signal(SIGTTIN, SIG_IGN);
+    if (isatty(STDIN_FILENO)) {
+        // lead a process group of our own and own the terminal, so only
+        // the foreground job ever receives Ctrl-C / Ctrl-Z
+        setpgid(0, 0);
+        tcsetpgrp(STDIN_FILENO, getpgrp());
+    }
+    jobs_init();
+    builtins_init();
+    stats_init(1);
     while (1) {
         signal(SIGINT, sigint_handler);
         signal(SIGTSTP, sigtstp_handler);
-        show_prompt();
-        fflush(stdout);
+        jobs_notify();
+        render_prompt();
 
         enable_raw_mode(&orig_termios);
-
-        int pos = 0;
-        command[0] = '\0';
-        int c;
-
-        while ((c = getchar()) != '\n') {
-            if (c == 27) { 
-                char seq[3];
-                seq[0] = getchar(); 
-                seq[1] = getchar();
-                seq[2] = '\0';
-
-                if (seq[0] == '[') {
-                    if (seq[1] == 'A') { 
-                        int total = count_commands();
-                        if (total > 0) {
-                            if (current_history_index == -1)
-                                current_history_index = total - 1;
-                            else if (current_history_index > 0)
-                                current_history_index--;
-
-                            HistoryEntry last = last_command(current_history_index);
-                            if (last.command) {
-                                printf("\r\033[K"); 
-                                show_prompt();
-                                strcpy(command, last.command);
-                                printf("%s", command);
-                                fflush(stdout);
-                                pos = strlen(command);
-                                free(last.command);
-                            }
-                        }
-                    } 
-                    else if (seq[1] == 'B') {  
-                        int total = count_commands();
-                        if (total > 0 && current_history_index != -1) {
-                            if (current_history_index < total - 1)
-                                current_history_index++;
-                            else
-                                current_history_index = total - 1;
-
-                            HistoryEntry last = last_command(current_history_index);
-                            if (last.command) {
-                                printf("\r\033[K");
-                                show_prompt();
-                                strcpy(command, last.command);
-                                printf("%s", command);
-                                fflush(stdout);
-                                pos = strlen(command);
-                                free(last.command);
-                            }
-                        } else {
-                            printf("\r\033[K");
-                            show_prompt();
-                            fflush(stdout);
-                            pos = 0;
-                            command[0] = '\0';
-                            current_history_index = -1;
-                        }
-                    }
-                }
-            } 
-            else if (c == 127) { 
-                if (pos > 0) {
-                    pos--;
-                    command[pos] = '\0';
-                    printf("\b \b");
-                    fflush(stdout);
-                }
-            } 
-            else {
-                if (pos < (int)(sizeof(command) - 1)) {
-                    command[pos++] = c;
-                    command[pos] = '\0';
-                    putchar(c);
-                    fflush(stdout);
-                }
-                current_history_index = -1; 
-            }
-        }
-
+        char *command = read_command();
         disable_raw_mode(&orig_termios);
-        printf("\n");
+        if (!command)
+            break;
 
         if (strcmp(command, "") == 0)
             continue;
 
         add_to_history(command);
 
-        if (strcmp(command, "exit") == 0 || strcmp(command, "quit") == 0)
-            break;
-
         if (strcmp(command, "clear") == 0) {
             system("clear");
             continue;
         }
 
+        UsageMark mark;
+        CmdUsage usage;
+        usage_begin(&mark);
         commands_operator(command);
+        usage_end(&mark, &usage);
+        report_usage(command, &usage);
+        if (exit_requested)
+            break;
     }
 
-    free(history);
-    return 0;
+    history_search_free();
+    history_free();
+    parse_cache_free();
+    arena_free(&line_arena);
+    return last_status;
 }
\ No newline at end of file
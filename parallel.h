@@ -0,0 +1,511 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/pidfd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include "jobs.h"
+
+// ---------------- parallel -----------------
+//
+//   parallel [-j N] [-k] [-q] [--pin] [-0] cmd [args...] ::: arg...
+//   ... | parallel [-j N] [-k] [-q] [--pin] [-0] cmd [args...]
+//
+// Runs cmd once per arg, with {} in its words replaced by the arg, or the
+// arg appended when no word has {}. Without ::: the args are the lines
+// (NUL-terminated strings with -0) of stdin, like xargs -n1, and the tasks
+// get /dev/null as their stdin.
+//
+// There are N slots (default: one per online CPU, -j 0 for no limit). The
+// shell sleeps in a single poll on every running task's pidfd and output
+// pipes, and fills a slot as soon as its task exits. The shell is the only
+// spawner, so a free slot takes the next task in order and there is no
+// queue to steal from. --pin binds each slot to one CPU of the shell's
+// affinity mask. What a task wrote is collected from its pipes once it
+// exits; a background process it leaves behind does not hold the slot.
+//
+// A task's stdout and stderr go to pipes and are buffered until the task
+// ends, then written in one piece, so the output of different tasks never
+// interleaves. With -k the output comes in argument order: the oldest
+// unfinished task streams straight through and the others wait their
+// turn. Afterwards a line per task with its exit status, wall and CPU time
+// goes to stderr (-q leaves it out).
+//
+// Tasks stay in the shell's process group, so Ctrl-C reaches all of them.
+// The remaining tasks are then not started. The exit status is the number
+// of failed tasks (at most 101), or 130 after Ctrl-C.
+
+typedef struct {
+    char *data;
+    size_t len, cap;
+} ParBuf;
+
+typedef struct {
+    char **argv;
+    pid_t pid;
+    int pidfd;
+    int out_fd, err_fd;         // read ends, -1 once at EOF
+    int slot;
+    int exited;
+    int status;                 // wait status
+    int done;                   // exited and its pipes drained
+    struct timespec start, end;
+    struct rusage usage;
+    ParBuf out, err;
+} ParTask;
+
+typedef struct {
+    ParTask *tasks;
+    size_t ntasks;
+    size_t next_out;            // -k: the task whose output goes next
+    int keep_order;
+    int pin;
+    int stdin_null;
+    int *cpus;                  // --pin: CPU of each slot, by slot % ncpus
+    int ncpus;
+} Parallel;
+
+static void par_write_all(int fd, const char *s, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, s, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return;             // nowhere to report it; drop the output
+        }
+        s += n;
+        len -= (size_t)n;
+    }
+}
+
+static void par_buf_flush(ParBuf *b, int fd) {
+    par_write_all(fd, b->data, b->len);
+    b->len = 0;
+}
+
+// Reads what is available on *fd into b; closes *fd at EOF.
+static void par_buf_read(ParBuf *b, int *fd) {
+    if (b->cap - b->len < 4096) {
+        size_t cap = b->cap ? b->cap * 2 : 16384;
+        char *grown = realloc(b->data, cap);
+        if (!grown) {
+            perror("realloc failed");
+            exit(1);
+        }
+        b->data = grown;
+        b->cap = cap;
+    }
+    ssize_t n = read(*fd, b->data + b->len, b->cap - b->len);
+    if (n > 0) {
+        b->len += (size_t)n;
+    } else if (n == 0 || errno != EINTR) {
+        close(*fd);
+        *fd = -1;
+    }
+}
+
+// Reads the rest of what is in *fd without waiting for EOF, then closes it.
+static void par_buf_drain(ParBuf *b, int *fd) {
+    if (*fd < 0)
+        return;
+    fcntl(*fd, F_SETFL, O_NONBLOCK);
+    while (*fd >= 0)
+        par_buf_read(b, fd);    // EAGAIN closes it
+}
+
+// argv of one task: the template with {} replaced by arg, or arg appended.
+static char **par_argv(char **tmpl, int ntmpl, const char *arg) {
+    int has_slot = 0;
+    for (int i = 0; i < ntmpl; i++)
+        if (strstr(tmpl[i], "{}")) has_slot = 1;
+    char **argv = malloc((size_t)(ntmpl + 2) * sizeof(char *));
+    if (!argv) {
+        perror("malloc failed");
+        exit(1);
+    }
+    size_t alen = strlen(arg);
+    for (int i = 0; i < ntmpl; i++) {
+        const char *w = tmpl[i];
+        size_t slots = 0;
+        for (const char *p = strstr(w, "{}"); p; p = strstr(p + 2, "{}")) slots++;
+        char *s = malloc(strlen(w) + slots * alen + 1);
+        if (!s) {
+            perror("malloc failed");
+            exit(1);
+        }
+        char *o = s;
+        for (const char *p; (p = strstr(w, "{}")); w = p + 2) {
+            memcpy(o, w, (size_t)(p - w));
+            o += p - w;
+            memcpy(o, arg, alen);
+            o += alen;
+        }
+        strcpy(o, w);
+        argv[i] = s;
+    }
+    int n = ntmpl;
+    if (!has_slot) {
+        argv[n] = strdup(arg);
+        if (!argv[n]) {
+            perror("strdup failed");
+            exit(1);
+        }
+        n++;
+    }
+    argv[n] = NULL;
+    return argv;
+}
+
+// The args of xargs mode: every line (or NUL-terminated string) of stdin.
+// The strings point into *buf, which the caller frees.
+static char **par_read_args(char sep, size_t *count, char **buf) {
+    size_t cap = 65536, len = 0;
+    char *data = malloc(cap + 1);
+    if (!data) {
+        perror("malloc failed");
+        exit(1);
+    }
+    for (;;) {
+        if (len == cap) {
+            cap *= 2;
+            char *grown = realloc(data, cap + 1);
+            if (!grown) {
+                perror("realloc failed");
+                exit(1);
+            }
+            data = grown;
+        }
+        ssize_t n = read(STDIN_FILENO, data + len, cap - len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        len += (size_t)n;
+    }
+    data[len] = '\0';
+
+    size_t n = 0, acap = 64;
+    char **args = malloc(acap * sizeof(char *));
+    if (!args) {
+        perror("malloc failed");
+        exit(1);
+    }
+    for (char *p = data; p < data + len;) {
+        char *end = memchr(p, sep, (size_t)(data + len - p));
+        if (!end) end = data + len;
+        *end = '\0';
+        if (*p) {
+            if (n == acap) {
+                acap *= 2;
+                char **grown = realloc(args, acap * sizeof(char *));
+                if (!grown) {
+                    perror("realloc failed");
+                    exit(1);
+                }
+                args = grown;
+            }
+            args[n++] = p;
+        }
+        p = end + 1;
+    }
+    *count = n;
+    *buf = data;
+    return args;
+}
+
+static void par_launch(Parallel *par, ParTask *t, int slot) {
+    int out[2], err[2];
+    t->slot = slot;
+    t->pidfd = t->out_fd = t->err_fd = -1;
+    clock_gettime(CLOCK_MONOTONIC, &t->start);
+    int piped = pipe2(out, O_CLOEXEC) == 0;
+    if (piped && pipe2(err, O_CLOEXEC) != 0) {
+        close(out[0]);
+        close(out[1]);
+        piped = 0;
+    }
+    if (!piped) {
+        perror("parallel: pipe");
+        t->exited = t->done = 1;
+        t->status = W_EXITCODE(127, 0);
+        t->end = t->start;
+        return;
+    }
+
+    posix_spawn_file_actions_t fa;
+    posix_spawn_file_actions_init(&fa);
+    posix_spawn_file_actions_adddup2(&fa, out[1], STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&fa, err[1], STDERR_FILENO);
+    if (par->stdin_null)
+        posix_spawn_file_actions_addopen(&fa, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    posix_spawnattr_t attr;
+    init_spawnattr(&attr, -1);
+
+    // the child inherits the affinity of the thread that spawns it
+    cpu_set_t saved;
+    int pinned = 0;
+    if (par->pin && sched_getaffinity(0, sizeof(saved), &saved) == 0) {
+        cpu_set_t one;
+        CPU_ZERO(&one);
+        CPU_SET(par->cpus[slot % par->ncpus], &one);
+        pinned = sched_setaffinity(0, sizeof(one), &one) == 0;
+    }
+    t->pid = spawn_command_attr(t->argv, &fa, &attr);
+    if (pinned)
+        sched_setaffinity(0, sizeof(saved), &saved);
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&fa);
+    close(out[1]);
+    close(err[1]);
+
+    if (t->pid < 0) {
+        close(out[0]);
+        close(err[0]);
+        t->exited = t->done = 1;
+        t->status = W_EXITCODE(127, 0);
+        clock_gettime(CLOCK_MONOTONIC, &t->end);
+        return;
+    }
+    t->out_fd = out[0];
+    t->err_fd = err[0];
+    t->pidfd = pidfd_open(t->pid, 0);
+}
+
+// Collects the exit of t; blocking only matters without a pidfd.
+static void par_reap(ParTask *t, int block) {
+    if (t->pidfd >= 0) {
+        siginfo_t info;
+        info.si_pid = 0;
+        if (syscall(SYS_waitid, P_PIDFD, t->pidfd, &info, WEXITED | (block ? 0 : WNOHANG), &t->usage) != 0
+            || info.si_pid == 0)
+            return;
+        t->status = info.si_code == CLD_EXITED ? W_EXITCODE(info.si_status, 0)
+                                               : W_EXITCODE(0, info.si_status);
+        close(t->pidfd);
+        t->pidfd = -1;
+    } else if (wait4(t->pid, &t->status, block ? 0 : WNOHANG, &t->usage) <= 0) {
+        return;
+    }
+    t->exited = 1;
+    clock_gettime(CLOCK_MONOTONIC, &t->end);
+}
+
+// Writes out whatever output may go now.
+static void par_flush(Parallel *par) {
+    if (!par->keep_order)
+        return;
+    while (par->next_out < par->ntasks) {
+        ParTask *t = &par->tasks[par->next_out];
+        if (!t->argv) break;    // not started yet
+        par_buf_flush(&t->out, STDOUT_FILENO);
+        par_buf_flush(&t->err, STDERR_FILENO);
+        if (!t->done) break;
+        free(t->out.data);
+        free(t->err.data);
+        t->out = t->err = (ParBuf){0};
+        par->next_out++;
+    }
+}
+
+static void par_finish(Parallel *par, ParTask *t) {
+    t->done = 1;
+    if (par->keep_order)
+        return;                 // par_flush writes and frees it in turn
+    par_buf_flush(&t->out, STDOUT_FILENO);
+    par_buf_flush(&t->err, STDERR_FILENO);
+    free(t->out.data);
+    free(t->err.data);
+    t->out = t->err = (ParBuf){0};
+}
+
+static double par_seconds(struct timespec a, struct timespec b) {
+    return (double)(b.tv_sec - a.tv_sec) + (b.tv_nsec - a.tv_nsec) / 1e9;
+}
+
+static void par_summary(const Parallel *par, size_t started, int jobs, struct timespec t0) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    size_t failed = 0;
+    double cpu = 0;
+    fprintf(stderr, "%6s %5s %10s %10s  %s\n", "task", "exit", "wall", "cpu", "command");
+    for (size_t i = 0; i < started; i++) {
+        const ParTask *t = &par->tasks[i];
+        double c = tv_seconds(t->usage.ru_utime) + tv_seconds(t->usage.ru_stime);
+        int code = status_to_code(t->status);
+        cpu += c;
+        failed += code != 0;
+        fprintf(stderr, "%6zu %5d %9.3fs %9.3fs ", i + 1, code, par_seconds(t->start, t->end), c);
+        for (char **a = t->argv; *a; a++)
+            fprintf(stderr, " %s", *a);
+        fputc('\n', stderr);
+    }
+    fprintf(stderr, "%zu tasks, %zu failed, -j %d: %.3fs wall, %.3fs cpu\n",
+            started, failed, jobs, par_seconds(t0, now), cpu);
+}
+
+static int par_usage(void) {
+    fprintf(stderr, "usage: parallel [-j N] [-k] [-q] [--pin] [-0] cmd [args...] [::: arg...]\n");
+    return 2;
+}
+
+int parallel_commands(char **args) {
+    Parallel par = {0};
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    int quiet = 0;
+    char sep = '\n';
+    int i = 1;
+    for (; args[i] && args[i][0] == '-'; i++) {
+        if (strcmp(args[i], "-j") == 0 && args[i + 1]) {
+            jobs = atol(args[++i]);
+        } else if (strncmp(args[i], "-j", 2) == 0 && args[i][2]) {
+            jobs = atol(args[i] + 2);
+        } else if (strcmp(args[i], "-k") == 0) {
+            par.keep_order = 1;
+        } else if (strcmp(args[i], "-q") == 0) {
+            quiet = 1;
+        } else if (strcmp(args[i], "--pin") == 0) {
+            par.pin = 1;
+        } else if (strcmp(args[i], "-0") == 0) {
+            sep = '\0';
+        } else if (strcmp(args[i], "--") == 0) {
+            i++;
+            break;
+        } else {
+            return par_usage();
+        }
+    }
+    char **tmpl = &args[i];
+    int ntmpl = 0;
+    while (tmpl[ntmpl] && strcmp(tmpl[ntmpl], ":::") != 0) ntmpl++;
+    if (ntmpl == 0 || jobs < 0)
+        return par_usage();
+
+    char **targs, *stdin_buf = NULL;
+    size_t nargs;
+    if (tmpl[ntmpl]) {
+        targs = &tmpl[ntmpl + 1];
+        for (nargs = 0; targs[nargs]; nargs++) {}
+    } else {
+        targs = par_read_args(sep, &nargs, &stdin_buf);
+        par.stdin_null = 1;
+    }
+    if (jobs == 0 || (size_t)jobs > nargs)
+        jobs = nargs ? (long)nargs : 1;
+
+    if (par.pin) {
+        cpu_set_t set;
+        if (sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_COUNT(&set) > 0) {
+            par.cpus = malloc((size_t)CPU_COUNT(&set) * sizeof(int));
+            if (!par.cpus) {
+                perror("malloc failed");
+                exit(1);
+            }
+            for (int c = 0; c < CPU_SETSIZE; c++)
+                if (CPU_ISSET(c, &set)) par.cpus[par.ncpus++] = c;
+        } else {
+            par.pin = 0;
+        }
+    }
+
+    par.ntasks = nargs;
+    par.tasks = calloc(nargs ? nargs : 1, sizeof(ParTask));
+    ParTask **slots = calloc((size_t)jobs, sizeof(ParTask *));
+    struct pollfd *fds = malloc((size_t)jobs * 3 * sizeof(struct pollfd));
+    ParTask **owners = malloc((size_t)jobs * 3 * sizeof(ParTask *));
+    if (!par.tasks || !slots || !fds || !owners) {
+        perror("malloc failed");
+        exit(1);
+    }
+
+    fflush(stdout);
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    sigint_flag = 0;
+    size_t next = 0;
+    int running = 0, interrupted = 0;
+    for (;;) {
+        for (int s = 0; s < jobs && next < nargs && !interrupted; s++) {
+            if (slots[s]) continue;
+            ParTask *t = &par.tasks[next];
+            t->argv = par_argv(tmpl, ntmpl, targs[next]);
+            next++;
+            par_launch(&par, t, s);
+            if (t->done) {
+                par_finish(&par, t);
+                s--;            // the slot is still free
+                continue;
+            }
+            slots[s] = t;
+            running++;
+        }
+        par_flush(&par);
+        if (running == 0)
+            break;
+
+        nfds_t n = 0;
+        for (int s = 0; s < jobs; s++) {
+            ParTask *t = slots[s];
+            if (!t) continue;
+            if (t->out_fd >= 0) { fds[n] = (struct pollfd){t->out_fd, POLLIN, 0}; owners[n++] = t; }
+            if (t->err_fd >= 0) { fds[n] = (struct pollfd){t->err_fd, POLLIN, 0}; owners[n++] = t; }
+            if (!t->exited && t->pidfd >= 0) { fds[n] = (struct pollfd){t->pidfd, POLLIN, 0}; owners[n++] = t; }
+        }
+        if (n > 0 && poll(fds, n, -1) < 0) {
+            if (errno == EINTR && sigint_flag)
+                interrupted = 1;
+            continue;
+        }
+        for (nfds_t k = 0; k < n; k++) {
+            if (!fds[k].revents) continue;
+            ParTask *t = owners[k];
+            if (fds[k].fd == t->out_fd) par_buf_read(&t->out, &t->out_fd);
+            else if (fds[k].fd == t->err_fd) par_buf_read(&t->err, &t->err_fd);
+            else par_reap(t, 0);
+        }
+        for (int s = 0; s < jobs; s++) {
+            ParTask *t = slots[s];
+            if (!t) continue;
+            if (!t->exited)
+                par_reap(t, t->pidfd < 0 && t->out_fd < 0 && t->err_fd < 0);
+            if (!t->exited) continue;
+            // all the task wrote is in its pipes by now; a background
+            // process it left holding them must not keep the slot
+            par_buf_drain(&t->out, &t->out_fd);
+            par_buf_drain(&t->err, &t->err_fd);
+            par_finish(&par, t);
+            slots[s] = NULL;
+            running--;
+        }
+    }
+
+    if (!quiet)
+        par_summary(&par, next, (int)jobs, t0);
+    size_t failed = 0;
+    for (size_t k = 0; k < next; k++) {
+        failed += status_to_code(par.tasks[k].status) != 0;
+        for (char **a = par.tasks[k].argv; *a; a++) free(*a);
+        free(par.tasks[k].argv);
+    }
+    free(par.tasks);
+    free(slots);
+    free(fds);
+    free(owners);
+    free(par.cpus);
+    if (stdin_buf) {
+        free(targs);
+        free(stdin_buf);
+    }
+    if (interrupted || sigint_flag)
+        return 130;
+    return failed > 101 ? 101 : (int)failed;
+}
+
+#endif
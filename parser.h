@@ -0,0 +1,558 @@
+#ifndef PARSER_H
+#define PARSER_H
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "builtins.h"
+#include "lexer.h"
+
+// ---------------- Parse Tree -----------------
+//
+//   list      := and_or ((';' | '&' | newline) and_or)* [';' | '&']
+//   and_or    := pipeline (('&&' | '||') newline* pipeline)*
+//   pipeline  := ['time'] command ('|' newline* command)*
+//   command   := '(' list ')' redirect*
+//              | (NAME=value)* (word | redirect)+
+//
+// A tree is built once per distinct line and never changed while it runs:
+// words point into the entry's copy of the line, builtins are resolved to
+// their table entry and each pipeline already has the PipeStage array
+// Pipe_commands takes. Everything else a run needs comes from line_arena.
+// Words with $ or ` are the exception: they are kept as typed, quotes and
+// all, and flagged, and expand.h turns them into words on every run.
+
+typedef enum {
+    NODE_COMMAND,
+    NODE_SUBSHELL,
+    NODE_PIPELINE,
+    NODE_AND,
+    NODE_OR,
+    NODE_LIST,
+} NodeType;
+
+typedef struct {
+    char *name;
+    char *value;
+    int expand;             // value is as typed and expands at run time
+} Assign;
+
+typedef struct Node Node;
+
+typedef struct {
+    Node *node;
+    int background;         // ended by '&'
+    const char *cmdline;    // as typed, for the job table
+} ListItem;
+
+struct Node {
+    NodeType type;
+    union {
+        struct {                    // NODE_COMMAND
+            int argc;
+            char **argv;
+            int nassigns;
+            Assign *assigns;
+            Redirect *redirs;
+            const Builtin *builtin;
+            unsigned char *expand;  // per word: kept as typed, expanded at
+                                    // run time (NULL if no word is)
+            int dynamic;            // a word, value or redirection expands
+        } cmd;
+        struct {                    // NODE_SUBSHELL
+            Node *body;
+            Redirect *redirs;
+        } sub;
+        struct {                    // NODE_PIPELINE
+            int n;
+            Node **nodes;
+            PipeStage *stages;
+            const char *cmdline;
+            int timed;              // prefixed by the `time` keyword
+            int dynamic;            // some stage's argv or redirection expands
+        } pipe;
+        struct {                    // NODE_AND, NODE_OR
+            Node *left, *right;
+        } bin;
+        struct {                    // NODE_LIST
+            int n;
+            ListItem *items;
+        } list;
+    };
+};
+
+typedef struct {
+    Token *t;
+    size_t i;
+    Arena *arena;           // the tree's own arena
+    const char *line;       // the line as typed
+} Parser;
+
+// Growable array in malloc'd memory, copied into the arena once complete
+// (the arena is busy with nested nodes while an array is being filled).
+typedef struct {
+    void **items;
+    size_t n, cap;
+} PtrVec;
+
+static void ptrvec_push(PtrVec *v, void *item) {
+    if (v->n == v->cap) {
+        size_t cap = v->cap ? v->cap * 2 : 8;
+        void **items = realloc(v->items, cap * sizeof(void *));
+        if (!items) {
+            perror("realloc failed");
+            exit(1);
+        }
+        v->items = items;
+        v->cap = cap;
+    }
+    v->items[v->n++] = item;
+}
+
+static Node *parse_node(Parser *p, NodeType type) {
+    Node *n = arena_alloc(p->arena, sizeof(Node));
+    memset(n, 0, sizeof(*n));
+    n->type = type;
+    return n;
+}
+
+static char *parse_span(Parser *p, size_t start, size_t end) {
+    char *s = arena_alloc(p->arena, end - start + 1);
+    memcpy(s, p->line + start, end - start);
+    s[end - start] = '\0';
+    return s;
+}
+
+static Node *parse_error(Parser *p) {
+    static const char *names[] = {
+        [TOK_PIPE] = "|", [TOK_OR] = "||", [TOK_AND] = "&&", [TOK_SEMI] = ";", [TOK_NEWLINE] = "newline",
+        [TOK_AMP] = "&", [TOK_LPAREN] = "(", [TOK_RPAREN] = ")", [TOK_LESS] = "<",
+        [TOK_GREAT] = ">", [TOK_DGREAT] = ">>", [TOK_LESSGREAT] = "<>", [TOK_GREATAND] = ">&",
+        [TOK_LESSAND] = "<&", [TOK_ANDGREAT] = "&>", [TOK_ANDDGREAT] = "&>>", [TOK_DLESS] = "<<",
+        [TOK_DLESSDASH] = "<<-", [TOK_TLESS] = "<<<", [TOK_END] = "newline",
+    };
+    const Token *t = &p->t[p->i];
+    fprintf(stderr, "myshell: syntax error near '%s'\n",
+            t->type == TOK_WORD ? t->text : names[t->type]);
+    return NULL;
+}
+
+static inline int parse_is_redirect(TokenType type) {
+    return type >= TOK_LESS && type <= TOK_TLESS;
+}
+
+static Redirect *parse_add_redirect(Parser *p, Redirect ***tail, int fd, RedirKind kind) {
+    Redirect *r = arena_alloc(p->arena, sizeof(Redirect));
+    memset(r, 0, sizeof(*r));
+    r->fd = fd;
+    r->kind = kind;
+    **tail = r;
+    *tail = &r->next;
+    return r;
+}
+
+static void parse_redirect_path(Parser *p, Redirect *r, const Token *word) {
+    r->expand = word->expand;
+    r->path = word->expand ? parse_span(p, word->start, word->end) : word->text;
+}
+
+// A redirection operator and its word (a file name, an fd, a here-string
+// or a here-document's delimiter), appended at *tail. &>f becomes >f 2>&1.
+static int parse_redirect(Parser *p, Redirect ***tail) {
+    const Token *op = &p->t[p->i];
+    if (p->t[p->i + 1].type != TOK_WORD) {
+        p->i++;
+        parse_error(p);
+        return -1;
+    }
+    const Token *word = &p->t[p->i + 1];
+    int in = op->type == TOK_LESS || op->type == TOK_LESSGREAT || op->type == TOK_LESSAND ||
+             op->type >= TOK_DLESS;
+    int fd = op->fd >= 0 ? op->fd : in ? STDIN_FILENO : STDOUT_FILENO;
+    TokenType type = op->type;
+    Redirect *r;
+
+    if (type == TOK_GREATAND || type == TOK_LESSAND) {
+        char *end;
+        long src = strtol(word->text, &end, 10);
+        if (strcmp(word->text, "-") == 0) {
+            parse_add_redirect(p, tail, fd, REDIR_CLOSE);
+        } else if (*word->text && !*end && src >= 0 && src <= INT_MAX) {
+            r = parse_add_redirect(p, tail, fd, REDIR_DUP);
+            r->src = (int)src;
+        } else if (type == TOK_GREATAND && op->fd < 0) {
+            type = TOK_ANDGREAT;        // >&file, as in bash
+        } else {
+            fprintf(stderr, "myshell: %s: ambiguous redirect\n", word->text);
+            return -1;
+        }
+    }
+
+    switch (type) {
+    case TOK_DLESS:
+    case TOK_DLESSDASH:
+        // with the delimiter unquoted, $ and ` in the body expand
+        r = parse_add_redirect(p, tail, fd, REDIR_DATA);
+        r->path = op->text;
+        r->len = op->len;
+        r->expand = !word->quoted && strpbrk(op->text, "$`\\") ? 2 : 0;
+        break;
+    case TOK_TLESS: {
+        // the newline after the word stays literal when it is expanded
+        const char *text = word->expand ? parse_span(p, word->start, word->end) : word->text;
+        size_t len = strlen(text);
+        char *data = arena_alloc(p->arena, len + 2);
+        memcpy(data, text, len);
+        data[len] = '\n';
+        data[len + 1] = '\0';
+        r = parse_add_redirect(p, tail, fd, REDIR_DATA);
+        r->path = data;
+        r->len = len + 1;
+        r->expand = word->expand;
+        break;
+    }
+    case TOK_ANDGREAT:
+    case TOK_ANDDGREAT:
+        r = parse_add_redirect(p, tail, STDOUT_FILENO, REDIR_OPEN);
+        r->flags = O_WRONLY | O_CREAT | (type == TOK_ANDGREAT ? O_TRUNC : O_APPEND);
+        parse_redirect_path(p, r, word);
+        r = parse_add_redirect(p, tail, STDERR_FILENO, REDIR_DUP);
+        r->src = STDOUT_FILENO;
+        break;
+    case TOK_GREATAND:
+    case TOK_LESSAND:
+        break;
+    default:
+        r = parse_add_redirect(p, tail, fd, REDIR_OPEN);
+        r->flags = type == TOK_LESS      ? O_RDONLY
+                 : type == TOK_LESSGREAT ? O_RDWR | O_CREAT
+                 : type == TOK_GREAT     ? O_WRONLY | O_CREAT | O_TRUNC
+                                         : O_WRONLY | O_CREAT | O_APPEND;
+        parse_redirect_path(p, r, word);
+        break;
+    }
+    p->i += 2;
+    return 0;
+}
+
+static void parse_skip_newlines(Parser *p) {
+    while (p->t[p->i].type == TOK_NEWLINE)
+        p->i++;
+}
+
+static Node *parse_list(Parser *p, TokenType close);
+
+static Node *parse_command(Parser *p) {
+    if (p->t[p->i].type == TOK_LPAREN) {
+        p->i++;
+        Node *body = parse_list(p, TOK_RPAREN);
+        if (!body) return NULL;
+        if (p->t[p->i].type != TOK_RPAREN) return parse_error(p);
+        p->i++;
+        Node *n = parse_node(p, NODE_SUBSHELL);
+        n->sub.body = body;
+        Redirect **tail = &n->sub.redirs;
+        while (parse_is_redirect(p->t[p->i].type))
+            if (parse_redirect(p, &tail) < 0) return NULL;
+        if (p->t[p->i].type == TOK_WORD || p->t[p->i].type == TOK_LPAREN)
+            return parse_error(p);
+        return n;
+    }
+
+    Node *n = parse_node(p, NODE_COMMAND);
+    Redirect **tail = &n->cmd.redirs;
+    size_t first = p->i, words = 0, assigns = 0;
+    for (size_t i = first; p->t[i].type == TOK_WORD || parse_is_redirect(p->t[i].type); i++) {
+        if (p->t[i].type != TOK_WORD) {
+            if (p->t[i + 1].type == TOK_WORD) i++;      // skip the file name
+        }
+        else if (p->t[i].assign && words == 0) assigns++;
+        else words++;
+    }
+    n->cmd.argv = arena_alloc(p->arena, (words + 1) * sizeof(char *));
+    n->cmd.assigns = assigns ? arena_alloc(p->arena, assigns * sizeof(Assign)) : NULL;
+
+    for (;;) {
+        Token *t = &p->t[p->i];
+        if (parse_is_redirect(t->type)) {
+            if (parse_redirect(p, &tail) < 0) return NULL;
+            continue;
+        }
+        if (t->type != TOK_WORD)
+            break;
+        char *text = t->expand ? parse_span(p, t->start, t->end) : t->text;
+        if (t->assign && n->cmd.argc == 0) {
+            // split NAME=value in place; the tree owns this copy of the line
+            char *eq = strchr(text, '=');
+            *eq = '\0';
+            n->cmd.assigns[n->cmd.nassigns++] = (Assign){text, eq + 1, t->expand};
+        } else {
+            if (t->expand && !n->cmd.expand) {
+                n->cmd.expand = arena_alloc(p->arena, words);
+                memset(n->cmd.expand, 0, words);
+            }
+            if (t->expand)
+                n->cmd.expand[n->cmd.argc] = 1;
+            n->cmd.argv[n->cmd.argc++] = text;
+        }
+        n->cmd.dynamic |= t->expand;
+        p->i++;
+    }
+    n->cmd.argv[n->cmd.argc] = NULL;
+    if (p->i == first)
+        return parse_error(p);
+    if (p->t[p->i].type == TOK_LPAREN)
+        return parse_error(p);
+    for (const Redirect *r = n->cmd.redirs; r; r = r->next)
+        n->cmd.dynamic |= r->expand != 0;
+    // a command name that expands is looked up when it has been expanded
+    if (n->cmd.argc > 0 && !(n->cmd.expand && n->cmd.expand[0]))
+        n->cmd.builtin = builtin_lookup(n->cmd.argv[0]);
+    return n;
+}
+
+static Node *parse_pipeline(Parser *p) {
+    size_t start = p->t[p->i].start;
+    PtrVec stages = {0};
+    // `time` is a keyword only unquoted and in front of a command
+    const Token *t = &p->t[p->i];
+    TokenType next = t[t->type != TOK_END].type;
+    int timed = t->type == TOK_WORD && !t->quoted && strcmp(t->text, "time") == 0 &&
+                (next == TOK_WORD || next == TOK_LPAREN || parse_is_redirect(next));
+    if (timed)
+        p->i++;
+    for (;;) {
+        Node *c = parse_command(p);
+        if (!c) {
+            free(stages.items);
+            return NULL;
+        }
+        ptrvec_push(&stages, c);
+        if (p->t[p->i].type != TOK_PIPE)
+            break;
+        p->i++;
+        parse_skip_newlines(p);
+    }
+
+    Node *n = parse_node(p, NODE_PIPELINE);
+    n->pipe.n = (int)stages.n;
+    n->pipe.timed = timed;
+    n->pipe.nodes = arena_alloc(p->arena, stages.n * sizeof(Node *));
+    n->pipe.stages = arena_alloc(p->arena, stages.n * sizeof(PipeStage));
+    for (size_t i = 0; i < stages.n; i++) {
+        Node *c = stages.items[i];
+        PipeStage *s = &n->pipe.stages[i];
+        n->pipe.nodes[i] = c;
+        if (c->type == NODE_SUBSHELL) {
+            *s = (PipeStage){NULL, c->sub.redirs, c->sub.body, 0};
+            for (const Redirect *r = c->sub.redirs; r; r = r->next)
+                n->pipe.dynamic |= r->expand != 0;
+        } else if (c->cmd.nassigns > 0 || c->cmd.argc == 0 || c->cmd.builtin) {
+            // NAME=value belongs to this stage alone and a builtin has to
+            // run alongside the other stages: run it in a fork, or in the
+            // shell when the builtin cannot change the shell's state
+            *s = (PipeStage){NULL, NULL, c, c->cmd.nassigns == 0 && c->cmd.builtin && c->cmd.builtin->pure};
+        } else {
+            *s = (PipeStage){c->cmd.argv, c->cmd.redirs, NULL, 0};
+            n->pipe.dynamic |= c->cmd.dynamic;
+        }
+    }
+    n->pipe.cmdline = parse_span(p, start, p->t[p->i - 1].end);
+    free(stages.items);
+    return n;
+}
+
+static Node *parse_and_or(Parser *p) {
+    Node *left = parse_pipeline(p);
+    while (left && (p->t[p->i].type == TOK_AND || p->t[p->i].type == TOK_OR)) {
+        Node *n = parse_node(p, p->t[p->i].type == TOK_AND ? NODE_AND : NODE_OR);
+        p->i++;
+        parse_skip_newlines(p);
+        n->bin.left = left;
+        n->bin.right = parse_pipeline(p);
+        left = n->bin.right ? n : NULL;
+    }
+    return left;
+}
+
+// Parses and_or lists up to (not including) the token close.
+static Node *parse_list(Parser *p, TokenType close) {
+    ListItem *items = NULL;
+    size_t count = 0, cap = 0;
+    Node *n = NULL;
+
+    for (;;) {
+        parse_skip_newlines(p);
+        if (p->t[p->i].type == close && (close != TOK_RPAREN || count > 0))
+            break;
+        size_t start = p->t[p->i].start;
+        Node *item = parse_and_or(p);
+        if (!item) goto out;
+        if (count == cap) {
+            cap = cap ? cap * 2 : 8;
+            ListItem *grown = realloc(items, cap * sizeof(ListItem));
+            if (!grown) {
+                perror("realloc failed");
+                exit(1);
+            }
+            items = grown;
+        }
+        int background = p->t[p->i].type == TOK_AMP;
+        items[count++] = (ListItem){item, background, parse_span(p, start, p->t[p->i - 1].end)};
+        if (p->t[p->i].type == TOK_SEMI || p->t[p->i].type == TOK_NEWLINE || background)
+            p->i++;
+        else if (p->t[p->i].type != close) {
+            parse_error(p);
+            goto out;
+        }
+    }
+
+    n = parse_node(p, NODE_LIST);
+    n->list.n = (int)count;
+    n->list.items = arena_alloc(p->arena, (count ? count : 1) * sizeof(ListItem));
+    if (count)
+        memcpy(n->list.items, items, count * sizeof(ListItem));
+out:
+    free(items);
+    return n;
+}
+
+// ---------------- Parse Cache -----------------
+//
+// Compiled lines are kept in an LRU cache keyed by a hash of the line, so
+// a line run again (recalled from history, or typed in a loop) goes
+// straight to execution. Each entry owns a copy of the line and an arena
+// holding the tokens' text and the tree. Entries in use are never evicted.
+
+#define PARSE_CACHE_SIZE 64
+#define PARSE_CACHE_BUCKETS 128     // power of two
+#define PARSE_ARENA_BLOCK 1024
+
+typedef struct ParseEntry {
+    uint64_t hash;
+    char *line;
+    size_t len;
+    Arena arena;
+    Node *root;
+    int refs;
+    struct ParseEntry *hash_next;
+    struct ParseEntry *lru_prev, *lru_next;     // lru_prev is more recent
+} ParseEntry;
+
+static ParseEntry *parse_buckets[PARSE_CACHE_BUCKETS];
+static ParseEntry *parse_lru_first, *parse_lru_last;
+static int parse_cache_count;
+
+static inline uint64_t parse_hash(const char *s, size_t len) {
+    uint64_t h = 14695981039346656037ull;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+static void parse_lru_unlink(ParseEntry *e) {
+    if (e->lru_prev) e->lru_prev->lru_next = e->lru_next;
+    else parse_lru_first = e->lru_next;
+    if (e->lru_next) e->lru_next->lru_prev = e->lru_prev;
+    else parse_lru_last = e->lru_prev;
+}
+
+static void parse_lru_push(ParseEntry *e) {
+    e->lru_prev = NULL;
+    e->lru_next = parse_lru_first;
+    if (parse_lru_first) parse_lru_first->lru_prev = e;
+    else parse_lru_last = e;
+    parse_lru_first = e;
+}
+
+static void parse_entry_free(ParseEntry *e) {
+    arena_free(&e->arena);
+    free(e->line);
+    free(e);
+}
+
+static void parse_cache_evict(void) {
+    ParseEntry *e = parse_lru_last;
+    while (e && e->refs > 0)
+        e = e->lru_prev;
+    if (!e) return;
+    ParseEntry **pp = &parse_buckets[e->hash & (PARSE_CACHE_BUCKETS - 1)];
+    while (*pp != e)
+        pp = &(*pp)->hash_next;
+    *pp = e->hash_next;
+    parse_lru_unlink(e);
+    parse_entry_free(e);
+    parse_cache_count--;
+}
+
+// Returns the compiled tree of line, from the cache or freshly parsed, or
+// NULL after printing a syntax error. scratch holds the tokens only. The
+// entry stays valid until parse_release.
+static ParseEntry *parse_cached(const char *line, Arena *scratch) {
+    size_t len = strlen(line);
+    uint64_t h = parse_hash(line, len);
+    ParseEntry **bucket = &parse_buckets[h & (PARSE_CACHE_BUCKETS - 1)];
+    for (ParseEntry *e = *bucket; e; e = e->hash_next) {
+        if (e->hash == h && e->len == len && memcmp(e->line, line, len) == 0) {
+            parse_lru_unlink(e);
+            parse_lru_push(e);
+            e->refs++;
+            return e;
+        }
+    }
+
+    ParseEntry *e = calloc(1, sizeof(ParseEntry));
+    if (!e || !(e->line = malloc(len + 1))) {
+        perror("malloc failed");
+        exit(1);
+    }
+    memcpy(e->line, line, len + 1);
+    e->len = len;
+    e->hash = h;
+    e->arena.block_min = PARSE_ARENA_BLOCK;
+
+    // the lexer cuts words out of its input; e->line stays as typed
+    char *buf = arena_alloc(&e->arena, len + 1);
+    memcpy(buf, line, len + 1);
+    LexResult lex = lex_line(scratch, buf);
+    if (lex.status == LEX_INCOMPLETE) {
+        fprintf(stderr, "myshell: unexpected end of line (unterminated quote, substitution or here-document)\n");
+        parse_entry_free(e);
+        return NULL;
+    }
+    Parser p = {lex.tokens, 0, &e->arena, e->line};
+    e->root = parse_list(&p, TOK_END);
+    if (!e->root) {
+        parse_entry_free(e);
+        return NULL;
+    }
+
+    if (parse_cache_count >= PARSE_CACHE_SIZE)
+        parse_cache_evict();
+    e->hash_next = *bucket;
+    *bucket = e;
+    parse_lru_push(e);
+    parse_cache_count++;
+    e->refs = 1;
+    return e;
+}
+
+static void parse_release(ParseEntry *e) {
+    e->refs--;
+}
+
+static void parse_cache_free(void) {
+    while (parse_lru_first) {
+        ParseEntry *e = parse_lru_first;
+        parse_lru_unlink(e);
+        parse_entry_free(e);
+    }
+    memset(parse_buckets, 0, sizeof(parse_buckets));
+    parse_cache_count = 0;
+}
+
+#endif
@@ -1,20 +1,132 @@
+#ifndef PROMT_H
+#define PROMT_H
+
 #include <pwd.h>
 #include <limits.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <sys/stat.h>
 #include <bits/local_lim.h>
 
-void show_prompt() {
-    char *user = getenv("USER");
-    if (!user) user = getpwuid(getuid())->pw_name;
+// ---------------- Prompt -----------------
+//
+// The prompt is built from $MYSHELL_PROMPT (default "%u@%h %w > "):
+//   %u user      %h host      %w compacted cwd   %W cwd with ~
+//   %g " (branch)" when inside a git work tree
+//   %v "(venv) " when a virtual environment is active
+//   %? " [status]" when the last command failed
+//   %d " 1.2s" when the last command took at least a second
+//   %% a literal %
+// Optional segments expand to nothing when they do not apply.
+//
+// Nothing here is looked up per prompt: user and host are read once, the
+// cwd segments are recomputed only after cd_commands changes directory,
+// and the git branch is re-read only when .git/HEAD changes (one stat).
+// Redrawing the current line reuses the rendered string as is.
+
+#define PROMPT_DEFAULT_FORMAT "%u@%h %w > "
+
+int prompt_cwd_dirty = 1;      // set by cd_commands
+double last_duration = 0;      // seconds taken by the last command line
+
+static char prompt_user[LOGIN_NAME_MAX + 1];
+static char prompt_host[HOST_NAME_MAX + 1];
+static char prompt_display_path[PATH_MAX];
+static char prompt_compact_path[PATH_MAX];
+static char prompt_git_head[2 * PATH_MAX + 16];  // path of HEAD, "" outside a repo
+static char prompt_git_branch[256];
+static struct timespec prompt_git_mtime;
+static ino_t prompt_git_ino;
+static char prompt_buf[2 * PATH_MAX];
+
+static void prompt_load_identity(void) {
+    const char *user = getenv("USER");
+    if (!user) {
+        struct passwd *pw = getpwuid(getuid());
+        user = pw ? pw->pw_name : "user";
+    }
+    snprintf(prompt_user, sizeof(prompt_user), "%s", user);
+
+    if (gethostname(prompt_host, sizeof(prompt_host)) != 0)
+        strcpy(prompt_host, "localhost");
+    prompt_host[sizeof(prompt_host) - 1] = '\0';
+}
+
+// Finds the HEAD file of the git repository containing cwd, if any.
+static void prompt_find_git(const char *cwd) {
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s", cwd);
+    prompt_git_head[0] = '\0';
+    prompt_git_branch[0] = '\0';
+    prompt_git_ino = 0;
+
+    for (;;) {
+        char dotgit[PATH_MAX + 8];
+        snprintf(dotgit, sizeof(dotgit), "%s/.git", strcmp(dir, "/") == 0 ? "" : dir);
+        struct stat st;
+        if (stat(dotgit, &st) == 0) {
+            if (S_ISDIR(st.st_mode)) {
+                snprintf(prompt_git_head, sizeof(prompt_git_head), "%s/HEAD", dotgit);
+            } else {
+                // worktrees and submodules: ".git" holds "gitdir: <path>"
+                char buf[PATH_MAX];
+                FILE *f = fopen(dotgit, "r");
+                if (f && fgets(buf, sizeof(buf), f) && strncmp(buf, "gitdir: ", 8) == 0) {
+                    buf[strcspn(buf, "\n")] = '\0';
+                    if (buf[8] == '/')
+                        snprintf(prompt_git_head, sizeof(prompt_git_head), "%s/HEAD", buf + 8);
+                    else
+                        snprintf(prompt_git_head, sizeof(prompt_git_head), "%s/%s/HEAD",
+                                 strcmp(dir, "/") == 0 ? "" : dir, buf + 8);
+                }
+                if (f) fclose(f);
+            }
+            return;
+        }
+        char *slash = strrchr(dir, '/');
+        if (!slash || slash == dir) {
+            if (strcmp(dir, "/") == 0) return;
+            strcpy(dir, "/");
+            continue;
+        }
+        *slash = '\0';
+    }
+}
+
+static void prompt_refresh_git(void) {
+    if (!prompt_git_head[0])
+        return;
+    struct stat st;
+    if (stat(prompt_git_head, &st) != 0) {
+        prompt_git_branch[0] = '\0';
+        return;
+    }
+    if (st.st_ino == prompt_git_ino &&
+        st.st_mtim.tv_sec == prompt_git_mtime.tv_sec &&
+        st.st_mtim.tv_nsec == prompt_git_mtime.tv_nsec)
+        return;
+    prompt_git_ino = st.st_ino;
+    prompt_git_mtime = st.st_mtim;
 
-    char hostname[HOST_NAME_MAX + 1];
-    if (gethostname(hostname, sizeof(hostname)) != 0) {
-        strcpy(hostname, "localhost");
+    char buf[512];
+    prompt_git_branch[0] = '\0';
+    FILE *f = fopen(prompt_git_head, "r");
+    if (!f) return;
+    if (fgets(buf, sizeof(buf), f)) {
+        buf[strcspn(buf, "\n")] = '\0';
+        if (strncmp(buf, "ref: refs/heads/", 16) == 0)
+            snprintf(prompt_git_branch, sizeof(prompt_git_branch), "%.*s",
+                     (int)sizeof(prompt_git_branch) - 1, buf + 16);
+        else
+            snprintf(prompt_git_branch, sizeof(prompt_git_branch), "%.7s", buf);  // detached
     }
+    fclose(f);
+}
 
+static void prompt_refresh_cwd(void) {
     char *cwd = getcwd(NULL, 0);
     if (!cwd) {
         perror("getcwd");
@@ -22,35 +134,98 @@ void show_prompt() {
     }
 
     char *home = getenv("HOME");
-    char display_path[PATH_MAX];
-    if (home && strncmp(cwd, home, strlen(home)) == 0) {
-        snprintf(display_path, sizeof(display_path), "~%s", cwd + strlen(home));
+    size_t hlen = home ? strlen(home) : 0;
+    if (hlen > 0 && strncmp(cwd, home, hlen) == 0 && (cwd[hlen] == '/' || cwd[hlen] == '\0')) {
+        snprintf(prompt_display_path, sizeof(prompt_display_path), "~%s", cwd + hlen);
     } else {
-        snprintf(display_path, sizeof(display_path), "%s", cwd);
+        snprintf(prompt_display_path, sizeof(prompt_display_path), "%s", cwd);
     }
-    char compact_path[PATH_MAX] = "";
-    if (display_path[0] != '~') {
-        char temp[PATH_MAX];
-        strncpy(temp, display_path, sizeof(temp));
-        temp[sizeof(temp) - 1] = '\0';
 
-        char *token = strtok(temp, "/");
-        while (token) {
-            if (strlen(compact_path) > 0)
-                strcat(compact_path, "/");
-
-            if (strlen(token) > 1)
-                strncat(compact_path, token, 1);
-            else
-                strcat(compact_path, token);
-
-            token = strtok(NULL, "/");
+    // outside $HOME, shorten every component to its first letter
+    if (prompt_display_path[0] != '~') {
+        char *out = prompt_compact_path;
+        const char *p = prompt_display_path;
+        while (*p) {
+            while (*p == '/') p++;
+            if (!*p) break;
+            if (out != prompt_compact_path) *out++ = '/';
+            *out++ = *p;
+            p += strcspn(p, "/");
         }
+        *out = '\0';
     } else {
-        strncpy(compact_path, display_path, sizeof(compact_path));
-        compact_path[sizeof(compact_path) - 1] = '\0';
+        snprintf(prompt_compact_path, sizeof(prompt_compact_path), "%s", prompt_display_path);
     }
 
-    printf("%s@%s %s > ", user, hostname, compact_path);
+    prompt_find_git(cwd);
     free(cwd);
+    prompt_cwd_dirty = 0;
+}
+
+static size_t prompt_append(size_t pos, const char *s) {
+    size_t len = strlen(s);
+    if (pos + len >= sizeof(prompt_buf))
+        len = sizeof(prompt_buf) - 1 - pos;
+    memcpy(prompt_buf + pos, s, len);
+    return pos + len;
 }
+
+// Re-renders prompt_buf from the cached segments.
+void render_prompt(void) {
+    if (!prompt_user[0])
+        prompt_load_identity();
+    if (prompt_cwd_dirty)
+        prompt_refresh_cwd();
+
+    const char *fmt = getenv("MYSHELL_PROMPT");
+    if (!fmt) fmt = PROMPT_DEFAULT_FORMAT;
+
+    size_t pos = 0;
+    char seg[PATH_MAX + 16];
+    for (const char *f = fmt; *f && pos < sizeof(prompt_buf) - 1; f++) {
+        if (*f != '%' || f[1] == '\0') {
+            prompt_buf[pos++] = *f;
+            continue;
+        }
+        seg[0] = '\0';
+        switch (*++f) {
+        case 'u': pos = prompt_append(pos, prompt_user); break;
+        case 'h': pos = prompt_append(pos, prompt_host); break;
+        case 'w': pos = prompt_append(pos, prompt_compact_path); break;
+        case 'W': pos = prompt_append(pos, prompt_display_path); break;
+        case 'g':
+            prompt_refresh_git();
+            if (prompt_git_branch[0])
+                snprintf(seg, sizeof(seg), " (%s)", prompt_git_branch);
+            pos = prompt_append(pos, seg);
+            break;
+        case 'v':
+            if (env_path) {
+                const char *name = strrchr(env_path, '/');
+                snprintf(seg, sizeof(seg), "(%s) ", name ? name + 1 : env_path);
+            }
+            pos = prompt_append(pos, seg);
+            break;
+        case '?':
+            if (last_status != 0)
+                snprintf(seg, sizeof(seg), " [%d]", last_status);
+            pos = prompt_append(pos, seg);
+            break;
+        case 'd':
+            if (last_duration >= 60)
+                snprintf(seg, sizeof(seg), " %dm%02ds", (int)last_duration / 60, (int)last_duration % 60);
+            else if (last_duration >= 1)
+                snprintf(seg, sizeof(seg), " %.1fs", last_duration);
+            pos = prompt_append(pos, seg);
+            break;
+        case '%': prompt_buf[pos++] = '%'; break;
+        default:
+            prompt_buf[pos++] = '%';
+            if (pos < sizeof(prompt_buf) - 1) prompt_buf[pos++] = *f;
+            break;
+        }
+    }
+    prompt_buf[pos] = '\0';
+}
+
+#endif
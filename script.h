@@ -0,0 +1,130 @@
+#ifndef SCRIPT_H
+#define SCRIPT_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "exec.h"
+#include "jobs.h"
+#include "lexer.h"
+#include "stats.h"
+
+// ---------------- Scripts -----------------
+//
+// Non-interactive input (a script file, -c, or stdin that is not a
+// terminal) bypasses the line editor: it is read in large blocks and every
+// complete command line in a block is run back to back, with no prompt,
+// terminal modes or history in between. A line that continues (open quote,
+// trailing |, unclosed parenthesis, backslash-newline) is run once the
+// block holds all of it.
+//
+// Unlike bash, stdin is not re-read byte by byte, so a command run from a
+// script piped into the shell does not see the rest of the script.
+
+#define SCRIPT_BLOCK (64 * 1024)
+
+void commands_operator(char *input);
+
+static void script_run_line(char *line) {
+    while (lex_is_blank(*line)) line++;
+    if (*line == '\0')
+        return;
+    if (stats_enabled) {
+        UsageMark mark;
+        CmdUsage usage;
+        usage_begin(&mark);
+        commands_operator(line);
+        usage_end(&mark, &usage);
+        stats_record(line, &usage, last_status);
+    } else {
+        commands_operator(line);
+    }
+    if (job_first)
+        jobs_discard_done();
+}
+
+// Runs the complete lines at the front of buf[0..len) and returns how many
+// bytes they took. At end of input the rest counts as a line too. buf must
+// have room for a NUL at buf[len].
+static size_t script_run_buffer(char *buf, size_t len, int eof) {
+    size_t start = 0, scan = 0;
+    while (start < len && !exit_requested) {
+        char *nl = memchr(buf + scan, '\n', len - scan);
+        if (!nl && !eof)
+            break;
+        size_t end = nl ? (size_t)(nl - buf) : len;
+        if (nl && lex_needs_more(buf + start, end - start)) {
+            scan = end + 1;     // keep the newline, the command goes on
+            continue;
+        }
+        buf[end] = '\0';
+        script_run_line(buf + start);
+        start = scan = end + 1;
+    }
+    return start < len ? start : len;
+}
+
+// Runs every command read from fd until end of input or `exit`.
+static void script_run_fd(int fd) {
+    size_t cap = SCRIPT_BLOCK, len = 0;
+    char *buf = malloc(cap);
+    if (!buf) {
+        perror("malloc failed");
+        exit(1);
+    }
+    int eof = 0;
+    while (!eof && !exit_requested) {
+        if (cap - len < SCRIPT_BLOCK / 2) {
+            // one command longer than what is left of the buffer
+            cap *= 2;
+            char *grown = realloc(buf, cap);
+            if (!grown) {
+                perror("realloc failed");
+                exit(1);
+            }
+            buf = grown;
+        }
+        ssize_t n = read(fd, buf + len, cap - len - 1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("myshell: read");
+            break;
+        }
+        eof = n == 0;
+        len += (size_t)n;
+        size_t used = script_run_buffer(buf, len, eof);
+        memmove(buf, buf + used, len - used);
+        len -= used;
+    }
+    free(buf);
+}
+
+// Runs a -c argument, which may hold several lines.
+static void script_run_string(const char *s) {
+    size_t len = strlen(s);
+    char *buf = malloc(len + 1);
+    if (!buf) {
+        perror("malloc failed");
+        exit(1);
+    }
+    memcpy(buf, s, len + 1);
+    script_run_buffer(buf, len, 1);
+    free(buf);
+}
+
+// Runs the script at path; 127 if it cannot be opened, like sh.
+static int script_run_file(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "myshell: %s: %s\n", path, strerror(errno));
+        return 127;
+    }
+    script_run_fd(fd);
+    close(fd);
+    return last_status;
+}
+
+#endif
@@ -0,0 +1,383 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "history.h"
+
+// ---------------- Command Telemetry -----------------
+//
+// Every command line run is logged next to the history file: <history>.stats
+// holds one fixed-size record per line and <history>.stats.str the strings
+// the records point at (the line itself and the cwd, which is written
+// again only when it changes). Both files are append-only. A record is
+// one O_APPEND write, so concurrent shells never tear each other's records.
+// The string file is appended under flock, because a record needs the
+// offset.
+//
+// `stats` mmaps both files and makes a single pass over the records. Per
+// command name it keeps counts and a log-scale histogram of durations (four
+// equal-width buckets per power of two; a percentile is reported as its
+// bucket's upper bound, so it can read up to 25% high), plus a heap of the
+// slowest lines. Memory does not grow with the size of the log.
+//
+// Lines are logged in interactive sessions. Set MYSHELL_STATS=1 to log
+// script and -c lines too, or MYSHELL_STATS=0 to log nothing.
+
+#define STATS_NAME_LEN 20
+
+typedef struct {
+    int64_t start_us;           // wall clock, microseconds since the epoch
+    uint64_t wall_us;
+    uint64_t cpu_us;            // user + sys of the shell and its children
+    uint64_t line_off;          // offsets into the .str file
+    uint64_t cwd_off;
+    int32_t status;
+    char name[STATS_NAME_LEN];  // first word, NUL-padded, may be truncated
+} StatsRecord;
+
+_Static_assert(sizeof(StatsRecord) == 64, "stats records are 64 bytes");
+
+static int stats_enabled = 0;
+static int stats_fd = -1, stats_str_fd = -1;
+static int stats_failed = 0;        // could not open the files; stop trying
+static char *stats_cwd = NULL;      // cwd as last written, and where
+static uint64_t stats_cwd_off;
+
+static char *stats_path(const char *suffix) {
+    return history_file_path(suffix);
+}
+
+// Decides once whether this shell logs: MYSHELL_STATS if set, otherwise
+// only when interactive.
+static void stats_init(int interactive) {
+    const char *env = getenv("MYSHELL_STATS");
+    stats_enabled = env && *env ? strcmp(env, "0") != 0 : interactive;
+}
+
+static int stats_open(void) {
+    if (stats_fd >= 0) return 0;
+    if (stats_failed) return -1;
+    char *path = stats_path(".stats");
+    char *str_path = stats_path(".stats.str");
+    if (path && str_path) {
+        stats_fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+        stats_str_fd = open(str_path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    }
+    free(path);
+    free(str_path);
+    if (stats_fd < 0 || stats_str_fd < 0) {
+        if (stats_fd >= 0) close(stats_fd);
+        if (stats_str_fd >= 0) close(stats_str_fd);
+        stats_fd = stats_str_fd = -1;
+        stats_failed = 1;
+        return -1;
+    }
+    return 0;
+}
+
+// Appends s and its NUL to the string file; returns its offset, or
+// UINT64_MAX if it could not be written.
+static uint64_t stats_add_string(const char *s) {
+    size_t len = strlen(s) + 1;
+    uint64_t off = UINT64_MAX;
+    flock(stats_str_fd, LOCK_EX);
+    struct stat st;
+    if (fstat(stats_str_fd, &st) == 0 && write(stats_str_fd, s, len) == (ssize_t)len)
+        off = (uint64_t)st.st_size;
+    flock(stats_str_fd, LOCK_UN);
+    return off;
+}
+
+// The command name of a line: its first word that is not `time` or an
+// assignment.
+static void stats_name(const char *line, char *name) {
+    memset(name, 0, STATS_NAME_LEN);
+    const char *p = line;
+    for (;;) {
+        while (*p == ' ' || *p == '\t' || *p == '(') p++;
+        const char *w = p;
+        while (*p && !strchr(" \t\n|&;<>()", *p)) p++;
+        size_t len = (size_t)(p - w);
+        if (len == 0) return;
+        if ((len == 4 && memcmp(w, "time", 4) == 0) || memchr(w, '=', len))
+            continue;
+        memcpy(name, w, len < STATS_NAME_LEN - 1 ? len : STATS_NAME_LEN - 1);
+        return;
+    }
+}
+
+static void stats_record(const char *line, const CmdUsage *u, int status) {
+    if (!stats_enabled || stats_open() < 0) return;
+
+    char *cwd = getcwd(NULL, 0);
+    if (cwd && (!stats_cwd || strcmp(cwd, stats_cwd) != 0)) {
+        free(stats_cwd);
+        stats_cwd = cwd;
+        stats_cwd_off = stats_add_string(cwd);
+    } else {
+        free(cwd);
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    StatsRecord r;
+    memset(&r, 0, sizeof(r));
+    r.wall_us = (uint64_t)(u->real * 1e6);
+    r.start_us = (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000 - (int64_t)r.wall_us;
+    r.cpu_us = (uint64_t)((u->user + u->sys) * 1e6);
+    r.status = status;
+    r.cwd_off = stats_cwd ? stats_cwd_off : UINT64_MAX;
+    r.line_off = stats_add_string(line);
+    stats_name(line, r.name);
+    if (write(stats_fd, &r, sizeof(r)) != (ssize_t)sizeof(r))
+        perror("stats");
+}
+
+// --- stats builtin ---
+
+#define STATS_BUCKETS 256
+
+typedef struct {
+    char name[STATS_NAME_LEN];
+    uint64_t count, failures, total_us, max_us;
+    uint32_t hist[STATS_BUCKETS];
+} StatsName;
+
+static inline uint64_t stats_hash(const char *s) {
+    uint64_t h = 1469598103934665603ULL;
+    while (*s) h = (h ^ (unsigned char)*s++) * 1099511628211ULL;
+    return h;
+}
+
+static inline int stats_bucket(uint64_t us) {
+    if (us < 4) return (int)us;
+    int msb = 63 - __builtin_clzll(us);
+    int b = msb * 4 + (int)((us >> (msb - 2)) & 3);
+    return b < STATS_BUCKETS ? b : STATS_BUCKETS - 1;
+}
+
+// Largest duration that falls in bucket b.
+static uint64_t stats_bucket_upper(int b) {
+    if (b < 4) return (uint64_t)b;
+    int msb = b / 4;
+    return ((uint64_t)(4 + b % 4 + 1) << (msb - 2)) - 1;
+}
+
+static uint64_t stats_percentile(const StatsName *n, double pct) {
+    uint64_t want = (uint64_t)(n->count * pct + 0.999999), seen = 0;
+    if (want == 0) want = 1;
+    for (int b = 0; b < STATS_BUCKETS; b++) {
+        seen += n->hist[b];
+        if (seen >= want) {
+            uint64_t upper = stats_bucket_upper(b);
+            return upper < n->max_us ? upper : n->max_us;
+        }
+    }
+    return n->max_us;
+}
+
+static const char *stats_duration(uint64_t us, char *buf, size_t size) {
+    if (us < 1000)
+        snprintf(buf, size, "%lluus", (unsigned long long)us);
+    else if (us < 1000000)
+        snprintf(buf, size, "%.1fms", us / 1e3);
+    else if (us < 60000000)
+        snprintf(buf, size, "%.2fs", us / 1e6);
+    else
+        snprintf(buf, size, "%llum%02llus", (unsigned long long)(us / 60000000),
+                 (unsigned long long)(us / 1000000 % 60));
+    return buf;
+}
+
+static const char *stats_string(const char *strs, size_t size, uint64_t off) {
+    if (!strs || off >= size || !memchr(strs + off, '\0', size - off))
+        return "?";
+    return strs + off;
+}
+
+static void *stats_map(const char *suffix, size_t *size) {
+    *size = 0;
+    char *path = stats_path(suffix);
+    int fd = path ? open(path, O_RDONLY | O_CLOEXEC) : -1;
+    free(path);
+    if (fd < 0) return NULL;
+    struct stat st;
+    void *map = NULL;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED) map = NULL;
+        else *size = (size_t)st.st_size;
+    }
+    close(fd);
+    return map;
+}
+
+static int stats_cmp_total(const void *a, const void *b) {
+    const StatsName *x = *(StatsName *const *)a, *y = *(StatsName *const *)b;
+    return (x->total_us < y->total_us) - (x->total_us > y->total_us);
+}
+
+// Min-heap on wall time holding the n slowest records seen so far.
+static void stats_heap_push(const StatsRecord **heap, size_t *len, size_t n, const StatsRecord *r) {
+    size_t i;
+    if (*len < n) {
+        i = (*len)++;
+        while (i > 0 && heap[(i - 1) / 2]->wall_us > r->wall_us) {
+            heap[i] = heap[(i - 1) / 2];
+            i = (i - 1) / 2;
+        }
+        heap[i] = r;
+        return;
+    }
+    if (n == 0 || r->wall_us <= heap[0]->wall_us) return;
+    i = 0;
+    for (;;) {
+        size_t c = 2 * i + 1;
+        if (c >= *len) break;
+        if (c + 1 < *len && heap[c + 1]->wall_us < heap[c]->wall_us) c++;
+        if (heap[c]->wall_us >= r->wall_us) break;
+        heap[i] = heap[c];
+        i = c;
+    }
+    heap[i] = r;
+}
+
+static int stats_cmp_slowest(const void *a, const void *b) {
+    const StatsRecord *x = *(const StatsRecord *const *)a, *y = *(const StatsRecord *const *)b;
+    return (x->wall_us < y->wall_us) - (x->wall_us > y->wall_us);
+}
+
+// stats [-n N] [name]: the N slowest lines and the busiest command names,
+// or only the lines of one command.
+int stats_commands(char **args) {
+    size_t top = 10;
+    const char *only = NULL;
+    for (int i = 1; args[i]; i++) {
+        if (strcmp(args[i], "-n") == 0 && args[i + 1]) {
+            top = (size_t)atol(args[++i]);
+        } else if (args[i][0] == '-') {
+            fprintf(stderr, "usage: stats [-n N] [name]\n");
+            return 2;
+        } else {
+            only = args[i];
+        }
+    }
+
+    size_t size, str_size;
+    const StatsRecord *recs = stats_map(".stats", &size);
+    const char *strs = stats_map(".stats.str", &str_size);
+    size_t nrecs = size / sizeof(StatsRecord);
+    if (nrecs == 0) {
+        printf("stats: no commands recorded yet\n");
+        if (recs) munmap((void *)recs, size);
+        if (strs) munmap((void *)strs, str_size);
+        return 0;
+    }
+
+    // open addressing on the name; the table doubles at half full
+    size_t cap = 256, used = 0;
+    StatsName **names = calloc(cap, sizeof(StatsName *));
+    const StatsRecord **heap = calloc(top ? top : 1, sizeof(StatsRecord *));
+    if (!names || !heap) {
+        perror("malloc failed");
+        exit(1);
+    }
+    size_t heap_len = 0, matched = 0;
+    for (size_t i = 0; i < nrecs; i++) {
+        const StatsRecord *r = &recs[i];
+        char name[STATS_NAME_LEN];
+        memcpy(name, r->name, STATS_NAME_LEN);
+        name[STATS_NAME_LEN - 1] = '\0';
+        if (only && strcmp(name, only) != 0) continue;
+        matched++;
+        stats_heap_push(heap, &heap_len, top, r);
+
+        if (used * 2 >= cap) {
+            StatsName **grown = calloc(cap * 2, sizeof(StatsName *));
+            if (!grown) {
+                perror("malloc failed");
+                exit(1);
+            }
+            for (size_t k = 0; k < cap; k++) {
+                if (!names[k]) continue;
+                size_t h = stats_hash(names[k]->name) & (cap * 2 - 1);
+                while (grown[h]) h = (h + 1) & (cap * 2 - 1);
+                grown[h] = names[k];
+            }
+            free(names);
+            names = grown;
+            cap *= 2;
+        }
+        size_t h = stats_hash(name) & (cap - 1);
+        while (names[h] && strcmp(names[h]->name, name) != 0)
+            h = (h + 1) & (cap - 1);
+        if (!names[h]) {
+            names[h] = calloc(1, sizeof(StatsName));
+            if (!names[h]) {
+                perror("malloc failed");
+                exit(1);
+            }
+            memcpy(names[h]->name, name, STATS_NAME_LEN);
+            used++;
+        }
+        StatsName *n = names[h];
+        n->count++;
+        n->failures += r->status != 0;
+        n->total_us += r->wall_us;
+        if (r->wall_us > n->max_us) n->max_us = r->wall_us;
+        n->hist[stats_bucket(r->wall_us)]++;
+    }
+
+    char when[32], d1[32], d2[32], d3[32];
+    time_t first = (time_t)(recs[0].start_us / 1000000);
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M", localtime(&first));
+    printf("%zu commands since %s\n", matched, when);
+
+    qsort(heap, heap_len, sizeof(*heap), stats_cmp_slowest);
+    if (heap_len) printf("\nslowest:\n");
+    for (size_t i = 0; i < heap_len; i++) {
+        const StatsRecord *r = heap[i];
+        time_t t = (time_t)(r->start_us / 1000000);
+        strftime(when, sizeof(when), "%m-%d %H:%M", localtime(&t));
+        printf("%10s %4d  %s  %s  (%s)\n", stats_duration(r->wall_us, d1, sizeof(d1)), r->status, when,
+               stats_string(strs, str_size, r->line_off), stats_string(strs, str_size, r->cwd_off));
+    }
+
+    StatsName **list = malloc((used ? used : 1) * sizeof(StatsName *));
+    if (!list) {
+        perror("malloc failed");
+        exit(1);
+    }
+    size_t nlist = 0;
+    for (size_t k = 0; k < cap; k++)
+        if (names[k]) list[nlist++] = names[k];
+    qsort(list, nlist, sizeof(*list), stats_cmp_total);
+    printf("\n%-20s %8s %6s %10s %10s %10s\n", "command", "runs", "fail%", "p50", "p95", "total");
+    for (size_t i = 0; i < nlist && (only || i < top); i++) {
+        StatsName *n = list[i];
+        printf("%-20s %8llu %5.1f%% %10s %10s %10s\n", n->name, (unsigned long long)n->count,
+               100.0 * n->failures / n->count,
+               stats_duration(stats_percentile(n, 0.50), d1, sizeof(d1)),
+               stats_duration(stats_percentile(n, 0.95), d2, sizeof(d2)),
+               stats_duration(n->total_us, d3, sizeof(d3)));
+    }
+
+    for (size_t k = 0; k < cap; k++) free(names[k]);
+    free(names);
+    free(list);
+    free(heap);
+    munmap((void *)recs, size);
+    if (strs) munmap((void *)strs, str_size);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,203 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// ---------------- Thread Pool -----------------
+//
+// A small work-stealing pool for builtins that walk large trees (rmdir,
+// cp -r). Every worker owns a deque: it pushes and pops new tasks at the
+// bottom, so each worker goes depth-first through its own part of the tree,
+// and idle workers steal from the top of someone else's deque, which takes
+// the oldest (usually largest) subtree. The calling thread is worker 0, so
+// a pool of one runs everything inline without creating threads.
+//
+// Tasks may submit more tasks; pool_run returns once every task submitted
+// has finished.
+
+typedef void (*pool_task_fn)(void *arg, int worker);
+
+typedef struct {
+    pool_task_fn fn;
+    void *arg;
+} PoolTask;
+
+typedef struct {
+    pthread_mutex_t lock;
+    PoolTask *items;
+    size_t head;          // steal end
+    size_t tail;          // owner end
+    size_t cap;
+} PoolDeque;
+
+typedef struct {
+    int nworkers;
+    PoolDeque *deques;
+    atomic_size_t pending;   // submitted but not finished
+    atomic_size_t queued;    // sitting in a deque
+    atomic_int sleepers;
+    pthread_mutex_t idle_lock;
+    pthread_cond_t idle_cond;
+} ThreadPool;
+
+// Number of online CPUs, at least 1.
+static int pool_default_workers(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
+static ThreadPool *pool_create(int nworkers) {
+    if (nworkers < 1) nworkers = 1;
+    ThreadPool *pool = calloc(1, sizeof(ThreadPool));
+    if (!pool) return NULL;
+    pool->deques = calloc((size_t)nworkers, sizeof(PoolDeque));
+    if (!pool->deques) {
+        free(pool);
+        return NULL;
+    }
+    pool->nworkers = nworkers;
+    for (int i = 0; i < nworkers; i++)
+        pthread_mutex_init(&pool->deques[i].lock, NULL);
+    pthread_mutex_init(&pool->idle_lock, NULL);
+    pthread_cond_init(&pool->idle_cond, NULL);
+    return pool;
+}
+
+static void pool_destroy(ThreadPool *pool) {
+    if (!pool) return;
+    for (int i = 0; i < pool->nworkers; i++) {
+        pthread_mutex_destroy(&pool->deques[i].lock);
+        free(pool->deques[i].items);
+    }
+    pthread_mutex_destroy(&pool->idle_lock);
+    pthread_cond_destroy(&pool->idle_cond);
+    free(pool->deques);
+    free(pool);
+}
+
+static void pool_wake(ThreadPool *pool, int all) {
+    if (atomic_load(&pool->sleepers) == 0)
+        return;
+    pthread_mutex_lock(&pool->idle_lock);
+    if (all)
+        pthread_cond_broadcast(&pool->idle_cond);
+    else
+        pthread_cond_signal(&pool->idle_cond);
+    pthread_mutex_unlock(&pool->idle_lock);
+}
+
+// Queues fn(arg) on worker's deque. Call from inside a task with the
+// worker number it was given, or with 0 before pool_run.
+static void pool_submit(ThreadPool *pool, int worker, pool_task_fn fn, void *arg) {
+    PoolDeque *dq = &pool->deques[worker];
+    // count it first so a thief cannot finish it before it is counted
+    atomic_fetch_add(&pool->pending, 1);
+    atomic_fetch_add(&pool->queued, 1);
+    pthread_mutex_lock(&dq->lock);
+    if (dq->tail == dq->cap) {
+        // slide live items to the front before growing
+        size_t live = dq->tail - dq->head;
+        if (dq->head > 0 && live < dq->cap / 2) {
+            memmove(dq->items, dq->items + dq->head, live * sizeof(PoolTask));
+        } else {
+            size_t cap = dq->cap ? dq->cap * 2 : 64;
+            PoolTask *items = realloc(dq->items, cap * sizeof(PoolTask));
+            if (!items) {
+                perror("realloc failed");
+                exit(1);
+            }
+            memmove(items, items + dq->head, live * sizeof(PoolTask));
+            dq->items = items;
+            dq->cap = cap;
+        }
+        dq->head = 0;
+        dq->tail = live;
+    }
+    dq->items[dq->tail++] = (PoolTask){fn, arg};
+    pthread_mutex_unlock(&dq->lock);
+    pool_wake(pool, 0);
+}
+
+static int pool_take(ThreadPool *pool, int worker, PoolTask *out) {
+    PoolDeque *own = &pool->deques[worker];
+    pthread_mutex_lock(&own->lock);
+    if (own->tail > own->head) {
+        *out = own->items[--own->tail];
+        pthread_mutex_unlock(&own->lock);
+        atomic_fetch_sub(&pool->queued, 1);
+        return 1;
+    }
+    pthread_mutex_unlock(&own->lock);
+
+    for (int i = 1; i < pool->nworkers; i++) {
+        PoolDeque *dq = &pool->deques[(worker + i) % pool->nworkers];
+        pthread_mutex_lock(&dq->lock);
+        if (dq->tail > dq->head) {
+            *out = dq->items[dq->head++];
+            pthread_mutex_unlock(&dq->lock);
+            atomic_fetch_sub(&pool->queued, 1);
+            return 1;
+        }
+        pthread_mutex_unlock(&dq->lock);
+    }
+    return 0;
+}
+
+static void pool_worker_loop(ThreadPool *pool, int worker) {
+    PoolTask task;
+    for (;;) {
+        if (pool_take(pool, worker, &task)) {
+            task.fn(task.arg, worker);
+            if (atomic_fetch_sub(&pool->pending, 1) == 1)
+                pool_wake(pool, 1);
+            continue;
+        }
+        if (atomic_load(&pool->pending) == 0)
+            return;
+
+        pthread_mutex_lock(&pool->idle_lock);
+        atomic_fetch_add(&pool->sleepers, 1);
+        if (atomic_load(&pool->queued) == 0 && atomic_load(&pool->pending) != 0)
+            pthread_cond_wait(&pool->idle_cond, &pool->idle_lock);
+        atomic_fetch_sub(&pool->sleepers, 1);
+        pthread_mutex_unlock(&pool->idle_lock);
+    }
+}
+
+typedef struct {
+    ThreadPool *pool;
+    int worker;
+} PoolWorkerArg;
+
+static void *pool_thread_main(void *p) {
+    PoolWorkerArg *a = p;
+    pool_worker_loop(a->pool, a->worker);
+    return NULL;
+}
+
+// Runs the queued tasks (and everything they submit) to completion on
+// nworkers threads, the caller included.
+static void pool_run(ThreadPool *pool) {
+    int n = pool->nworkers;
+    pthread_t *threads = calloc((size_t)n, sizeof(pthread_t));
+    PoolWorkerArg *args = calloc((size_t)n, sizeof(PoolWorkerArg));
+    int started = 0;
+    for (int i = 1; threads && args && i < n; i++) {
+        args[i] = (PoolWorkerArg){pool, i};
+        if (pthread_create(&threads[i], NULL, pool_thread_main, &args[i]) != 0)
+            break;      // fewer threads; the others pick up the slack
+        started = i;
+    }
+    pool_worker_loop(pool, 0);
+    for (int i = 1; i <= started; i++)
+        pthread_join(threads[i], NULL);
+    free(threads);
+    free(args);
+}
+
+#endif